@@ -0,0 +1,275 @@
+#!/usr/bin/env python3
+# vim:fileencoding=utf-8
+# License: GPL v3 Copyright: 2017, Kovid Goyal <kovid at kovidgoyal.net>
+
+import os
+import sys
+from time import monotonic
+
+base = os.path.dirname(os.path.abspath(__file__))
+benchmarks = {}
+
+
+def init_env():
+    sys.path.insert(0, base)
+
+
+def benchmark(func):
+    benchmarks[func.__name__] = func
+    return func
+
+
+def timed(name, func, *args, repeat=1, **kw):
+    best = float('inf')
+    for i in range(repeat):
+        st = monotonic()
+        func(*args, **kw)
+        best = min(best, monotonic() - st)
+    print('  {:<40} {:10.4f} s'.format(name, best))
+    return best
+
+
+def filled_screen(lines=50, columns=200, scrollback=100000):
+    from kitty.fast_data_types import Screen, parse_bytes
+    s = Screen(None, lines, columns, scrollback)
+    line = ('x' * (columns // 2 - 1) + ' ') * 2 + '\r\n'
+    chunk = line.encode('utf-8') * 1000
+    for i in range(scrollback // 1000 + 1):
+        parse_bytes(s, chunk)
+    return s
+
+
+@benchmark
+def resize(num=20):
+    '''Consecutive resizes of a screen with a full scrollback, as happens
+    during an interactive resize, compared to a single coalesced resize'''
+    s, s2 = filled_screen(), filled_screen()
+    sizes = [(s.lines + i % 5, s.columns - 2 * (i % 7) - 1) for i in range(num)]
+
+    def every():
+        for lines, columns in sizes:
+            s.resize(lines, columns)
+
+    def coalesced():
+        s2.resize(*sizes[-1])
+
+    def scroll_to_top():
+        s.scroll(s.historybuf.ynum, True)
+
+    timed('{} resizes'.format(num), every)
+    timed('1 coalesced resize', coalesced)
+    timed('scroll to top after resizing', scroll_to_top)
+
+
+@benchmark
+def selection():
+    '''Getting the text of a multi-megabyte selection spanning the entire
+    scrollback, as a single buffer and in chunks'''
+    s = filled_screen()
+    s.scroll(s.historybuf.ynum, True)
+    s.start_selection(0, 0)
+    s.scroll(s.historybuf.ynum, False)
+    s.update_selection(s.columns - 1, s.lines - 1, True)
+    size = len(s.text_for_selection())
+
+    def chunked():
+        s.text_for_selection(lambda chunk: None)
+
+    timed('{:.1f} MB as bytes'.format(size / 1e6), s.text_for_selection, repeat=5)
+    timed('{:.1f} MB in chunks'.format(size / 1e6), chunked, repeat=5)
+    timed('{:.1f} MB as str'.format(size / 1e6), lambda: s.text_for_selection().decode('utf-8'), repeat=5)
+
+
+def source_code_screen(in_memory_lines=0, scrollback=100000):
+    # A screen whose scrollback is filled with source code, colored the way a
+    # pager or editor would
+    from kitty.fast_data_types import Screen, parse_bytes
+    s = Screen(None, 50, 200, scrollback)
+    s.historybuf.in_memory_lines = in_memory_lines
+    text = b''
+    for name in sorted(os.listdir(os.path.join(base, 'kitty'))):
+        if name.endswith('.c'):
+            with open(os.path.join(base, 'kitty', name), 'rb') as f:
+                text += f.read()
+    text = text.replace(b'static', b'\x1b[32mstatic\x1b[m').replace(b'return', b'\x1b[1;33mreturn\x1b[m').replace(b'\n', b'\r\n')
+    while s.historybuf.count < s.historybuf.ynum:
+        parse_bytes(s, text)
+    return s
+
+
+@benchmark
+def scrollback():
+    '''The compression ratio of a full scrollback and the latency of a page
+    scroll into compressed, decompressed and spilled to disk parts of it'''
+    for in_memory_lines in (0, 1000):
+        s = source_code_screen(in_memory_lines)
+        hb = s.historybuf
+        st = monotonic()
+        stats = hb.compression_stats(True)
+        if in_memory_lines:
+            print('  {} segments spilled to disk'.format(stats['spilled']))
+        else:
+            print('  {:<40} {:10.4f} s'.format('wait for compression', monotonic() - st))
+            print('  {:<40} {:10.1f} x'.format('compression ratio', stats['raw_size'] / max(1, stats['compressed_size'])))
+            print('  {:<40} {:10.1f} MB'.format('compressed size', stats['compressed_size'] / 1e6))
+        pages = iter(range(hb.count - s.lines, 0, -10 * s.lines))
+
+        def page_scroll(top=None):
+            top = next(pages) if top is None else top
+            for i in range(s.lines):
+                hb.line(top + i)
+
+        timed('page scroll, ' + ('on disk' if in_memory_lines else 'compressed'), page_scroll, repeat=20)
+        timed('page scroll, decompressed', page_scroll, hb.count // 2, repeat=20)
+
+
+@benchmark
+def search():
+    '''Searching a scrollback of a million lines for rare and common text,
+    literally and with regular expressions'''
+    from kitty.search import search
+    s = source_code_screen(scrollback=1000000)
+    s.historybuf.compression_stats(True)
+    for name, query, kw in (
+        ('rare text', 'historybuf_materialize', {}),
+        ('absent text', 'no such text', {}),
+        ('rare text, ignoring case', 'HISTORYBUF_MATERIALIZE', {'case_sensitive': False}),
+        ('regex', r'historybuf_\w+\(self', {'regex': True}),
+        ('common text, newest 100', 'static', {'limit': 100}),
+        ('common text', 'static', {}),
+    ):
+        timed('{} ({} matches)'.format(name, len(search(s, query, **kw))), search, s, query, repeat=3, **kw)
+
+
+@benchmark
+def ring(total=1000 * 1000 * 1000):
+    '''Throughput of the lock-free ring that input from children is handed
+    over in, from the I/O thread to the main thread, for typical read sizes'''
+    from kitty.fast_data_types import test_byte_ring
+    for capacity, max_chunk in ((1024 * 1024, 4096), (1024 * 1024, 65536), (64 * 1024, 4096)):
+        t = timed('{} KB ring, chunks up to {} KB'.format(capacity // 1024, max_chunk // 1024), test_byte_ring, total, capacity, max_chunk, 1, repeat=3)
+        print('  {:<40} {:10.1f} GB/s'.format('throughput', total / t / 1e9))
+
+
+def spawn(cmd):
+    # A program running in a pty, as in a kitty window
+    pid, fd = os.forkpty()
+    if pid == 0:
+        os.execvp('/bin/sh', ['/bin/sh', '-c', cmd])
+    return pid, fd
+
+
+@benchmark
+def echo_latency(keystrokes=100):
+    '''The latency of echoing key presses in the focused window, while other
+    windows are flooded with output'''
+    from kitty.fast_data_types import ChildMonitor, Screen, add_tab, add_window, set_active_window
+    deaths = []
+    cm = ChildMonitor(0, deaths.append, None)
+    cm.start()
+    add_tab(1)
+
+    def wait_for(condition, timeout=60):
+        end = monotonic() + timeout
+        while not condition():
+            cm.parse_input()
+            if monotonic() > end:
+                raise SystemExit('Timed out waiting for the children')
+
+    def add(wid, cmd):
+        s = Screen(None, 24, 80, 2000)
+        pid, fd = spawn(cmd)
+        add_window(1, wid, 'w')
+        cm.add_child(wid, pid, fd, s)
+        return s
+
+    echo = add(1, 'stty raw -echo; echo ready; exec cat')
+    set_active_window(1, 0)
+    wait_for(lambda: str(echo.line(0)) == 'ready')
+    flooders = []
+    for num in (0, 4, 16):
+        while len(flooders) < num:
+            flooders.append(add(len(flooders) + 2, 'exec yes "The quick brown fox jumps over the lazy dog"'))
+        wait_for(lambda: all(s.historybuf.count for s in flooders))
+        latencies = []
+        for i in range(keystrokes):
+            ch = 'ab'[i % 2]
+            st = monotonic()
+            cm.needs_write(1, ('\r' + ch).encode('ascii'))
+            wait_for(lambda: str(echo.line(echo.cursor.y)).startswith(ch))
+            latencies.append(monotonic() - st)
+        latencies.sort()
+        print('  {:<40} {:7.2f} ms median {:7.2f} ms p99 {:7.2f} ms max'.format(
+            'with {} flooding windows'.format(num), 1000 * latencies[len(latencies) // 2],
+            1000 * latencies[int(len(latencies) * 0.99)], 1000 * latencies[-1]))
+    for wid in range(1, len(flooders) + 2):
+        cm.mark_for_close(wid)
+    wait_for(lambda: len(deaths) == len(flooders) + 1)
+    cm.shutdown()
+    cm.wakeup()
+    cm.join()
+
+
+@benchmark
+def headless(duration=3):
+    '''The frames rendered and the latencies of windows flooded with output,
+    running the main loop headless, with the cell data of frames prepared
+    by the null renderer'''
+    from kitty.config import defaults
+    from kitty.fast_data_types import (
+        ChildMonitor, Screen, add_tab, add_window, set_active_window,
+        set_latency_tracking, set_options, set_window_render_data
+    )
+    set_options(defaults)
+    set_latency_tracking(True)
+    deaths = []
+    cm = ChildMonitor(0, deaths.append, None)
+    cm.start()
+    add_tab(1)
+    screens = []
+    for num in (1, 4, 16):
+        while len(screens) < num:
+            wid = len(screens) + 1
+            s = Screen(None, 24, 80, 2000)
+            pid, fd = spawn('exec yes "The quick brown fox jumps over the lazy dog"')
+            add_window(1, wid, 'w')
+            set_window_render_data(1, wid - 1, 0, 0, -1, 1, 0.025, 0.08, s, 0, 0, 800, 400)
+            cm.add_child(wid, pid, fd, s)
+            screens.append(s)
+        set_active_window(1, 0)
+        before = cm.pacing_stats()['frames']
+        cm.main_loop(duration)
+        frames = sum(cm.pacing_stats()['frames'].values()) - sum(before.values())
+        print('  {:<40} {:10.1f} fps'.format('with {} flooding windows'.format(num), frames / duration))
+        for stage in ('read_to_parse', 'parse_to_present'):
+            st = screens[0].latency_stats()[stage]
+            print('  {:<40} {:7.2f} ms median {:7.2f} ms p99'.format('  focused ' + stage.replace('_', ' '), 1000 * st['p50'], 1000 * st['p99']))
+    for wid in range(1, len(screens) + 1):
+        cm.mark_for_close(wid)
+    while len(deaths) < len(screens):
+        cm.main_loop(0.1)
+    cm.shutdown()
+    cm.wakeup()
+    cm.join()
+    set_latency_tracking(False)
+
+
+def main():
+    import argparse
+    parser = argparse.ArgumentParser()
+    parser.add_argument(
+        'name', nargs='*', default=[],
+        help='The name of the benchmark to run, by default all benchmarks are run. Available: ' + ', '.join(sorted(benchmarks)))
+    args = parser.parse_args()
+    names = args.name or sorted(benchmarks)
+    unknown = [x for x in names if x not in benchmarks]
+    if unknown:
+        raise SystemExit('No benchmark named: %s' % ', '.join(unknown))
+    init_env()
+    for name in names:
+        print(name + ':')
+        benchmarks[name]()
+
+
+if __name__ == '__main__':
+    main()
@@ -2,6 +2,7 @@
 # vim:fileencoding=utf-8
 # License: GPL v3 Copyright: 2016, Kovid Goyal <kovid at kovidgoyal.net>
 
+import json
 from gettext import gettext as _
 from weakref import WeakValueDictionary
 
@@ -9,7 +10,8 @@ from .config import MINIMUM_FONT_SIZE
 from .constants import cell_size, set_boss, viewport_size, wakeup
 from .fast_data_types import (
     GLFW_KEY_DOWN, GLFW_KEY_UP, ChildMonitor, destroy_global_data,
-    destroy_sprite_map, glfw_post_empty_event, layout_sprite_map
+    destroy_sprite_map, glfw_post_empty_event, layout_sprite_map,
+    set_latency_tracking
 )
 from .fonts.render import prerender, resize_fonts, set_font_family
 from .keys import get_key_map, get_shortcut
@@ -63,6 +65,9 @@ class Boss:
         self.window_is_focused = True
         self.glfw_window_title = None
         self.shutting_down = False
+        # The latency stats of closed windows, when they are dumped on exit
+        self.latency_stats = [] if args.dump_latency else None
+        set_latency_tracking(self.latency_stats is not None)
         self.child_monitor = ChildMonitor(
             glfw_window.window_id(),
             self.on_child_death,
@@ -97,8 +102,21 @@ class Boss:
     def on_child_death(self, window_id):
         w = self.window_id_map.pop(window_id, None)
         if w is not None:
+            self.record_latency_stats(w)
             w.on_child_death()
 
+    def record_latency_stats(self, window):
+        if self.latency_stats is not None and window.screen is not None:
+            stats = window.screen.latency_stats()
+            if stats is not None:
+                self.latency_stats.append({'id': window.id, 'title': window.title, 'latency': stats})
+
+    def dump_latency_stats(self):
+        for w in tuple(self.window_id_map.values()):
+            self.record_latency_stats(w)
+        with open(self.args.dump_latency, 'w') as f:
+            json.dump(self.latency_stats, f, indent=2)
+
     def close_window(self, window=None):
         if window is None:
             window = self.active_window
@@ -260,6 +278,8 @@ class Boss:
         self.child_monitor.shutdown()
         wakeup()
         self.child_monitor.join()
+        if self.latency_stats is not None:
+            self.dump_latency_stats()
         self.tab_manager.destroy()
         destroy_sprite_map()
         destroy_global_data()
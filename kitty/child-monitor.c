@@ -17,20 +17,25 @@ extern int pthread_setname_np(const char *name);
 #endif
 #include "state.h"
 #include "screen.h"
+#include "lineops.h"
 #include <termios.h>
 #include <unistd.h>
 #include <float.h>
+#include <math.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#endif
 #include <GLFW/glfw3.h>
 extern PyTypeObject Screen_Type;
 
-#define EXTRA_FDS 2
-#define wakeup_main_loop glfwPostEmptyEvent
-
-static void (*parse_func)(Screen*, PyObject*);
+static void (*parse_func)(Screen*, uint8_t*, size_t, PyObject*);
 
 typedef struct {
     Screen *screen;
@@ -38,6 +43,15 @@ typedef struct {
     int fd;
     unsigned long id;
     pid_t pid;
+    // The events the I/O worker waits for on fd, zero when fd is not registered with its poller
+    int events;
+    bool rearm_queued;
+    // Set by the main thread to move the child to the worker move_to
+    bool needs_move;
+    unsigned int move_to;
+    // The number of reads and writes done for the child, counted by its
+    // worker, and their number in the last rebalancing interval
+    uint64_t load, recent_load;
 } Child;
 
 static const Child EMPTY_CHILD = {0};
@@ -47,17 +61,15 @@ static const Child EMPTY_CHILD = {0};
     pthread_mutex_##op(&children_lock);
 
 
-static Child children[MAX_CHILDREN] = {{0}};
-static Child scratch[MAX_CHILDREN] = {{0}};
-static Child add_queue[MAX_CHILDREN] = {{0}}, remove_queue[MAX_CHILDREN] = {{0}};
-static unsigned long remove_notify[MAX_CHILDREN] = {0};
-static size_t add_queue_count = 0, remove_queue_count = 0;
-static struct pollfd fds[MAX_CHILDREN + EXTRA_FDS] = {{0}};
+// These arrays grow as needed and are never shrunk. They are allocated with
+// the raw allocator since the I/O workers do not hold the GIL. Each worker
+// has its own children, add and rearm queues, see IOWorker.
+static struct { Child *items; size_t capacity; } scratch = {0}, remove_queue = {0};
+static struct { unsigned long *items; size_t capacity; } remove_notify = {0};
+static size_t remove_queue_count = 0;
 static pthread_mutex_t children_lock;
 static bool signal_received = false;
 static ChildMonitor *the_monitor = NULL;
-static uint8_t drain_buf[1024];
-static int signal_fds[2], wakeup_fds[2];
 static void *glfw_window_id = NULL;
 
 
@@ -72,35 +84,182 @@ set_thread_name(const char *name) {
     if (ret != 0) perror("Failed to set thread name");
 }
 
+static inline void
+reap_child(pid_t pid) {
+    int status;
+    while(true) {
+        if (waitpid(pid, &status, WNOHANG) == -1) {
+            if (errno != EINTR) break;
+        } else break;
+    }
+}
 
-// Main thread functions {{{
+// Scheduling {{{
+// So that a few flooding children cannot starve the others, or delay the echo
+// of key presses in the focused window, every child gets a quantum of bytes
+// parsed per tick of the main loop, a larger one for the focused window, which
+// is parsed first. Since the parser accepts any split of the input, the unused
+// part of a quantum never has to be carried over, as in deficit round-robin.
+// The I/O thread stops reading from unfocused children once they have
+// UNFOCUSED_READ_LIMIT bytes waiting to be parsed.
+#define PARSE_QUANTUM (16 * 1024)
+#define FOCUSED_PARSE_WEIGHT 4
+#define UNFOCUSED_READ_LIMIT (256 * 1024)
 
-#define FREE_CHILD(x) \
-    Py_CLEAR((x).screen); x = EMPTY_CHILD;
+static inline bool
+input_over_limit(Screen *screen) {
+    return ring_used(&screen->read_ring) >= __atomic_load_n(&screen->read_limit, __ATOMIC_RELAXED);
+}
 
-#define XREF_CHILD(x, OP) OP(x.screen); 
-#define INCREF_CHILD(x) XREF_CHILD(x, Py_INCREF)
-#define DECREF_CHILD(x) XREF_CHILD(x, Py_DECREF)
+static inline unsigned int
+limit_iov(struct iovec *iov, unsigned int num, size_t limit) {
+    // Shorten the regions in iov to limit bytes in total, returns the new number of regions
+    for (unsigned int i = 0; i < num; i++) {
+        if (iov[i].iov_len >= limit) { iov[i].iov_len = limit; return limit ? i + 1 : i; }
+        limit -= iov[i].iov_len;
+    }
+    return num;
+}
+// }}}
 
-// The max time (in secs) to wait for events from the window system
-// before ticking over the main loop. Negative values mean wait forever.
-static double maximum_wait = -1.0;
+// Child map {{{
+// Maps the id of a child to its worker and its index in the children of the
+// worker. An open addressing hash
+// table with linear probing, whose capacity is a power of two that is kept
+// at least twice the number of children. Ids are never zero, so a zero id
+// marks an empty slot. Must only be used with children_lock held.
 
-static inline void
-set_maximum_wait(double val) {
-    if (val >= 0 && (val < maximum_wait || maximum_wait < 0)) maximum_wait = val;
+typedef struct {
+    unsigned long id;
+    unsigned int worker;
+    size_t idx;
+} ChildSlot;
+
+static struct { ChildSlot *items; size_t capacity, count; } child_map = {0};
+
+static inline size_t
+child_map_home(unsigned long id) {
+    uint64_t h = (uint64_t)id * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h ^ (h >> 32)) & (child_map.capacity - 1);
+}
+
+static inline ChildSlot*
+child_map_slot(unsigned long id) {
+    // The slot holding id or the empty slot where it would be inserted
+    size_t mask = child_map.capacity - 1, s = child_map_home(id);
+    while (child_map.items[s].id && child_map.items[s].id != id) s = (s + 1) & mask;
+    return child_map.items + s;
+}
+
+static ChildSlot*
+child_map_get(unsigned long id) {
+    if (!child_map.count) return NULL;
+    ChildSlot *slot = child_map_slot(id);
+    return slot->id ? slot : NULL;
 }
 
 static void
-handle_signal(int sig_num) {
-    int save_err = errno;
-    unsigned char byte = (unsigned char)sig_num;
-    while(true) {
-        ssize_t ret = write(signal_fds[1], &byte, 1);
-        if (ret < 0 && errno == EINTR) continue;
-        break;
+child_map_set(unsigned long id, unsigned int worker, size_t idx) {
+    if (2 * (child_map.count + 1) > child_map.capacity) {
+        ChildSlot *old = child_map.items;
+        size_t old_capacity = child_map.capacity;
+        child_map.capacity = MAX(64u, 2 * old_capacity);
+        child_map.items = calloc(child_map.capacity, sizeof(ChildSlot));
+        if (child_map.items == NULL) fatal("Out of memory while growing the child map");
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].id) *child_map_slot(old[i].id) = old[i];
+        }
+        free(old);
     }
-    errno = save_err;
+    ChildSlot *slot = child_map_slot(id);
+    if (!slot->id) { slot->id = id; child_map.count++; }
+    slot->worker = worker; slot->idx = idx;
+}
+
+static void
+child_map_remove(unsigned long id) {
+    if (!child_map.count) return;
+    size_t mask = child_map.capacity - 1, hole = child_map_slot(id) - child_map.items;
+    if (!child_map.items[hole].id) return;
+    child_map.count--;
+    // Shift back the following entries of the cluster, so that no lookup
+    // stops at the hole before reaching its entry
+    for (size_t s = (hole + 1) & mask; child_map.items[s].id; s = (s + 1) & mask) {
+        size_t home = child_map_home(child_map.items[s].id);
+        if (((s - home) & mask) >= ((s - hole) & mask)) {
+            child_map.items[hole] = child_map.items[s];
+            hole = s;
+        }
+    }
+    child_map.items[hole].id = 0;
+}
+
+static void
+child_map_free(void) {
+    free(child_map.items);
+    memset(&child_map, 0, sizeof(child_map));
+}
+// }}}
+
+// Poller {{{
+// Every I/O worker waits for events on the fds of its children and a wakeup
+// channel of its own, the first worker also on a signal channel. The fd of a
+// child is registered once, and its events only change when its read buffer
+// fills up or is drained or its write buffer becomes empty or non-empty, so
+// idle children cost nothing per iteration of the I/O loop. A child that
+// waits for no events is not registered at all, so that a hangup is not
+// reported over and over while its read buffer is full. On Linux, epoll is
+// used, with an eventfd for wakeups and a signalfd for signals, elsewhere
+// poll() and self-pipes.
+
+typedef struct {
+    size_t idx;
+    int revents;
+} ChildEvent;
+
+#ifdef __linux__
+typedef struct {
+    int epoll_fd, wakeup_fd;
+    struct { struct epoll_event *items; size_t capacity; } events;
+} Poller;
+#else
+typedef struct {
+    int wakeup_fds[2];
+    struct { struct pollfd *items; size_t capacity; } fds;
+    // The child polled first, see poller_wait()
+    size_t start;
+} Poller;
+#endif
+
+// Children are sharded between the I/O workers, each of which runs its own
+// I/O loop in a thread of its own. Only a worker re-allocates its children,
+// so it can access them without holding children_lock, other threads must
+// hold it. Other threads queue work for a worker under children_lock, set
+// has_changes and wake the worker up, so the worker only takes the lock when
+// there is something to do.
+typedef struct {
+    unsigned int idx;
+    pthread_t thread;
+    bool started;
+    struct { Child *items; size_t capacity; } children, add_queue;
+    size_t count, add_queue_count;
+    // The indices of the children whose events must be re-computed
+    struct { size_t *items; size_t capacity; } rearm_queue;
+    size_t rearm_queue_count;
+    bool has_changes;
+    // The load of the children in the last rebalancing interval
+    uint64_t load;
+    Poller poller;
+    struct { ChildEvent *items; size_t capacity; } ready;
+} IOWorker;
+
+#define MAX_IO_WORKERS 64
+static IOWorker *workers = NULL;
+static unsigned int num_workers = 0;
+
+static inline bool
+poller_has_signals(IOWorker *w) {
+    return w->idx == 0;
 }
 
 static inline bool
@@ -117,6 +276,406 @@ self_pipe(int fds[2]) {
     return true;
 }
 
+static inline void
+drain_fd(int fd) {
+    static uint8_t drain_buf[1024];
+    while(true) {
+        ssize_t len = read(fd, drain_buf, sizeof(drain_buf));
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EIO) perror("Call to read() from drain fd failed");
+            break;
+        }
+        break;
+    }
+}
+
+#ifdef __linux__
+
+#define WAKEUP_DATA UINT64_MAX
+#define SIGNAL_DATA (UINT64_MAX - 1)
+
+static int signal_fd = -1;
+static sigset_t handled_signals, original_signal_mask;
+static bool signals_blocked = false;
+
+static void
+restore_signal_mask(void) {
+    if (signals_blocked) pthread_sigmask(SIG_SETMASK, &original_signal_mask, NULL);
+}
+
+static inline struct epoll_event
+as_epoll_event(int events, uint64_t data) {
+    struct epoll_event ev = {.events = (events & POLLIN ? EPOLLIN : 0) | (events & POLLOUT ? EPOLLOUT : 0), .data.u64 = data};
+    return ev;
+}
+
+static void
+poller_destroy(void) {
+#define C(fd) if (fd > -1) { close(fd); fd = -1; }
+    for (unsigned int i = 0; i < num_workers; i++) {
+        IOWorker *w = workers + i;
+        C(w->poller.epoll_fd); C(w->poller.wakeup_fd);
+        free(w->ready.items); memset(&w->ready, 0, sizeof(w->ready));
+        free(w->poller.events.items); memset(&w->poller.events, 0, sizeof(w->poller.events));
+    }
+    C(signal_fd);
+#undef C
+}
+
+static void
+poller_reserve(IOWorker *w, size_t count) {
+    // Make space for events from count children
+    ensure_space_for(&w->ready, items, ChildEvent, count, capacity, 64, false);
+    ensure_space_for(&w->poller.events, items, struct epoll_event, count + 2, capacity, 64, false);
+}
+
+static bool
+poller_init_worker(IOWorker *w) {
+    Poller *p = &w->poller;
+    struct epoll_event wev = as_epoll_event(POLLIN, WAKEUP_DATA), sev = as_epoll_event(POLLIN, SIGNAL_DATA);
+    if (
+        (p->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+        (p->wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1 ||
+        epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, p->wakeup_fd, &wev) != 0 ||
+        (poller_has_signals(w) && epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, signal_fd, &sev) != 0)
+    ) return false;
+    poller_reserve(w, 0);
+    return true;
+}
+
+static bool
+poller_init(void) {
+    // The signals are read from signal_fd, so they must be blocked in every
+    // thread. Threads inherit the signal mask of the thread that creates
+    // them, child processes must call clear_handled_signals() before exec.
+    sigemptyset(&handled_signals);
+    sigaddset(&handled_signals, SIGINT); sigaddset(&handled_signals, SIGTERM); sigaddset(&handled_signals, SIGCHLD);
+    int ret = pthread_sigmask(SIG_BLOCK, &handled_signals, &original_signal_mask);
+    if (ret != 0) { errno = ret; return false; }
+    signals_blocked = true;
+    for (unsigned int i = 0; i < num_workers; i++) workers[i].poller.epoll_fd = workers[i].poller.wakeup_fd = -1;
+    bool ok = (signal_fd = signalfd(-1, &handled_signals, SFD_CLOEXEC | SFD_NONBLOCK)) != -1;
+    for (unsigned int i = 0; ok && i < num_workers; i++) ok = poller_init_worker(workers + i);
+    if (!ok) {
+        int saved_errno = errno;
+        restore_signal_mask();
+        signals_blocked = false;
+        poller_destroy();
+        errno = saved_errno;
+        return false;
+    }
+    return true;
+}
+
+static void
+poller_release_signals(void) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    restore_signal_mask();
+    signals_blocked = false;
+}
+
+static void
+wakeup_worker(IOWorker *w) {
+    static const uint64_t one = 1;
+    while(true) {
+        ssize_t ret = write(w->poller.wakeup_fd, &one, sizeof(one));
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            // EAGAIN means the counter is full, so a wakeup is pending anyway
+            if (errno != EAGAIN) perror("Failed to write to wakeup fd with error");
+        }
+        break;
+    }
+}
+
+static void
+poller_set(IOWorker *w, size_t i, int events) {
+    // Change the events waited for on the fd of the child at index i
+    Child *c = w->children.items + i;
+    struct epoll_event ev = as_epoll_event(events, i);
+    int op = events ? (c->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD) : EPOLL_CTL_DEL;
+    if (epoll_ctl(w->poller.epoll_fd, op, c->fd, &ev) != 0) perror("Call to epoll_ctl() failed");
+    c->events = events;
+}
+
+static void
+poller_moved(IOWorker *w, size_t i) {
+    // The child at index i was moved there from a different index
+    Child *c = w->children.items + i;
+    struct epoll_event ev = as_epoll_event(c->events, i);
+    if (c->events && epoll_ctl(w->poller.epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) != 0) perror("Call to epoll_ctl() failed");
+}
+
+static inline bool
+read_signals(void) {
+    // Returns true if SIGINT or SIGTERM was received. Children that exited are reaped.
+    struct signalfd_siginfo fdsi;
+    bool ans = false;
+    while(true) {
+        ssize_t len = read(signal_fd, &fdsi, sizeof(fdsi));
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) perror("Call to read() from signal fd failed");
+            break;
+        }
+        if (len != sizeof(fdsi)) break;
+        if (fdsi.ssi_signo == SIGCHLD) {
+            if (fdsi.ssi_code == CLD_EXITED) reap_child(fdsi.ssi_pid);
+        } else ans = true;
+    }
+    return ans;
+}
+
+static size_t
+poller_wait(IOWorker *w, bool *signalled) {
+    // Wait for events, returns the number of children with events in ready
+    uint64_t val;
+    size_t num = 0;
+    int ret = epoll_wait(w->poller.epoll_fd, w->poller.events.items, w->count + 2, -1);
+    if (ret < 0) {
+        if (errno != EINTR) perror("Call to epoll_wait() failed");
+        return 0;
+    }
+    for (int k = 0; k < ret; k++) {
+        struct epoll_event *ev = w->poller.events.items + k;
+        switch(ev->data.u64) {
+            case WAKEUP_DATA:
+                while (read(w->poller.wakeup_fd, &val, sizeof(val)) < 0 && errno == EINTR);
+                break;
+            case SIGNAL_DATA:
+                if (read_signals()) *signalled = true;
+                break;
+            default:
+                w->ready.items[num].idx = ev->data.u64;
+                w->ready.items[num++].revents = (ev->events & EPOLLIN ? POLLIN : 0) | (ev->events & EPOLLOUT ? POLLOUT : 0) | (ev->events & (EPOLLHUP | EPOLLERR) ? POLLHUP : 0);
+        }
+    }
+    return num;
+}
+
+#else
+
+#define EXTRA_FDS 2
+
+static int signal_fds[2] = {-1, -1};
+
+static void
+handle_signal(int sig_num) {
+    int save_err = errno;
+    unsigned char byte = (unsigned char)sig_num;
+    while(true) {
+        ssize_t ret = write(signal_fds[1], &byte, 1);
+        if (ret < 0 && errno == EINTR) continue;
+        break;
+    }
+    errno = save_err;
+}
+
+static void
+poller_destroy(void) {
+    for (int i = 0; i < 2; i++) {
+        if (signal_fds[i] > -1) { close(signal_fds[i]); signal_fds[i] = -1; }
+    }
+    for (unsigned int k = 0; k < num_workers; k++) {
+        IOWorker *w = workers + k;
+        for (int i = 0; i < 2; i++) {
+            if (w->poller.wakeup_fds[i] > -1) { close(w->poller.wakeup_fds[i]); w->poller.wakeup_fds[i] = -1; }
+        }
+        free(w->ready.items); memset(&w->ready, 0, sizeof(w->ready));
+        free(w->poller.fds.items); memset(&w->poller.fds, 0, sizeof(w->poller.fds));
+    }
+}
+
+static void
+poller_reserve(IOWorker *w, size_t count) {
+    // Make space for events from count children
+    ensure_space_for(&w->ready, items, ChildEvent, count, capacity, 64, false);
+    ensure_space_for(&w->poller.fds, items, struct pollfd, count + EXTRA_FDS, capacity, 64, true);
+}
+
+static bool
+poller_init(void) {
+    for (unsigned int i = 0; i < num_workers; i++) workers[i].poller.wakeup_fds[0] = workers[i].poller.wakeup_fds[1] = -1;
+    if (!self_pipe(signal_fds)) return false;
+    if (signal(SIGINT, handle_signal) == SIG_ERR) return false;
+    if (signal(SIGTERM, handle_signal) == SIG_ERR) return false;
+    if (siginterrupt(SIGINT, false) != 0) return false;
+    if (siginterrupt(SIGTERM, false) != 0) return false;
+    for (unsigned int i = 0; i < num_workers; i++) {
+        IOWorker *w = workers + i;
+        if (!self_pipe(w->poller.wakeup_fds)) return false;
+        poller_reserve(w, 0);
+        // poll() ignores negative fds
+        w->poller.fds.items[0].fd = w->poller.wakeup_fds[0];
+        w->poller.fds.items[1].fd = poller_has_signals(w) ? signal_fds[0] : -1;
+        w->poller.fds.items[0].events = POLLIN; w->poller.fds.items[1].events = POLLIN;
+    }
+    return true;
+}
+
+static void
+poller_release_signals(void) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+}
+
+static void
+wakeup_worker(IOWorker *w) {
+    while(true) {
+        ssize_t ret = write(w->poller.wakeup_fds[1], "w", 1);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            perror("Failed to write to wakeup fd with error");
+        }
+        break;
+    }
+}
+
+static void
+poller_set(IOWorker *w, size_t i, int events) {
+    // Change the events waited for on the fd of the child at index i, poll() ignores negative fds
+    w->poller.fds.items[EXTRA_FDS + i].fd = events ? w->children.items[i].fd : -1;
+    w->poller.fds.items[EXTRA_FDS + i].events = events;
+    w->children.items[i].events = events;
+}
+
+static void
+poller_moved(IOWorker *w, size_t i) {
+    // The child at index i was moved there from a different index
+    poller_set(w, i, w->children.items[i].events);
+}
+
+static size_t
+poller_wait(IOWorker *w, bool *signalled) {
+    // Wait for events, returns the number of children with events in ready
+    size_t num = 0, count = w->count;
+    struct pollfd *pfds = w->poller.fds.items;
+    int ret = poll(pfds, count + EXTRA_FDS, -1);
+    if (ret < 0) {
+        if (errno != EAGAIN && errno != EINTR) perror("Call to poll() failed");
+        return 0;
+    }
+    if (pfds[0].revents & POLLIN) drain_fd(pfds[0].fd); // wakeup
+    if (pfds[1].revents & POLLIN) { drain_fd(pfds[1].fd); *signalled = true; }
+    // Start at a different child every time, so that no child is always served first
+    size_t start = w->poller.start < count ? w->poller.start : 0;
+    for (size_t k = 0, i = start; k < count; k++, i = i + 1 < count ? i + 1 : 0) {
+        if (pfds[EXTRA_FDS + i].revents) {
+            w->ready.items[num].idx = i;
+            w->ready.items[num++].revents = pfds[EXTRA_FDS + i].revents;
+        }
+    }
+    w->poller.start = start + 1;
+    return num;
+}
+
+#endif
+
+static void
+wakeup_io_loop(void) {
+    // Wake up all I/O workers
+    for (unsigned int i = 0; i < num_workers; i++) wakeup_worker(workers + i);
+}
+// }}}
+
+// Headless {{{
+// A ChildMonitor created without a window runs headless: the main loop waits
+// for wakeups from the other threads on a pipe instead of for GLFW events,
+// and frames are rendered by the null renderer below. Everything else, the
+// I/O workers, parsing, frame pacing and latency tracking, is the same as
+// with a window, so that real programs can be benchmarked with no display.
+
+static bool headless = false, headless_should_close = false;
+static int main_wakeup_fds[2] = {-1, -1};
+// The plain memory the null renderer prepares cell data in. It is shared by
+// all screens, since it is never read.
+static struct { Cell *items; size_t capacity; } null_cells = {0};
+static struct { float *items; size_t capacity; } null_selection = {0};
+
+static bool
+headless_init(void) {
+    headless_should_close = false;
+    if (!self_pipe(main_wakeup_fds)) return false;
+    // Wakeups must never block the I/O workers, a full pipe means one is pending anyway
+    int flags = fcntl(main_wakeup_fds[1], F_GETFL);
+    if (flags == -1 || fcntl(main_wakeup_fds[1], F_SETFL, flags | O_NONBLOCK) == -1) return false;
+    return true;
+}
+
+static void
+headless_destroy(void) {
+    for (unsigned int i = 0; i < 2; i++) {
+        if (main_wakeup_fds[i] > -1) close(main_wakeup_fds[i]);
+        main_wakeup_fds[i] = -1;
+    }
+    free(null_cells.items); memset(&null_cells, 0, sizeof(null_cells));
+    free(null_selection.items); memset(&null_selection, 0, sizeof(null_selection));
+}
+
+static void
+wakeup_main_loop(void) {
+    if (!headless) { glfwPostEmptyEvent(); return; }
+    while(true) {
+        ssize_t ret = write(main_wakeup_fds[1], "w", 1);
+        if (ret < 0 && errno == EINTR) continue;
+        break;
+    }
+}
+
+static inline void
+headless_wait(double timeout) {
+    // Wait for a wakeup for at most timeout seconds, forever if it is negative
+    struct pollfd pfd = {.fd = main_wakeup_fds[0], .events = POLLIN};
+    int ret = poll(&pfd, 1, timeout < 0 ? -1 : (int)ceil(timeout * 1000));
+    if (ret > 0) drain_fd(main_wakeup_fds[0]);
+    else if (ret < 0 && errno != EINTR) perror("Call to poll() in the headless main loop failed");
+}
+
+static inline bool
+main_loop_should_close(void) {
+    return headless ? headless_should_close : glfwWindowShouldClose(glfw_window_id);
+}
+
+static inline void
+close_main_loop(void) {
+    if (headless) { headless_should_close = true; wakeup_main_loop(); }
+    else glfwSetWindowShouldClose(glfw_window_id, true);
+}
+// }}}
+
+
+// Main thread functions {{{
+
+#define FREE_CHILD(x) \
+    Py_CLEAR((x).screen); x = EMPTY_CHILD;
+
+#define XREF_CHILD(x, OP) OP(x.screen); 
+#define INCREF_CHILD(x) XREF_CHILD(x, Py_INCREF)
+#define DECREF_CHILD(x) XREF_CHILD(x, Py_DECREF)
+
+// The max time (in secs) to wait for events from the window system
+// before ticking over the main loop. Negative values mean wait forever.
+static double maximum_wait = -1.0;
+
+static inline void
+set_maximum_wait(double val) {
+    if (val >= 0 && (val < maximum_wait || maximum_wait < 0)) maximum_wait = val;
+}
+
+static unsigned int
+io_worker_count(void) {
+    // The number of I/O workers to use, automatically one for every 16 CPUs
+    unsigned int ans = OPT(io_threads);
+    if (!ans) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        ans = cpus > 16 ? cpus / 16 : 1;
+        ans = MIN(ans, 8u);
+    }
+    return MIN(ans, (unsigned int)MAX_IO_WORKERS);
+}
+
 static PyObject *
 new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
     ChildMonitor *self;
@@ -126,16 +685,17 @@ new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
     if (the_monitor) { PyErr_SetString(PyExc_RuntimeError, "Can have only a single ChildMonitor instance"); return NULL; }
     if (!PyArg_ParseTuple(args, "OOO", &wid, &death_notify, &dump_callback)) return NULL; 
     glfw_window_id = PyLong_AsVoidPtr(wid);
+    headless = glfw_window_id == NULL;
+    if (headless && !headless_init()) return PyErr_SetFromErrno(PyExc_OSError);
     if ((ret = pthread_mutex_init(&children_lock, NULL)) != 0) {
         PyErr_Format(PyExc_RuntimeError, "Failed to create children_lock mutex: %s", strerror(ret));
         return NULL;
     }
-    if (!self_pipe(wakeup_fds)) return PyErr_SetFromErrno(PyExc_OSError);
-    if (!self_pipe(signal_fds)) return PyErr_SetFromErrno(PyExc_OSError);
-    if (signal(SIGINT, handle_signal) == SIG_ERR) return PyErr_SetFromErrno(PyExc_OSError);
-    if (signal(SIGTERM, handle_signal) == SIG_ERR) return PyErr_SetFromErrno(PyExc_OSError);
-    if (siginterrupt(SIGINT, false) != 0) return PyErr_SetFromErrno(PyExc_OSError);
-    if (siginterrupt(SIGTERM, false) != 0) return PyErr_SetFromErrno(PyExc_OSError);
+    num_workers = io_worker_count();
+    workers = calloc(num_workers, sizeof(IOWorker));
+    if (workers == NULL) return PyErr_NoMemory();
+    for (unsigned int i = 0; i < num_workers; i++) workers[i].idx = i;
+    if (!poller_init()) return PyErr_SetFromErrno(PyExc_OSError);
     self = (ChildMonitor *)type->tp_alloc(type, 0);
     if (self == NULL) return PyErr_NoMemory();
     self->death_notify = death_notify; Py_INCREF(death_notify);
@@ -143,9 +703,6 @@ new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
         self->dump_callback = dump_callback; Py_INCREF(dump_callback);
         parse_func = parse_worker_dump;
     } else parse_func = parse_worker;
-    self->count = 0; 
-    fds[0].fd = wakeup_fds[0]; fds[1].fd = signal_fds[0];
-    fds[0].events = POLLIN; fds[1].events = POLLIN;
     the_monitor = self;
 
     return (PyObject*) self;
@@ -159,201 +716,739 @@ dealloc(ChildMonitor* self) {
     Py_TYPE(self)->tp_free((PyObject*)self);
     while (remove_queue_count) {
         remove_queue_count--;
-        FREE_CHILD(remove_queue[remove_queue_count]);
+        FREE_CHILD(remove_queue.items[remove_queue_count]);
     }
-    while (add_queue_count) {
-        add_queue_count--;
-        FREE_CHILD(add_queue[add_queue_count]);
+    // Leave the signals as they were before, for a monitor created later,
+    // which would otherwise save the blocked mask as the original one
+    poller_release_signals();
+    poller_destroy();
+    signal_received = false;
+#define F(x) free(x.items); memset(&x, 0, sizeof(x));
+    for (unsigned int i = 0; i < num_workers; i++) {
+        IOWorker *w = workers + i;
+        while (w->add_queue_count) {
+            w->add_queue_count--;
+            FREE_CHILD(w->add_queue.items[w->add_queue_count]);
+        }
+        F(w->children); F(w->add_queue); F(w->rearm_queue);
     }
-    close(wakeup_fds[0]);
-    close(wakeup_fds[1]);
-    close(signal_fds[0]); 
-    close(signal_fds[1]);
+    F(scratch); F(remove_queue); F(remove_notify);
+#undef F
+    free(workers); workers = NULL; num_workers = 0;
+    child_map_free();
+    headless_destroy();
+    the_monitor = NULL;
 }
 
-static void
-wakeup_io_loop() {
-    while(true) {
-        ssize_t ret = write(wakeup_fds[1], "w", 1);
-        if (ret < 0) {
-            if (errno == EINTR) continue;
-            perror("Failed to write to wakeup fd with error");
+static inline Child*
+find_child(unsigned long id, IOWorker **worker) {
+    // The child with the specified id, or NULL if it has not been picked up
+    // by its worker yet. Must be called with children_lock held.
+    ChildSlot *slot = child_map_get(id);
+    if (slot == NULL) return NULL;
+    IOWorker *w = workers + slot->worker;
+    if (worker) *worker = w;
+    return w->children.items + slot->idx;
+}
+
+static inline Child*
+find_queued_child(unsigned long id, IOWorker **worker) {
+    // The child with the specified id in the add queue of its worker. Must be
+    // called with children_lock held.
+    for (unsigned int i = 0; i < num_workers; i++) {
+        IOWorker *w = workers + i;
+        for (size_t q = 0; q < w->add_queue_count; q++) {
+            if (w->add_queue.items[q].id == id) {
+                if (worker) *worker = w;
+                return w->add_queue.items + q;
+            }
         }
-        break;
     }
+    return NULL;
+}
+
+static inline void
+queue_changes(IOWorker *w) {
+    // Have the worker process its queues. Must be called with children_lock
+    // held, and followed by wakeup_worker().
+    __atomic_store_n(&w->has_changes, true, __ATOMIC_RELEASE);
+}
+
+static inline void
+rearm_child(IOWorker *w, Child *c) {
+    // Have the worker re-compute the events it waits for on the fd of c.
+    // Must be called with children_lock held, and followed by
+    // wakeup_worker().
+    if (c->rearm_queued) return;
+    c->rearm_queued = true;
+    ensure_space_for(&w->rearm_queue, items, size_t, w->rearm_queue_count + 1, capacity, 64, false);
+    w->rearm_queue.items[w->rearm_queue_count++] = c - w->children.items;
+    queue_changes(w);
+}
+
+static inline void
+rearm_child_with_id(unsigned long id) {
+    // A child still in the add queue has its events computed when it is added
+    IOWorker *w = NULL;
+    children_mutex(lock);
+    Child *c = find_child(id, &w);
+    if (c) rearm_child(w, c);
+    children_mutex(unlock);
+    if (w) wakeup_worker(w);
 }
 
 static void* io_loop(void *data);
 
 static PyObject *
-start(ChildMonitor *self) {
-#define start_doc "start() -> Start the I/O thread"
-    int ret = pthread_create(&self->io_thread, NULL, io_loop, self);
-    if (ret != 0) return PyErr_SetFromErrno(PyExc_OSError);
+start(ChildMonitor UNUSED *self) {
+#define start_doc "start() -> Start the I/O threads"
+    for (unsigned int i = 0; i < num_workers; i++) {
+        IOWorker *w = workers + i;
+        if (w->started) continue;
+        int ret = pthread_create(&w->thread, NULL, io_loop, w);
+        if (ret != 0) { errno = ret; return PyErr_SetFromErrno(PyExc_OSError); }
+        w->started = true;
+    }
     Py_RETURN_NONE;
 }
 
+static void remove_all_children(IOWorker *w);
+static void stop_writer(void);
+
 static PyObject *
-join(ChildMonitor *self) {
-#define join_doc "join() -> Wait for the I/O thread to finish"
-    int ret = pthread_join(self->io_thread, NULL);
-    if (ret != 0) return PyErr_SetFromErrno(PyExc_OSError);
+join(ChildMonitor UNUSED *self) {
+#define join_doc "join() -> Wait for the I/O threads to finish"
+    for (unsigned int i = 0; i < num_workers; i++) {
+        IOWorker *w = workers + i;
+        if (!w->started) continue;
+        int ret = pthread_join(w->thread, NULL);
+        if (ret != 0) { errno = ret; return PyErr_SetFromErrno(PyExc_OSError); }
+        w->started = false;
+    }
+    // Children that were moved to a worker after it finished
+    children_mutex(lock);
+    for (unsigned int i = 0; i < num_workers; i++) remove_all_children(workers + i);
+    children_mutex(unlock);
+    stop_writer();
     Py_RETURN_NONE;
 }
 
 
 static PyObject *
 wakeup(ChildMonitor UNUSED *self) {
-#define wakeup_doc "wakeup() -> wakeup the ChildMonitor I/O thread, forcing it to exit from poll() if it is waiting there."
+#define wakeup_doc "wakeup() -> wakeup the ChildMonitor I/O threads, forcing them to exit from poll() if they are waiting there."
     wakeup_io_loop();
     Py_RETURN_NONE;
 }
 
+static inline IOWorker*
+least_loaded_worker(void) {
+    // The worker with the fewest children, must be called with children_lock held
+    IOWorker *ans = workers;
+    for (unsigned int i = 1; i < num_workers; i++) {
+        IOWorker *w = workers + i;
+        if (w->count + w->add_queue_count < ans->count + ans->add_queue_count) ans = w;
+    }
+    return ans;
+}
+
 static PyObject *
-add_child(ChildMonitor *self, PyObject *args) {
+add_child(ChildMonitor UNUSED *self, PyObject *args) {
 #define add_child_doc "add_child(id, pid, fd, screen) -> Add a child."
     children_mutex(lock);
-    if (self->count + add_queue_count >= MAX_CHILDREN) { PyErr_SetString(PyExc_ValueError, "Too many children"); children_mutex(unlock); return NULL; }
-    add_queue[add_queue_count] = EMPTY_CHILD;
-#define A(attr) &add_queue[add_queue_count].attr
-    if (!PyArg_ParseTuple(args, "kiiO", A(id), A(pid), A(fd), A(screen))) {
+    IOWorker *w = least_loaded_worker();
+    ensure_space_for(&w->add_queue, items, Child, w->add_queue_count + 1, capacity, 16, true);
+    w->add_queue.items[w->add_queue_count] = EMPTY_CHILD;
+#define A(attr) &w->add_queue.items[w->add_queue_count].attr
+    if (!PyArg_ParseTuple(args, "kiiO!", A(id), A(pid), A(fd), &Screen_Type, A(screen))) {
         children_mutex(unlock);
         return NULL; 
     }
 #undef A
-    INCREF_CHILD(add_queue[add_queue_count]);
-    add_queue_count++;
+    Child *c = w->add_queue.items + w->add_queue_count;
+    // The fd is written to from both threads, neither of which must block
+    int flags = fcntl(c->fd, F_GETFL);
+    if (flags == -1 || fcntl(c->fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        children_mutex(unlock);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    Screen *screen = c->screen;
+    screen_mutex(lock, write);
+    screen->write_queue.fd = c->fd;
+    screen->write_queue.child_id = c->id;
+    screen_mutex(unlock, write);
+    INCREF_CHILD(w->add_queue.items[w->add_queue_count]);
+    w->add_queue_count++;
+    queue_changes(w);
     children_mutex(unlock);
-    wakeup_io_loop();
+    wakeup_worker(w);
     Py_RETURN_NONE;
 }
 
+// Data for a child is written directly from the main thread when nothing is
+// queued for it, which is the common case for key presses. Otherwise, it is
+// appended to the write queue of its screen, which the I/O thread flushes
+// with writev() whenever the child can accept more data. Small writes are
+// copied into the last segment of the queue, large writes from python
+// reference the bytes object they come from.
+
+#define MIN_SEGMENT_SZ 4096
+#define MIN_REFERENCED_SZ (64 * 1024)
+#define MAX_WRITE_IOVECS 64
+
+static inline WriteSegment*
+alloc_segment(size_t capacity) {
+    // The data of the segment is allocated along with it
+    WriteSegment *s = PyMem_RawMalloc(sizeof(WriteSegment) + capacity);
+    if (s == NULL) fatal("Out of memory.");
+    s->next = NULL; s->owner = NULL; s->sz = 0; s->capacity = capacity;
+    s->data = (uint8_t*)(s + 1);
+    return s;
+}
+
+static inline void
+append_segment(WriteQueue *q, WriteSegment *s) {
+    if (q->tail) q->tail->next = s;
+    else q->head = s;
+    q->tail = s;
+    q->queued += s->sz;
+}
+
+static inline bool
+consume_written(WriteQueue *q, size_t written) {
+    // Remove written bytes from the queue, all of it if written is SIZE_MAX.
+    // Returns true if segments referencing python objects were written.
+    bool has_done = false;
+    while (q->head && written) {
+        WriteSegment *s = q->head;
+        size_t left = s->sz - q->offset;
+        if (written < left) { q->offset += written; q->queued -= written; break; }
+        written -= left; q->queued -= left;
+        q->offset = 0;
+        q->head = s->next;
+        if (q->head == NULL) q->tail = NULL;
+        if (s->owner) {
+            s->next = q->done;
+            __atomic_store_n(&q->done, s, __ATOMIC_RELAXED);
+            has_done = true;
+        } else PyMem_RawFree(s);
+    }
+    return has_done;
+}
+
+static inline size_t
+write_directly(WriteQueue *q, const char *data, size_t sz) {
+    // Write as much of data as the child accepts right away. Only done when
+    // nothing is queued, since the I/O thread writes queued data without
+    // holding the lock.
+    size_t written = 0;
+    if (q->queued || q->fd < 0) return 0;
+    while (written < sz) {
+        ssize_t ret = write(q->fd, data + written, sz - written);
+        if (ret > 0) written += ret;
+        else if (ret < 0 && errno == EINTR) continue;
+        else break;  // EAGAIN or an error, which the I/O thread deals with
+    }
+    return written;
+}
+
+static bool
+queue_write(Screen *screen, const char *data, size_t sz, PyObject *owner, double key_at) {
+    // Returns false if the screen has no child. If owner is not NULL, data is
+    // in its buffer and it is referenced instead of copying data. key_at is
+    // the time of the key press data is for, if any and its latency is tracked.
+    WriteQueue *q = &screen->write_queue;
+    bool rearm = false;
+    screen_mutex(lock, write);
+    if (q->fd < 0) { screen_mutex(unlock, write); return false; }
+    size_t written = write_directly(q, data, sz);
+    data += written; sz -= written;
+    if (sz) {
+        // The I/O thread waits for the fd to become writable only while there is data to write
+        rearm = !q->queued;
+        if (owner != NULL) {
+            WriteSegment *s = alloc_segment(0);
+            s->owner = owner; Py_INCREF(owner);
+            s->data = (uint8_t*)data; s->sz = sz;
+            append_segment(q, s);
+        } else if (q->tail && !q->tail->owner && q->tail->capacity - q->tail->sz >= sz) {
+            // The I/O thread only reads the part of the segment before its current size
+            memcpy(q->tail->data + q->tail->sz, data, sz);
+            q->tail->sz += sz; q->queued += sz;
+        } else {
+            WriteSegment *s = alloc_segment(MAX(sz, MIN_SEGMENT_SZ));
+            memcpy(s->data, data, sz); s->sz = sz;
+            append_segment(q, s);
+        }
+    }
+    if (key_at) {
+        // Queued data is written in order, so the key press is written once the queue is empty
+        if (!screen->latency->key_at) screen->latency->key_at = key_at;
+        if (!q->queued) latency_key_written(screen->latency, monotonic());
+    }
+    screen_mutex(unlock, write);
+    if (rearm) rearm_child_with_id(q->child_id);
+    return true;
+}
+
+static inline void
+free_segments(WriteSegment *s) {
+    // Must be called with the GIL held
+    while (s) {
+        WriteSegment *next = s->next;
+        Py_XDECREF(s->owner);
+        PyMem_RawFree(s);
+        s = next;
+    }
+}
+
+void
+free_write_queue(WriteQueue *q) {
+    free_segments(q->head); free_segments(q->done);
+    q->head = NULL; q->tail = NULL; q->done = NULL;
+    q->offset = 0; q->queued = 0;
+}
+
+static inline void
+release_written_segments(Screen *screen) {
+    // Release the python objects referenced by segments the I/O thread has written
+    WriteQueue *q = &screen->write_queue;
+    if (!__atomic_load_n(&q->done, __ATOMIC_RELAXED)) return;
+    screen_mutex(lock, write);
+    WriteSegment *done = q->done;
+    q->done = NULL;
+    screen_mutex(unlock, write);
+    free_segments(done);
+}
+
 bool
-schedule_write_to_child(unsigned long id, const char *data, size_t sz) {
-    ChildMonitor *self = the_monitor;
-    bool found = false;
+schedule_write_to_child(Screen *screen, const char *data, size_t sz) {
+    return screen != NULL && queue_write(screen, data, sz, NULL, 0);
+}
+
+bool
+schedule_key_write_to_child(Screen *screen, const char *data, size_t sz) {
+    // As above, for the data of a key press
+    return screen != NULL && queue_write(screen, data, sz, NULL, screen->latency ? monotonic() : 0);
+}
+
+static PyObject *
+needs_write(ChildMonitor UNUSED *self, PyObject *args) {
+#define needs_write_doc "needs_write(id, data) -> Queue data to be written to child. Large bytes objects are referenced instead of copied."
+    unsigned long id;
+    Py_ssize_t sz;
+    const char *data;
+    PyObject *obj, *owner = NULL;
+    Screen *screen = NULL;
+    if (!PyArg_ParseTuple(args, "kO", &id, &obj)) return NULL; 
+    if (PyBytes_Check(obj)) {
+        data = PyBytes_AS_STRING(obj); sz = PyBytes_GET_SIZE(obj);
+        if (sz >= MIN_REFERENCED_SZ) owner = obj;
+    } else if (!PyArg_Parse(obj, "s#", &data, &sz)) return NULL;
     children_mutex(lock);
-    for (size_t i = 0; i < self->count; i++) {
-        if (children[i].id == id) { 
-            found = true;
-            Screen *screen = children[i].screen;
-            screen_mutex(lock, write);
-            size_t space_left = screen->write_buf_sz - screen->write_buf_used;
-            if (space_left < sz) { 
-                if (screen->write_buf_used + sz > 100 * 1024 * 1024) {
-                    fprintf(stderr, "Too much data being sent to child with id: %lu, ignoring it\n", id);
-                    screen_mutex(unlock, write);
-                    break;
-                }
-                screen->write_buf_sz = screen->write_buf_used + sz;
-                screen->write_buf = PyMem_RawRealloc(screen->write_buf, screen->write_buf_sz);
-                if (screen->write_buf == NULL) { fatal("Out of memory."); }
+    Child *c = find_child(id, NULL);
+    if (c == NULL) c = find_queued_child(id, NULL);
+    if (c) screen = c->screen;
+    children_mutex(unlock);
+    // The screen cannot be freed before this function returns, since children are only freed in the main thread
+    if (screen && queue_write(screen, data, sz, owner, 0)) { Py_RETURN_TRUE; }
+    Py_RETURN_FALSE;
+}
+
+static PyObject *
+shutdown(ChildMonitor *self) {
+#define shutdown_doc "shutdown() -> Shutdown the monitor loop."
+    poller_release_signals();
+    self->shutting_down = true;
+    Py_RETURN_NONE;
+}
+
+// Frame pacing {{{
+// Input is parsed input_delay after it arrives and frames are rendered at
+// most every repaint_delay, except that:
+// - Small input in the focused window shortly after a key press is
+//   interactive, such as the echo of typed text. It is parsed right away and
+//   the frame showing it is rendered right away.
+// - While a lot of input is parsed per frame, the interval between frames is
+//   stretched, up to MAX_THROUGHPUT_REPAINT_DELAY, so that more time is spent
+//   parsing and less rendering frames nobody can read.
+
+#define INTERACTIVE_INPUT_SZ 4096
+#define INTERACTIVE_INPUT_WINDOW 0.5
+#define THROUGHPUT_FRAME_SZ (64 * 1024)
+#define MAX_THROUGHPUT_REPAINT_DELAY 0.05
+#define THROUGHPUT_STRETCH 1.5
+// Intervals between frames longer than this are idle time, not pacing
+#define MAX_FRAME_INTERVAL 1.0
+
+typedef enum { PACE_NORMAL, PACE_INTERACTIVE, PACE_THROUGHPUT, NUM_PACE_MODES } PaceMode;
+static const char* pace_mode_names[NUM_PACE_MODES] = {"normal", "interactive", "throughput"};
+
+typedef struct {
+    // The base delays, from the options
+    double input_delay, repaint_delay;
+    // The mode of the last frame, which decides the delay before the next one
+    PaceMode mode;
+    double stretch, last_frame_at;
+    size_t parsed_since_frame;
+    bool interactive_since_frame;
+    // Stats
+    unsigned long long frames[NUM_PACE_MODES], interactive_inputs;
+    double mean_frame_interval[NUM_PACE_MODES];
+} FramePacer;
+
+static FramePacer pacer = {0};
+
+static inline bool
+pacer_is_interactive(double now, size_t pending, bool focused, double last_key_at) {
+    return focused && pending <= INTERACTIVE_INPUT_SZ && last_key_at > 0 && now - last_key_at <= INTERACTIVE_INPUT_WINDOW;
+}
+
+static inline void
+pacer_parsed(FramePacer *p, size_t sz, bool interactive) {
+    p->parsed_since_frame += sz;
+    if (interactive) { p->interactive_since_frame = true; p->interactive_inputs++; }
+}
+
+static inline double
+pacer_repaint_delay(FramePacer *p) {
+    if (p->mode != PACE_THROUGHPUT) return p->repaint_delay;
+    return MAX(p->repaint_delay, MIN(p->repaint_delay * p->stretch, MAX_THROUGHPUT_REPAINT_DELAY));
+}
+
+static inline double
+pacer_frame_wait(FramePacer *p, double now) {
+    // The time to wait before rendering the next frame
+    if (p->interactive_since_frame) return 0;
+    return MAX(0, pacer_repaint_delay(p) - (now - p->last_frame_at));
+}
+
+static inline void
+pacer_frame_rendered(FramePacer *p, double now) {
+    double interval = now - p->last_frame_at;
+    if (p->interactive_since_frame) p->mode = PACE_INTERACTIVE;
+    else p->mode = p->parsed_since_frame >= THROUGHPUT_FRAME_SZ ? PACE_THROUGHPUT : PACE_NORMAL;
+    p->stretch = p->mode == PACE_THROUGHPUT ? MIN(MAX(1, p->stretch) * THROUGHPUT_STRETCH, 64) : 1;
+    if (interval < MAX_FRAME_INTERVAL) {
+        double *mean = p->mean_frame_interval + p->mode;
+        *mean = p->frames[p->mode] ? 0.9 * *mean + 0.1 * interval : interval;
+    }
+    p->frames[p->mode]++;
+    p->last_frame_at = now;
+    p->parsed_since_frame = 0;
+    p->interactive_since_frame = false;
+}
+
+static PyObject*
+pacer_stats(FramePacer *p) {
+    PyObject *frames = PyDict_New(), *intervals = PyDict_New();
+    if (frames == NULL || intervals == NULL) { Py_XDECREF(frames); Py_XDECREF(intervals); return NULL; }
+    for (int m = 0; m < NUM_PACE_MODES; m++) {
+        PyObject *n = PyLong_FromUnsignedLongLong(p->frames[m]), *t = PyFloat_FromDouble(p->mean_frame_interval[m]);
+        int ret = n && t ? PyDict_SetItemString(frames, pace_mode_names[m], n) | PyDict_SetItemString(intervals, pace_mode_names[m], t) : -1;
+        Py_XDECREF(n); Py_XDECREF(t);
+        if (ret != 0) { Py_DECREF(frames); Py_DECREF(intervals); return NULL; }
+    }
+    return Py_BuildValue("{ss sd sN sN sK}",
+        "mode", pace_mode_names[p->mode], "repaint_delay", pacer_repaint_delay(p),
+        "frames", frames, "mean_frame_interval", intervals, "interactive_inputs", p->interactive_inputs);
+}
+
+static PyObject *
+pacing_stats(ChildMonitor UNUSED *self) {
+#define pacing_stats_doc "pacing_stats() -> The number of frames rendered in each pacing mode, their mean intervals and the current mode and repaint delay"
+    return pacer_stats(&pacer);
+}
+
+static PyObject*
+test_frame_pacer(PyObject UNUSED *self, PyObject *args) {
+#define test_frame_pacer_doc "test_frame_pacer(events, input_delay, repaint_delay) -> Run a frame pacer with the specified base delays through events, returning the delays it chose and its stats. Events are ('key', time), ('input', time, size, focused), for which the delay before parsing is returned, and ('frame', time), for which the delay before rendering is returned."
+    FramePacer p = {0};
+    PyObject *events;
+    double last_key_at = 0;
+    if (!PyArg_ParseTuple(args, "Odd", &events, &p.input_delay, &p.repaint_delay)) return NULL;
+    PyObject *seq = PySequence_Fast(events, "events must be a sequence");
+    if (seq == NULL) return NULL;
+    PyObject *delays = PyList_New(0);
+    for (Py_ssize_t i = 0; delays && i < PySequence_Fast_GET_SIZE(seq); i++) {
+        const char *kind; double t, delay = -1; unsigned long long sz = 0; int focused = 0;
+        PyObject *ev = PySequence_Fast_GET_ITEM(seq, i);
+        if (!PyArg_ParseTuple(ev, "sd|Kp", &kind, &t, &sz, &focused)) { Py_CLEAR(delays); break; }
+        if (strcmp(kind, "key") == 0) last_key_at = t;
+        else if (strcmp(kind, "input") == 0) {
+            bool interactive = pacer_is_interactive(t, sz, focused, last_key_at);
+            delay = interactive ? 0 : p.input_delay;
+            pacer_parsed(&p, sz, interactive);
+        } else if (strcmp(kind, "frame") == 0) {
+            delay = pacer_frame_wait(&p, t);
+            pacer_frame_rendered(&p, t + delay);
+        } else { PyErr_Format(PyExc_ValueError, "Unknown event: %s", kind); Py_CLEAR(delays); break; }
+        if (delay >= 0) {
+            PyObject *d = PyFloat_FromDouble(delay);
+            if (d == NULL || PyList_Append(delays, d) != 0) Py_CLEAR(delays);
+            Py_XDECREF(d);
+        }
+    }
+    Py_DECREF(seq);
+    if (delays == NULL) return NULL;
+    PyObject *stats = pacer_stats(&p);
+    if (stats == NULL) { Py_DECREF(delays); return NULL; }
+    return Py_BuildValue("NN", delays, stats);
+}
+// }}}
+
+static inline void
+update_visibility(Child *children, size_t count) {
+    // Computed once per tick for all children, rather than by looking up the
+    // window of every child
+    for (size_t i = 0; i < count; i++) children[i].screen->is_visible = true;  // not yet added to a tab
+    for (unsigned int t = 0; t < global_state.num_tabs; t++) {
+        Tab *tab = global_state.tabs + t;
+        for (unsigned int i = 0; i < tab->num_windows; i++) {
+            Screen *screen = tab->windows[i].render_data.screen;
+            if (screen) screen->is_visible = t == global_state.active_tab && tab->windows[i].visible;
+        }
+    }
+}
+
+static inline void
+stamp_read(LatencyTracker *t, size_t end, double at) {
+    // Must be called with read_buf_lock held
+    if (t->num_reads == LATENCY_READ_STAMPS) {
+        t->reads[(t->reads_start + t->num_reads - 1) % LATENCY_READ_STAMPS].end = end;
+        return;
+    }
+    t->reads[(t->reads_start + t->num_reads++) % LATENCY_READ_STAMPS] = (ReadStamp){.end=end, .at=at};
+}
+
+static inline double
+consume_read_stamps(LatencyTracker *t, size_t end) {
+    // The time the oldest input up to the position end in the read ring was
+    // read at, which is about to be parsed. Must be called with read_buf_lock held.
+    double ans = t->num_reads ? t->reads[t->reads_start].at : 0;
+    while (t->num_reads && t->reads[t->reads_start].end <= end) {
+        t->reads_start = (t->reads_start + 1) % LATENCY_READ_STAMPS;
+        t->num_reads--;
+    }
+    return ans;
+}
+
+static inline void
+track_parse_latency(Screen *screen, double read_at, double last_read_at) {
+    // Input read from read_at to last_read_at has just been parsed, which is
+    // the echo of a key press written to the child before last_read_at
+    LatencyTracker *t = screen->latency;
+    double now = monotonic();
+    if (read_at) latency_record(t->histograms + READ_TO_PARSE, now - read_at);
+    if (!t->parsed_at) t->parsed_at = now;
+    screen_mutex(lock, write);
+    if (t->written_key_at && t->written_key_at <= last_read_at) {
+        if (!t->echo_key_at) t->echo_key_at = t->written_key_at;
+        t->written_key_at = 0;
+    }
+    screen_mutex(unlock, write);
+}
+
+static inline void
+do_parse(ChildMonitor *self, unsigned long id, Screen *screen, double now, bool visible, bool focused) {
+    struct iovec iov[2];
+    unsigned int num = 0;
+    bool interactive = false;
+    double read_at = 0, last_read_at = 0;
+    size_t quantum = focused ? FOCUSED_PARSE_WEIGHT * PARSE_QUANTUM : PARSE_QUANTUM;
+    screen_mutex(lock, read);
+    // Flush the input batched while the window was not visible as soon as it becomes visible
+    bool flush = visible && screen->throttle_parsing;
+    __atomic_store_n(&screen->throttle_parsing, !visible, __ATOMIC_RELAXED);
+    if (screen->new_input_at) {
+        double time_since_new_input = now - screen->new_input_at;
+        interactive = pacer_is_interactive(now, ring_used(&screen->read_ring), focused, global_state.last_key_input_at);
+        double delay = interactive ? 0 : pacer.input_delay;
+        if (screen->throttle_parsing && !screen->has_pending_query && !input_over_limit(screen)) delay = MAX(delay, OPT(background_input_delay));
+        if (flush || time_since_new_input >= delay) {
+            // The I/O thread adds input to the ring and sets new_input_at
+            // with read_buf_lock held, so new_input_at is only reset for the
+            // input that is parsed below. Input beyond the quantum is left
+            // for the next tick, which happens right away.
+            num = ring_read_space(&screen->read_ring, iov);
+            size_t len = ring_used(&screen->read_ring);
+            if (len > quantum) {
+                num = limit_iov(iov, num, quantum);
+                len = quantum;
+                set_maximum_wait(0);
+            } else {
+                screen->new_input_at = 0;
+                screen->has_pending_query = false;
             }
-            memcpy(screen->write_buf + screen->write_buf_used, data, sz);
-            screen->write_buf_used += sz;
-            if (screen->write_buf_sz > BUFSIZ && screen->write_buf_used < BUFSIZ) {
-                screen->write_buf_sz = BUFSIZ;
-                screen->write_buf = PyMem_RawRealloc(screen->write_buf, screen->write_buf_sz);
-                if (screen->write_buf == NULL) { fatal("Out of memory."); }
+            if (screen->latency) {
+                // Measured from the read of the oldest input parsed, not from
+                // new_input_at, which is only reset once the ring is drained
+                read_at = consume_read_stamps(screen->latency, screen->read_ring.tail + len);
+                last_read_at = screen->latency->last_read_at;
             }
-            if (screen->write_buf_used) wakeup_io_loop();
-            screen_mutex(unlock, write);
-            break;
-        }
+        } else set_maximum_wait(delay - time_since_new_input);
     }
-    children_mutex(unlock);
-    return found;
+    screen_mutex(unlock, read);
+    if (!num) return;
+    // The input is parsed in place, without holding any locks, while the I/O
+    // thread reads more input into the free space of the ring
+    size_t consumed = 0;
+    for (unsigned int i = 0; i < num; i++) {
+        parse_func(screen, iov[i].iov_base, iov[i].iov_len, self->dump_callback);
+        consumed += iov[i].iov_len;
+    }
+    ring_commit_read(&screen->read_ring, consumed);
+    pacer_parsed(&pacer, consumed, interactive);
+    if (screen->latency) track_parse_latency(screen, read_at, last_read_at);
+    // Pairs with the fence in update_events(), so that either the I/O thread
+    // sees the space freed above or the read_stalled flag it set is seen here
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&screen->read_stalled, false, __ATOMIC_RELAXED)) rearm_child_with_id(id);
 }
 
-static PyObject *
-needs_write(ChildMonitor UNUSED *self, PyObject *args) {
-#define needs_write_doc "needs_write(id, data) -> Queue data to be written to child."
-    unsigned long id, sz;
-    const char *data;
-    if (!PyArg_ParseTuple(args, "ks#", &id, &data, &sz)) return NULL; 
-    if (schedule_write_to_child(id, data, sz)) { Py_RETURN_TRUE; }
-    Py_RETURN_FALSE;
+static inline unsigned long
+focused_window_id(void) {
+    if (global_state.active_tab >= global_state.num_tabs) return 0;
+    Tab *tab = global_state.tabs + global_state.active_tab;
+    return tab->active_window < tab->num_windows ? tab->windows[tab->active_window].id : 0;
 }
 
-static PyObject *
-shutdown(ChildMonitor *self) {
-#define shutdown_doc "shutdown() -> Shutdown the monitor loop."
-    signal(SIGINT, SIG_DFL);
-    signal(SIGTERM, SIG_DFL);
-    self->shutting_down = true;
-    Py_RETURN_NONE;
+static inline void
+parse_child(ChildMonitor *self, Child *c, bool focused, double now) {
+    if (!c->needs_removal) {
+        __atomic_store_n(&c->screen->read_limit, focused ? READ_BUF_SZ : UNFOCUSED_READ_LIMIT, __ATOMIC_RELAXED);
+        do_parse(self, c->id, c->screen, now, c->screen->is_visible, focused);
+    }
+    release_written_segments(c->screen);
 }
 
-static inline void
-do_parse(ChildMonitor *self, Screen *screen, double now) {
-    screen_mutex(lock, read);
-    if (screen->read_buf_sz) {
-        double time_since_new_input = now - screen->new_input_at;
-        if (time_since_new_input >= OPT(input_delay)) {
-            parse_func(screen, self->dump_callback);
-            if (screen->read_buf_sz >= READ_BUF_SZ) wakeup_io_loop();  // Ensure the read fd has POLLIN set
-            screen->read_buf_sz = 0;
-            screen->new_input_at = 0;
-        } else set_maximum_wait(OPT(input_delay) - time_since_new_input);
+// Every REBALANCE_INTERVAL seconds, a child is moved from the busiest to the
+// least busy I/O worker, if their loads, counted in reads and writes, differ
+// by more than a quarter and moving it evens them out.
+#define REBALANCE_INTERVAL 1.0
+#define MIN_REBALANCE_LOAD 64
+
+static inline IOWorker*
+rebalance_workers(double now) {
+    // Returns the worker to wake up, if any. Must be called with children_lock held.
+    static double last_rebalance_at = 0;
+    if (num_workers < 2 || now - last_rebalance_at < REBALANCE_INTERVAL) return NULL;
+    last_rebalance_at = now;
+    IOWorker *busiest = workers, *idlest = workers;
+    for (unsigned int k = 0; k < num_workers; k++) {
+        IOWorker *w = workers + k;
+        w->load = 0;
+        for (size_t i = 0; i < w->count; i++) {
+            Child *c = w->children.items + i;
+            c->recent_load = __atomic_exchange_n(&c->load, 0, __ATOMIC_RELAXED);
+            w->load += c->recent_load;
+        }
+        if (w->load > busiest->load) busiest = w;
+        if (w->load < idlest->load || (w->load == idlest->load && w->count < idlest->count)) idlest = w;
     }
-    screen_mutex(unlock, read);
+    uint64_t gap = busiest->load - idlest->load, best_diff = gap;
+    if (busiest->load < MIN_REBALANCE_LOAD || 4 * gap < busiest->load) return NULL;
+    // The child whose load is closest to half the difference, as long as
+    // moving it lowers the load of the busiest worker without making the
+    // least busy one busier than that
+    Child *best = NULL;
+    for (size_t i = 0; i < busiest->count; i++) {
+        Child *c = busiest->children.items + i;
+        if (!c->recent_load || c->recent_load >= gap || c->needs_removal || c->needs_move) continue;
+        uint64_t diff = 2 * c->recent_load > gap ? 2 * c->recent_load - gap : gap - 2 * c->recent_load;
+        if (diff < best_diff) { best = c; best_diff = diff; }
+    }
+    if (best == NULL) return NULL;
+    best->needs_move = true; best->move_to = idlest->idx;
+    queue_changes(busiest);
+    return busiest;
 }
 
+static void cancel_write_jobs(pid_t pid);
+
 static void
 parse_input(ChildMonitor *self) {
-    // Parse all available input that was read in the I/O thread.
+    // Parse all available input that was read by the I/O workers.
     size_t count = 0, remove_count = 0;
     double now = monotonic();
+    pacer.input_delay = OPT(input_delay);
     children_mutex(lock);
+    ensure_space_for(&remove_notify, items, unsigned long, remove_queue_count, capacity, 16, false);
     while (remove_queue_count) {
         remove_queue_count--; 
-        remove_notify[remove_count] = remove_queue[remove_queue_count].id;
+        remove_notify.items[remove_count] = remove_queue.items[remove_queue_count].id;
         remove_count++;
-        FREE_CHILD(remove_queue[remove_queue_count]);
+        cancel_write_jobs(remove_queue.items[remove_queue_count].pid);
+        FREE_CHILD(remove_queue.items[remove_queue_count]);
     }
 
     if (UNLIKELY(signal_received)) {
-        glfwSetWindowShouldClose(glfw_window_id, true);
+        close_main_loop();
     } else {
-        count = self->count;
-        for (size_t i = 0; i < count; i++) {
-            scratch[i] = children[i];
-            INCREF_CHILD(scratch[i]);
+        for (unsigned int k = 0; k < num_workers; k++) count += workers[k].count;
+        ensure_space_for(&scratch, items, Child, count, capacity, 16, false);
+        count = 0;
+        for (unsigned int k = 0; k < num_workers; k++) {
+            IOWorker *w = workers + k;
+            for (size_t i = 0; i < w->count; i++) {
+                scratch.items[count] = w->children.items[i];
+                INCREF_CHILD(scratch.items[count]);
+                count++;
+            }
         }
     }
+    IOWorker *rebalanced = rebalance_workers(now);
     children_mutex(unlock);
+    if (rebalanced) wakeup_worker(rebalanced);
 
     while(remove_count) {
         // must be done while no locks are held, since the locks are non-recursive and
         // the python function could call into other functions in this module
         remove_count--;
-        PyObject *t = PyObject_CallFunction(self->death_notify, "k", remove_notify[remove_count]);
+        PyObject *t = PyObject_CallFunction(self->death_notify, "k", remove_notify.items[remove_count]);
         if (t == NULL) PyErr_Print();
         else Py_DECREF(t);
     }
 
+    // The focused window is parsed first, the others in turn starting from a
+    // different one every tick
+    static size_t start = 0;
+    unsigned long focused = focused_window_id();
+    update_visibility(scratch.items, count);
+    size_t first = count;
     for (size_t i = 0; i < count; i++) {
-        if (!scratch[i].needs_removal) {
-            do_parse(self, scratch[i].screen, now);
-        }
-        DECREF_CHILD(scratch[i]);
+        if (scratch.items[i].id == focused) { first = i; break; }
+    }
+    if (first < count) parse_child(self, scratch.items + first, true, now);
+    for (size_t k = 0; k < count; k++) {
+        size_t i = (start + k) % count;
+        if (i != first) parse_child(self, scratch.items + i, false, now);
     }
+    start = count ? (start + 1) % count : 0;
+    for (size_t i = 0; i < count; i++) DECREF_CHILD(scratch.items[i]);
+}
+
+static PyObject *
+pyparse_input(ChildMonitor *self) {
+#define pyparse_input_doc "parse_input() -> Parse the input read from the children, for driving the monitor without main_loop(), as in benchmarks"
+    parse_input(self);
+    if (PyErr_Occurred()) return NULL;
+    Py_RETURN_NONE;
 }
 
 static PyObject *
-mark_for_close(ChildMonitor *self, PyObject *args) {
+mark_for_close(ChildMonitor UNUSED *self, PyObject *args) {
 #define mark_for_close_doc "Mark a child to be removed from the child monitor"
     unsigned long window_id;
     if (!PyArg_ParseTuple(args, "k", &window_id)) return NULL;
+    IOWorker *w = NULL;
     children_mutex(lock);
-    for (size_t i = 0; i < self->count; i++) {
-        if (children[i].id == window_id) {
-            children[i].needs_removal = true;
-            break;
-        }
-    }
+    Child *c = find_child(window_id, &w);
+    // Not yet picked up by its I/O worker, or moving to a different one
+    if (c == NULL) c = find_queued_child(window_id, &w);
+    if (c) { c->needs_removal = true; queue_changes(w); }
     children_mutex(unlock);
-    wakeup_io_loop();
+    if (w) wakeup_worker(w);
     Py_RETURN_NONE;
 }
 
@@ -373,25 +1468,20 @@ pty_resize(int fd, struct winsize *dim) {
 }
 
 static PyObject *
-resize_pty(ChildMonitor *self, PyObject *args) {
+resize_pty(ChildMonitor UNUSED *self, PyObject *args) {
 #define resize_pty_doc "Resize the pty associated with the specified child"
     unsigned long window_id;
     struct winsize dim;
     int fd = -1;
     if (!PyArg_ParseTuple(args, "kHHHH", &window_id, &dim.ws_row, &dim.ws_col, &dim.ws_xpixel, &dim.ws_ypixel)) return NULL;
     children_mutex(lock);
-#define FIND(queue, count) { \
-    for (size_t i = 0; i < count; i++) { \
-        if (queue[i].id == window_id) { \
-            fd = queue[i].fd; \
-            break; \
-        } \
-    }}
-    FIND(children, self->count);
-    if (fd == -1) FIND(add_queue, add_queue_count);
+    Child *c = find_child(window_id, NULL);
+    // Not yet picked up by its I/O worker
+    if (c == NULL) c = find_queued_child(window_id, NULL);
+    if (c) fd = c->fd;
     if (fd != -1) {
         if (!pty_resize(fd, &dim)) PyErr_SetFromErrno(PyExc_OSError);
-    } else fprintf(stderr, "Failed to send resize signal to child with id: %lu (children count: %u) (add queue: %lu)\n", window_id, self->count, add_queue_count);
+    } else fprintf(stderr, "Failed to send resize signal to child with id: %lu\n", window_id);
     children_mutex(unlock);
     if (PyErr_Occurred()) return NULL;
     Py_RETURN_NONE;
@@ -410,18 +1500,16 @@ set_iutf8(int UNUSED fd, bool UNUSED on) {
 }
 
 static PyObject*
-pyset_iutf8(ChildMonitor *self, PyObject *args) {
+pyset_iutf8(ChildMonitor UNUSED *self, PyObject *args) {
     unsigned long window_id;
     int on;
     PyObject *found = Py_False;
     if (!PyArg_ParseTuple(args, "kp", &window_id, &on)) return NULL;
     children_mutex(lock);
-    for (size_t i = 0; i < self->count; i++) {
-        if (children[i].id == window_id) {
-            found = Py_True;
-            if (!set_iutf8(fds[EXTRA_FDS + i].fd, on & 1)) PyErr_SetFromErrno(PyExc_OSError);
-            break;
-        }
+    Child *c = find_child(window_id, NULL);
+    if (c) {
+        found = Py_True;
+        if (!set_iutf8(c->fd, on & 1)) PyErr_SetFromErrno(PyExc_OSError);
     }
     children_mutex(unlock);
     if (PyErr_Occurred()) return NULL;
@@ -433,8 +1521,6 @@ pyset_iutf8(ChildMonitor *self, PyObject *args) {
 #undef INCREF_CHILD
 #undef DECREF_CHILD
 
-static double last_render_at = -DBL_MAX;
-
 static inline double
 cursor_width(double w, bool vert) {
     double dpi = vert ? global_state.logical_dpi_x : global_state.logical_dpi_y;
@@ -482,7 +1568,7 @@ collect_cursor_info(CursorRenderInfo *ans, Window *w, double now) {
 
 static inline void
 update_window_title(Window *w) {
-    if (w->title && w->title != global_state.application_title) {
+    if (w->title && w->title != global_state.application_title && !headless) {
         global_state.application_title = w->title;
         glfwSetWindowTitle(glfw_window_id, PyUnicode_AsUTF8(w->title));
 #ifdef __APPLE__
@@ -491,6 +1577,15 @@ update_window_title(Window *w) {
     }
 }
 
+static PyObject*
+clear_handled_signals(PyObject UNUSED *self) {
+#define clear_handled_signals_doc "Unblock the signals handled by the I/O thread, for use in child processes before they exec"
+#ifdef __linux__
+    restore_signal_mask();
+#endif
+    Py_RETURN_NONE;
+}
+
 static PyObject*
 simple_render_screen(PyObject UNUSED *self, PyObject *args) {
 #define simple_render_screen_doc "Render a Screen object, with no cursor"
@@ -503,19 +1598,44 @@ simple_render_screen(PyObject UNUSED *self, PyObject *args) {
     Py_RETURN_NONE;
 }
 
+// Null renderer {{{
+// Renders frames when headless. The cell data of screens is prepared just as
+// for drawing them, with the same conditions, but into plain memory, so that
+// the cost of preparing frames is part of what is measured headless.
+
+static void
+null_render_cells(Screen *screen) {
+    size_t num = (size_t)screen->lines * screen->columns;
+    if ((screen->scroll_changed || screen->is_dirty) && !screen_is_update_pending(screen, monotonic(), NULL)) {
+        ensure_space_for(&null_cells, items, Cell, num, capacity, 4096, false);
+        screen_update_cell_data(screen, null_cells.items, sizeof(Cell) * num);
+    }
+    if (screen_is_selection_dirty(screen)) {
+        ensure_space_for(&null_selection, items, float, num, capacity, 4096, true);
+        screen_apply_selection(screen, null_selection.items, sizeof(float) * num);
+    }
+}
+
+static inline void
+render_cells(ssize_t vao_idx, ssize_t gvao_idx, float xstart, float ystart, float dx, float dy, Screen *screen, CursorRenderInfo *cursor) {
+    if (headless) null_render_cells(screen);
+    else draw_cells(vao_idx, gvao_idx, xstart, ystart, dx, dy, screen, cursor);
+}
+// }}}
+
 static inline void
 render(double now) {
-    double time_since_last_render = now - last_render_at;
     static CursorRenderInfo cursor_info;
-    if (time_since_last_render < OPT(repaint_delay)) { 
-        set_maximum_wait(OPT(repaint_delay) - time_since_last_render);
+    pacer.repaint_delay = OPT(repaint_delay);
+    double frame_wait = pacer_frame_wait(&pacer, now);
+    if (frame_wait > 0) { 
+        set_maximum_wait(frame_wait);
         return;
     }
-
-    draw_borders();
+    if (!headless) draw_borders();
     cursor_info.is_visible = false;
 #define TD global_state.tab_bar_render_data
-    if (TD.screen && global_state.num_tabs > 1) draw_cells(TD.vao_idx, 0, TD.xstart, TD.ystart, TD.dx, TD.dy, TD.screen, &cursor_info);
+    if (TD.screen && global_state.num_tabs > 1) render_cells(TD.vao_idx, 0, TD.xstart, TD.ystart, TD.dx, TD.dy, TD.screen, &cursor_info);
 #undef TD
     if (global_state.num_tabs) {
         Tab *tab = global_state.tabs + global_state.active_tab;
@@ -531,13 +1651,26 @@ render(double now) {
                         } else w->last_drag_scroll_at = 0;
                     } else set_maximum_wait(now - w->last_drag_scroll_at);
                 }
+                // A window in the middle of a synchronized update is held
+                // back: it is drawn with the contents and cursor it was last
+                // presented with until the update ends, the other windows
+                // are drawn as usual
+                double time_left;
+                bool held_back = screen_is_update_pending(WD.screen, now, &time_left);
+                if (held_back) set_maximum_wait(time_left);
                 bool is_active_window = i == tab->active_window;
                 if (is_active_window) {
-                    collect_cursor_info(&cursor_info, w, now);
-                    update_window_title(w);
+                    if (held_back) cursor_info = w->presented_cursor;
+                    else {
+                        collect_cursor_info(&cursor_info, w, now);
+                        update_window_title(w);
+                        w->presented_cursor = cursor_info;
+                    }
                 } else cursor_info.is_visible = false;
-                draw_cells(WD.vao_idx, WD.gvao_idx, WD.xstart, WD.ystart, WD.dx, WD.dy, WD.screen, &cursor_info);
-                if (is_active_window && cursor_info.is_visible && cursor_info.shape != CURSOR_BLOCK) draw_cursor(&cursor_info);
+                if (held_back) {
+                    if (!headless) draw_rendered_frame(WD.vao_idx, WD.gvao_idx, WD.screen);
+                } else render_cells(WD.vao_idx, WD.gvao_idx, WD.xstart, WD.ystart, WD.dx, WD.dy, WD.screen, &cursor_info);
+                if (is_active_window && cursor_info.is_visible && cursor_info.shape != CURSOR_BLOCK && !headless) draw_cursor(&cursor_info);
                 if (WD.screen->start_visual_bell_at != 0) {
                     double bell_left = global_state.opts.visual_bell_duration - (now - WD.screen->start_visual_bell_at);
                     set_maximum_wait(bell_left);
@@ -547,60 +1680,441 @@ render(double now) {
         
 #undef WD
     }
-    glfwSwapBuffers(glfw_window_id);
-    last_render_at = now;
+    if (!headless) glfwSwapBuffers(glfw_window_id);
+    pacer_frame_rendered(&pacer, now);
+    if (global_state.track_latency && global_state.num_tabs) {
+        Tab *tab = global_state.tabs + global_state.active_tab;
+        double presented_at = monotonic();
+        for (unsigned int i = 0; i < tab->num_windows; i++) {
+            Window *w = tab->windows + i;
+            if (w->visible && w->render_data.screen && w->render_data.screen->latency && !screen_is_update_pending(w->render_data.screen, now, NULL)) latency_presented(w->render_data.screen->latency, presented_at);
+        }
+    }
 }
 
-typedef struct { int fd; uint8_t *buf; size_t sz; } ThreadWriteData;
+// Stdin writer {{{
+// Data for the stdin of programs, such as the pager showing the scrollback,
+// is written by a single long-lived thread, which polls the pipes of all
+// jobs and writes to them without blocking. The data of a job is queued as
+// segments that reference the python objects holding it, instead of copying
+// it. Producers, an iterator of chunks or the scrollback export, queue more
+// from the main thread as the writer drains the queue, so that only about
+// WRITE_JOB_HIGH_WATER bytes of a job are in memory at a time. The jobs for
+// a child are cancelled once it is removed, and the callback of a job is
+// called in the main thread once it is done.
+
+#define WRITE_JOB_HIGH_WATER (1024u * 1024u)
+#define MAX_WRITE_JOBS 64u
+
+typedef struct ScrollbackExport ScrollbackExport;
+static WriteSegment* next_export_segment(ScrollbackExport *e, bool *exhausted);
+static void free_export(ScrollbackExport *e);
 
-static inline ThreadWriteData*
-alloc_twd(size_t sz) {
-    ThreadWriteData *data = malloc(sizeof(ThreadWriteData));
-    if (data != NULL) {
-        data->sz = sz;
-        data->buf = malloc(sz);
-        if (data->buf == NULL) { free(data); data = NULL; }
+typedef struct {
+    unsigned long long id;
+    pid_t pid;
+    // Guarded by the writer lock. The writer thread closes queue.fd and sets
+    // finished once all data is written, the job is cancelled or writing
+    // fails. It sets wants_data when the queue runs low.
+    WriteQueue queue;
+    unsigned long long written;
+    int error;
+    bool all_queued, cancelled, finished, wants_data;
+    // Main thread only
+    PyObject *iterator, *callback;
+    ScrollbackExport *export;
+} WriteJob;
+
+static struct {
+    // Only the main thread adds and removes jobs, always with lock held
+    WriteJob *jobs[MAX_WRITE_JOBS];
+    unsigned int count;
+    unsigned long long next_id;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int wakeup_fds[2];
+    bool started, shutting_down;
+} stdin_writer = {.lock = PTHREAD_MUTEX_INITIALIZER, .wakeup_fds = {-1, -1}};
+
+#define writer_mutex(op) pthread_mutex_##op(&stdin_writer.lock);
+
+static inline void
+wakeup_writer(void) {
+    while (true) {
+        ssize_t ret = write(stdin_writer.wakeup_fds[1], "w", 1);
+        if (ret < 0 && errno == EINTR) continue;
+        break;
     }
-    return data;
 }
 
-static inline void
-free_twd(ThreadWriteData *x) {
-    if (x != NULL) free(x->buf);
-    free(x);
+static inline bool
+write_job(WriteJob *j) {
+    // Write queued data until the pipe is full. Returns true if the main
+    // thread has to release written segments or queue more data.
+    WriteQueue *q = &j->queue;
+    struct iovec iov[MAX_WRITE_IOVECS];
+    bool needs_main = false;
+    while (true) {
+        // The main thread only appends to the queue, so the segments can be
+        // written without holding the lock
+        int num = 0;
+        writer_mutex(lock);
+        size_t offset = q->offset;
+        for (WriteSegment *s = q->head; s && num < MAX_WRITE_IOVECS; s = s->next, offset = 0) {
+            iov[num].iov_base = s->data + offset;
+            iov[num++].iov_len = s->sz - offset;
+        }
+        writer_mutex(unlock);
+        if (!num) break;
+        ssize_t ret = writev(q->fd, iov, num);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        writer_mutex(lock);
+        if (ret <= 0) j->error = ret < 0 ? errno : EIO;  // EPIPE when the program exits before reading everything
+        else {
+            if (consume_written(q, ret)) needs_main = true;
+            j->written += ret;
+            if (!j->all_queued && !j->wants_data && q->queued < WRITE_JOB_HIGH_WATER / 2) { j->wants_data = true; needs_main = true; }
+        }
+        writer_mutex(unlock);
+        if (ret <= 0) break;
+    }
+    return needs_main;
 }
 
 static void*
-thread_write(void *x) {
-    ThreadWriteData *data = (ThreadWriteData*)x;
+writer_loop(void UNUSED *x) {
     set_thread_name("KittyWriteStdin");
-    FILE *f = fdopen(data->fd, "w");
-    if (fwrite(data->buf, 1, data->sz, f) != data->sz) {
-        fprintf(stderr, "Failed to write all data\n");
+    struct pollfd fds[MAX_WRITE_JOBS + 1];
+    WriteJob *polled[MAX_WRITE_JOBS];
+    fds[0].fd = stdin_writer.wakeup_fds[0]; fds[0].events = POLLIN;
+    writer_mutex(lock);
+    while (!stdin_writer.shutting_down) {
+        nfds_t num = 1;
+        bool needs_main = false;
+        for (unsigned int i = 0; i < stdin_writer.count; i++) {
+            WriteJob *j = stdin_writer.jobs[i];
+            if (j->finished) continue;
+            if (j->cancelled || j->error || (j->all_queued && !j->queue.queued)) {
+                close(j->queue.fd); j->queue.fd = -1;
+                j->finished = true; needs_main = true;
+            } else if (j->queue.queued) {
+                polled[num - 1] = j;
+                fds[num].fd = j->queue.fd; fds[num++].events = POLLOUT;
+            }
+        }
+        writer_mutex(unlock);
+        // Jobs are only freed by the main thread once they are finished, so
+        // the polled jobs can be written to without holding the lock
+        if (needs_main) wakeup_main_loop();
+        int ret = poll(fds, num, -1);
+        if (ret > 0) {
+            if (fds[0].revents & POLLIN) drain_fd(fds[0].fd);
+            needs_main = false;
+            for (nfds_t k = 1; k < num; k++) {
+                if (fds[k].revents && write_job(polled[k - 1])) needs_main = true;
+            }
+            if (needs_main) wakeup_main_loop();
+        } else if (ret < 0 && errno != EAGAIN && errno != EINTR) perror("Call to poll() in the stdin writer failed");
+        writer_mutex(lock);
     }
-    fclose(f);
-    free_twd(data);
+    writer_mutex(unlock);
     return 0;
 }
 
+static inline void
+free_write_job(WriteJob *j) {
+    free_write_queue(&j->queue);
+    Py_CLEAR(j->iterator); Py_CLEAR(j->callback);
+    free_export(j->export);
+    free(j);
+}
+
+static inline WriteJob*
+alloc_write_job(int fd, pid_t pid, PyObject *callback) {
+    WriteJob *j = calloc(1, sizeof(WriteJob));
+    if (j == NULL) { PyErr_NoMemory(); return NULL; }
+    j->queue.fd = fd; j->pid = pid;
+    if (callback != Py_None) { j->callback = callback; Py_INCREF(callback); }
+    return j;
+}
+
+static bool
+add_write_job(WriteJob *j) {
+    // Hand the job over to the writer thread, starting it if needed. On
+    // failure, a python exception is set and the caller must free the job.
+    if (stdin_writer.count >= MAX_WRITE_JOBS) { PyErr_SetString(PyExc_RuntimeError, "Too many writes in progress"); return false; }
+    int flags = fcntl(j->queue.fd, F_GETFL);
+    if (flags == -1 || fcntl(j->queue.fd, F_SETFL, flags | O_NONBLOCK) == -1) { PyErr_SetFromErrno(PyExc_OSError); return false; }
+    if (!stdin_writer.started) {
+        if (!self_pipe(stdin_writer.wakeup_fds)) { PyErr_SetFromErrno(PyExc_OSError); return false; }
+        int ret = pthread_create(&stdin_writer.thread, NULL, writer_loop, NULL);
+        if (ret != 0) {
+            close(stdin_writer.wakeup_fds[0]); close(stdin_writer.wakeup_fds[1]); stdin_writer.wakeup_fds[0] = -1; stdin_writer.wakeup_fds[1] = -1;
+            errno = ret; PyErr_SetFromErrno(PyExc_OSError); return false;
+        }
+        stdin_writer.started = true;
+    }
+    writer_mutex(lock);
+    j->id = ++stdin_writer.next_id;
+    stdin_writer.jobs[stdin_writer.count++] = j;
+    writer_mutex(unlock);
+    wakeup_writer();
+    return true;
+}
+
+static WriteSegment*
+segment_referencing(PyObject *obj) {
+    // A segment referencing the data of a bytes or str object. Returns NULL if
+    // obj is empty, or, with a python exception set, if it is neither.
+    const char *data;
+    Py_ssize_t sz;
+    if (PyBytes_Check(obj)) { data = PyBytes_AS_STRING(obj); sz = PyBytes_GET_SIZE(obj); }
+    else if (!PyArg_Parse(obj, "s#", &data, &sz)) return NULL;
+    if (!sz) return NULL;
+    WriteSegment *s = alloc_segment(0);
+    s->owner = obj; Py_INCREF(obj);
+    s->data = (uint8_t*)data; s->sz = sz;
+    return s;
+}
+
+static inline bool
+queue_job_data(WriteJob *j) {
+    // Queue data from the producer of the job until it is exhausted or
+    // WRITE_JOB_HIGH_WATER bytes are queued. Returns true if the writer
+    // thread has to be woken up.
+    writer_mutex(lock);
+    size_t queued = j->queue.queued;
+    j->wants_data = false;
+    writer_mutex(unlock);
+    bool exhausted = false, failed = false, added = false;
+    while (queued < WRITE_JOB_HIGH_WATER && !exhausted) {
+        WriteSegment *s;
+        if (j->export) s = next_export_segment(j->export, &exhausted);
+        else {
+            PyObject *chunk = PyIter_Next(j->iterator);
+            if (chunk == NULL) exhausted = true;
+            s = chunk ? segment_referencing(chunk) : NULL;
+            Py_XDECREF(chunk);
+            if (PyErr_Occurred()) { PyErr_Print(); failed = true; exhausted = true; }
+        }
+        if (s == NULL && !exhausted) continue;
+        writer_mutex(lock);
+        if (s) { append_segment(&j->queue, s); queued = j->queue.queued; }
+        j->all_queued = exhausted;
+        if (failed) j->cancelled = true;
+        writer_mutex(unlock);
+        added = true;
+    }
+    return added;
+}
+
+static void
+cancel_write_jobs(pid_t pid) {
+    // Called when the child with the specified pid is removed
+    bool found = false;
+    writer_mutex(lock);
+    for (unsigned int i = 0; i < stdin_writer.count; i++) {
+        WriteJob *j = stdin_writer.jobs[i];
+        if (j->pid == pid && !j->finished) { j->cancelled = true; found = true; }
+    }
+    writer_mutex(unlock);
+    if (found) wakeup_writer();
+}
+
+static inline void
+process_write_jobs(void) {
+    // Release written data, queue more from producers and report finished jobs
+    WriteJob *finished[MAX_WRITE_JOBS];
+    unsigned int num_finished = 0, num = 0;
+    bool wake = false;
+    writer_mutex(lock);
+    for (unsigned int i = 0; i < stdin_writer.count; i++) {
+        WriteJob *j = stdin_writer.jobs[i];
+        if (j->finished) finished[num_finished++] = j;
+        else stdin_writer.jobs[num++] = j;
+    }
+    stdin_writer.count = num;
+    writer_mutex(unlock);
+    // Producers and callbacks can add jobs, but never remove them
+    for (unsigned int i = 0; i < stdin_writer.count; i++) {
+        WriteJob *j = stdin_writer.jobs[i];
+        writer_mutex(lock);
+        WriteSegment *done = j->queue.done;
+        j->queue.done = NULL;
+        bool wants_data = j->wants_data && !j->all_queued && !j->cancelled;
+        writer_mutex(unlock);
+        free_segments(done);
+        if (wants_data && queue_job_data(j)) wake = true;
+    }
+    if (wake) wakeup_writer();
+    for (unsigned int i = 0; i < num_finished; i++) {
+        WriteJob *j = finished[i];
+        if (j->callback) {
+            PyObject *ret = PyObject_CallFunction(j->callback, "KKi", j->id, j->written, j->cancelled ? ECANCELED : j->error);
+            if (ret == NULL) PyErr_Print();
+            else Py_DECREF(ret);
+        }
+        free_write_job(j);
+    }
+}
+
+static void
+stop_writer(void) {
+    // Jobs that are not finished yet are abandoned
+    if (!stdin_writer.started) return;
+    writer_mutex(lock);
+    stdin_writer.shutting_down = true;
+    writer_mutex(unlock);
+    wakeup_writer();
+    pthread_join(stdin_writer.thread, NULL);
+    for (unsigned int i = 0; i < stdin_writer.count; i++) {
+        if (!stdin_writer.jobs[i]->finished) close(stdin_writer.jobs[i]->queue.fd);
+        free_write_job(stdin_writer.jobs[i]);
+    }
+    stdin_writer.count = 0;
+    close(stdin_writer.wakeup_fds[0]); close(stdin_writer.wakeup_fds[1]); stdin_writer.wakeup_fds[0] = -1; stdin_writer.wakeup_fds[1] = -1;
+    stdin_writer.started = false; stdin_writer.shutting_down = false;
+}
+
+static inline PyObject*
+write_failed(int fd) {
+    // The writes take ownership of fd, so it is closed when they fail, for
+    // the reader not to wait for data forever
+    if (fd > -1) close(fd);
+    return NULL;
+}
+
 PyObject*
 cm_thread_write(PyObject UNUSED *self, PyObject *args) {
-    static pthread_t thread;
-    int fd;
-    Py_ssize_t sz;
-    const char *buf;
-    if (!PyArg_ParseTuple(args, "is#", &fd, &buf, &sz)) return NULL;
-    ThreadWriteData *data = alloc_twd(sz);
-    if (data == NULL) return PyErr_NoMemory();
-    data->fd = fd; 
-    memcpy(data->buf, buf, data->sz);
-    int ret = pthread_create(&thread, NULL, thread_write, data);
-    if (ret != 0) { free_twd(data); return PyErr_SetFromErrno(PyExc_OSError); }
-    Py_RETURN_NONE;
+    // thread_write(fd, data, pid=0, callback=None) -> Write data, bytes, str
+    // or an iterator of them, to fd in the stdin writer thread and close fd
+    // once done, or right away if it fails. Returns the id of the job, which is cancelled when the child
+    // with the specified pid is removed. Once done, callback is called with
+    // the id, the number of bytes written and an errno code, 0 on success.
+    int fd = -1, pid = 0;
+    PyObject *data, *callback = Py_None, *iterator = NULL;
+    WriteSegment *s = NULL;
+    if (!PyArg_ParseTuple(args, "iO|iO", &fd, &data, &pid, &callback)) return write_failed(fd);
+    if (PyBytes_Check(data) || PyUnicode_Check(data)) {
+        s = segment_referencing(data);
+        if (s == NULL && PyErr_Occurred()) return write_failed(fd);
+    } else if ((iterator = PyObject_GetIter(data)) == NULL) return write_failed(fd);
+    WriteJob *j = alloc_write_job(fd, pid, callback);
+    if (j == NULL) { free_segments(s); Py_XDECREF(iterator); return write_failed(fd); }
+    if (iterator) { j->iterator = iterator; queue_job_data(j); }
+    else {
+        if (s) append_segment(&j->queue, s);
+        j->all_queued = true;
+    }
+    if (!add_write_job(j)) { free_write_job(j); return write_failed(fd); }
+    return PyLong_FromUnsignedLongLong(j->id);
+}
+// }}}
+
+// Scrollback export {{{
+// The scrollback is encoded as ANSI escaped UTF-8 in the main thread, a chunk
+// at a time, as the stdin writer drains the chunks already encoded. Neither
+// the memory used nor the time spent per loop iteration grow with the size
+// of the scrollback, and a pager that is slow to read never blocks the main
+// loop.
+
+#define EXPORT_CHUNK_SIZE (256u * 1024u)
+// The space needed for one line: line_as_ansi() output encoded as UTF-8, a
+// newline before it and the newline at the end of the export
+#define EXPORT_LINE_BUF_SIZE 5120u
+#define MAX_EXPORT_LINE_SIZE (EXPORT_LINE_BUF_SIZE * 4u + 2u)
+
+struct ScrollbackExport {
+    Screen *screen;
+    HistoryBuf *historybuf;
+    // The buffer that was visible when the export started, main or alternate
+    LineBuf *linebuf;
+    index_type columns, num_history_lines;
+    uint64_t num_added_at_start, next_line, num_lines;
+    bool started;
+};
+
+static inline Line*
+export_line(ScrollbackExport *e, uint64_t num) {
+    // Returns the line num lines below the top of the scrollback as it was
+    // when the export started, or NULL if it has since been evicted. Output
+    // that arrives during the export scrolls lines from the screen into the
+    // history buffer and out of it, so lines are located relative to the
+    // number of lines added since the start.
+    HistoryBuf *hb = e->historybuf;
+    int64_t shift = hb->num_added - e->num_added_at_start;
+    // The lines of the alternate screen never scroll into the history buffer
+    if (e->linebuf != e->screen->main_linebuf && num >= e->num_history_lines) shift = 0;
+    int64_t lnum = (int64_t)e->num_history_lines - 1 - (int64_t)num + shift;
+    if (lnum >= 0) {
+        if (lnum >= hb->count) return NULL;
+        historybuf_init_line(hb, lnum, hb->line);
+        return hb->line;
+    }
+    index_type y = -lnum - 1;
+    if (y >= e->screen->lines) return NULL;
+    linebuf_init_line(e->linebuf, y);
+    return e->linebuf->line;
+}
+
+static WriteSegment*
+next_export_segment(ScrollbackExport *e, bool *exhausted) {
+    static Py_UCS4 t[EXPORT_LINE_BUF_SIZE];
+    WriteSegment *s = alloc_segment(EXPORT_CHUNK_SIZE);
+    char *data = (char*)s->data;
+    // A resize rewraps all lines, ending the export with what has been written so far
+    if (e->screen->historybuf != e->historybuf || e->screen->columns != e->columns) e->next_line = e->num_lines;
+    while (e->next_line < e->num_lines && EXPORT_CHUNK_SIZE - s->sz >= MAX_EXPORT_LINE_SIZE) {
+        Line *line = export_line(e, e->next_line++);
+        if (line == NULL) continue;
+        if (e->started && !line->continued) data[s->sz++] = '\n';
+        e->started = true;
+        index_type num = line_as_ansi(line, t, EXPORT_LINE_BUF_SIZE);
+        for (index_type i = 0; i < num; i++) s->sz += encode_utf8(t[i], data + s->sz);
+    }
+    if (e->next_line >= e->num_lines) { data[s->sz++] = '\n'; *exhausted = true; }
+    return s;
+}
+
+static void
+free_export(ScrollbackExport *e) {
+    if (e == NULL) return;
+    Py_CLEAR(e->screen); Py_CLEAR(e->historybuf); Py_CLEAR(e->linebuf);
+    free(e);
+}
+
+PyObject*
+cm_stream_scrollback(PyObject UNUSED *self, PyObject *args) {
+    // stream_scrollback(fd, screen, pid=0, callback=None) -> Like
+    // thread_write(), for the scrollback and screen of screen
+    int fd = -1, pid = 0;
+    Screen *screen;
+    PyObject *callback = Py_None;
+    if (!PyArg_ParseTuple(args, "iO!|iO", &fd, &Screen_Type, &screen, &pid, &callback)) return write_failed(fd);
+    WriteJob *j = alloc_write_job(fd, pid, callback);
+    if (j == NULL) return write_failed(fd);
+    ScrollbackExport *e = calloc(1, sizeof(ScrollbackExport));
+    if (e == NULL) { free_write_job(j); PyErr_NoMemory(); return write_failed(fd); }
+    // The pager needs every line, so rewrap any lines still pending from a resize up front
+    historybuf_materialize(screen->historybuf, UINT_MAX);
+    e->screen = screen; Py_INCREF(screen);
+    e->historybuf = screen->historybuf; Py_INCREF(e->historybuf);
+    e->linebuf = screen->linebuf; Py_INCREF(e->linebuf);
+    e->columns = screen->columns;
+    e->num_history_lines = e->historybuf->count;
+    e->num_added_at_start = e->historybuf->num_added;
+    e->num_lines = (uint64_t)e->num_history_lines + screen->lines;
+    j->export = e;
+    queue_job_data(j);
+    if (!add_write_job(j)) { free_write_job(j); return write_failed(fd); }
+    return PyLong_FromUnsignedLongLong(j->id);
 }
+// }}}
 
 static inline void
 hide_mouse(double now) {
+    if (headless) return;
     if (glfwGetInputMode(glfw_window_id, GLFW_CURSOR) == GLFW_CURSOR_NORMAL && OPT(mouse_hide_wait) > 0 && now - global_state.last_mouse_activity_at > OPT(mouse_hide_wait)) {
         glfwSetInputMode(glfw_window_id, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
     }
@@ -609,17 +2123,34 @@ hide_mouse(double now) {
 
 static inline void
 wait_for_events() {
-    if (maximum_wait < 0) glfwWaitEvents();
+    if (headless) { if (maximum_wait != 0) headless_wait(maximum_wait); }
+    else if (maximum_wait < 0) glfwWaitEvents();
     else if (maximum_wait > 0) glfwWaitEventsTimeout(maximum_wait);
     maximum_wait = -1;
 }
 
 
+static inline void
+process_pending_resizes(double now) {
+    double time_since_last_resize = now - global_state.last_resize_event_at;
+    if (time_since_last_resize < OPT(resize_debounce_time)) set_maximum_wait(OPT(resize_debounce_time) - time_since_last_resize);
+    else apply_pending_resize();
+}
+
 static PyObject*
-main_loop(ChildMonitor *self) {
-#define main_loop_doc "The main thread loop"
-    while (!glfwWindowShouldClose(glfw_window_id)) {
+main_loop(ChildMonitor *self, PyObject *args) {
+#define main_loop_doc "main_loop(run_for=0) -> The main thread loop. If run_for is positive, it returns after that many seconds, even if it was not closed."
+    double run_for = 0;
+    if (!PyArg_ParseTuple(args, "|d", &run_for)) return NULL;
+    double stop_at = run_for > 0 ? monotonic() + run_for : 0;
+    while (!main_loop_should_close()) {
         double now = monotonic();
+        if (stop_at) {
+            if (now >= stop_at) break;
+            set_maximum_wait(stop_at - now);
+        }
+        if (global_state.has_pending_resizes) process_pending_resizes(now);
+        if (stdin_writer.count) process_write_jobs();
         render(now);
         hide_mouse(now);
         wait_for_events();
@@ -629,20 +2160,59 @@ main_loop(ChildMonitor *self) {
     Py_RETURN_NONE;
 }
 
+static PyObject*
+pyclose(ChildMonitor UNUSED *self) {
+#define pyclose_doc "close() -> Make the main loop return, by closing the window, or when headless, by itself"
+    close_main_loop();
+    Py_RETURN_NONE;
+}
+
 // }}}
 
 // I/O thread functions {{{
 
 static inline void
-add_children(ChildMonitor *self) {
-    for (; add_queue_count > 0 && self->count < MAX_CHILDREN;) {
-        add_queue_count--;
-        children[self->count] = add_queue[add_queue_count];
-        add_queue[add_queue_count] = EMPTY_CHILD;
-        fds[EXTRA_FDS + self->count].fd = children[self->count].fd;
-        fds[EXTRA_FDS + self->count].events = POLLIN;
-        self->count++;
+update_events(IOWorker *w, size_t i) {
+    // Wait for input only while the read ring holds less than read_limit
+    // bytes and for output only while there is data to write
+    Screen *screen = w->children.items[i].screen;
+    bool full = input_over_limit(screen);
+    if (full) {
+        // The main thread re-arms the child once it has freed some space
+        __atomic_store_n(&screen->read_stalled, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        full = input_over_limit(screen);
+    }
+    screen_mutex(lock, write);
+    int events = (full ? 0 : POLLIN) | (screen->write_queue.queued ? POLLOUT : 0);
+    screen_mutex(unlock, write);
+    if (events != w->children.items[i].events) poller_set(w, i, events);
+}
+
+static inline void
+add_children(IOWorker *w) {
+    if (!w->add_queue_count) return;
+    ensure_space_for(&w->children, items, Child, w->count + w->add_queue_count, capacity, 16, true);
+    poller_reserve(w, w->count + w->add_queue_count);
+    while (w->add_queue_count) {
+        w->add_queue_count--;
+        w->children.items[w->count] = w->add_queue.items[w->add_queue_count];
+        w->add_queue.items[w->add_queue_count] = EMPTY_CHILD;
+        child_map_set(w->children.items[w->count].id, w->idx, w->count);
+        update_events(w, w->count);
+        w->count++;
+    }
+}
+
+static inline void
+rearm_children(IOWorker *w) {
+    // Must run before remove_children(), which changes the indices of children
+    for (size_t q = 0; q < w->rearm_queue_count; q++) {
+        size_t i = w->rearm_queue.items[q];
+        w->children.items[i].rearm_queued = false;
+        update_events(w, i);
     }
+    w->rearm_queue_count = 0;
 }
 
 
@@ -659,183 +2229,357 @@ hangup(pid_t pid) {
 
 
 static inline void
-cleanup_child(ssize_t i) {
-    close(children[i].fd);
-    hangup(children[i].pid);
+cleanup_child(Child *c) {
+    // The main thread must not write to the fd once it is closed, as the fd
+    // could be re-used
+    Screen *screen = c->screen;
+    screen_mutex(lock, write);
+    screen->write_queue.fd = -1;
+    screen_mutex(unlock, write);
+    close(c->fd);
+    hangup(c->pid);
 }
 
 
 static inline void
-remove_children(ChildMonitor *self) {
-    if (self->count > 0) {
-        size_t count = 0; 
-        for (ssize_t i = self->count - 1; i >= 0; i--) {
-            if (children[i].needs_removal) {
-                count++;
-                cleanup_child(i);
-                remove_queue[remove_queue_count] = children[i];
-                remove_queue_count++;
-                children[i] = EMPTY_CHILD;
-                fds[EXTRA_FDS + i].fd = -1;
-                size_t num_to_right = self->count - 1 - i;
-                if (num_to_right > 0) {
-                    memmove(children + i, children + i + 1, num_to_right * sizeof(Child));
-                    memmove(fds + EXTRA_FDS + i, fds + EXTRA_FDS + i + 1, num_to_right * sizeof(struct pollfd));
-                }
-            }
+remove_children(IOWorker *w) {
+    // Remove the children marked for removal and hand over the children
+    // marked for moving to their new worker
+    for (ssize_t i = (ssize_t)w->count - 1; i >= 0; i--) {
+        Child *c = w->children.items + i;
+        if (!c->needs_removal && !c->needs_move) continue;
+        if (c->events) poller_set(w, i, 0);
+        child_map_remove(c->id);
+        if (c->needs_removal) {
+            cleanup_child(c);
+            ensure_space_for(&remove_queue, items, Child, remove_queue_count + 1, capacity, 16, true);
+            remove_queue.items[remove_queue_count++] = *c;
+        } else {
+            IOWorker *dest = workers + c->move_to;
+            c->needs_move = false;
+            ensure_space_for(&dest->add_queue, items, Child, dest->add_queue_count + 1, capacity, 16, true);
+            dest->add_queue.items[dest->add_queue_count++] = *c;
+            queue_changes(dest);
+            wakeup_worker(dest);
+        }
+        // Fill the gap with the last child, so that only one child changes its index
+        w->count--;
+        w->children.items[i] = w->children.items[w->count];
+        w->children.items[w->count] = EMPTY_CHILD;
+        if ((size_t)i < w->count) {
+            child_map_set(w->children.items[i].id, w->idx, i);
+            poller_moved(w, i);
         }
-        self->count -= count;
     }
 }
 
+static void
+remove_all_children(IOWorker *w) {
+    // Must be called with children_lock held, once the worker has finished
+    add_children(w);
+    for (size_t i = 0; i < w->count; i++) w->children.items[i].needs_removal = true;
+    remove_children(w);
+}
+
+
+static inline bool
+has_terminal_query(const uint8_t *buf, size_t sz) {
+    // Whether buf contains an escape code the terminal responds to, such as
+    // DA, DSR, DECRQM, DCS requests or graphics commands. An incomplete escape
+    // code at the end of buf is treated as a query, since the rest of it is
+    // not available yet.
+    const uint8_t *end = buf + sz, *p = buf;
+    while ((p = memchr(p, 0x1b, end - p)) != NULL) {
+        if (++p >= end) return true;
+        switch(*p) {
+            case '[': {
+                uint8_t intermediate = 0;
+                for (p++; p < end && (*p < 0x40 || *p > 0x7e); p++) intermediate = *p;
+                if (p >= end || *p == 'c' || *p == 'n' || (*p == 'p' && intermediate == '$')) return true;
+                break;
+            }
+            case 'P':
+            case '_':
+            case 'Z':
+                return true;
+        }
+    }
+    return false;
+}
 
 static bool
-read_bytes(int fd, Screen *screen) {
+read_bytes(int fd, Screen *screen, bool *needs_parse) {
     ssize_t len;
-    size_t available_buffer_space, orig_sz;
-
-    screen_mutex(lock, read);
-    orig_sz = screen->read_buf_sz;
-    if (orig_sz >= READ_BUF_SZ) { screen_mutex(unlock, read); return true; }  // screen read buffer is full
-    available_buffer_space = READ_BUF_SZ - orig_sz;
-    screen_mutex(unlock, read);
+    struct iovec iov[2];
+    // Read straight into the free space of the ring, which only this thread
+    // writes to, up to read_limit
+    size_t used = ring_used(&screen->read_ring), limit = __atomic_load_n(&screen->read_limit, __ATOMIC_RELAXED);
+    unsigned int num = limit_iov(iov, ring_write_space(&screen->read_ring, iov), limit > used ? limit - used : 0);
+    if (!num) return true;  // screen read ring is full
 
     while(true) {
-        len = read(fd, screen->read_buf + orig_sz, available_buffer_space);
+        len = readv(fd, iov, num);
         if (len < 0) {
             if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { *needs_parse = false; return true; }
             if (errno != EIO) perror("Call to read() from child fd failed");
             return false;
         }
         break;
     }
     if (UNLIKELY(len == 0)) return false;
+    bool has_query = false;
+    if (__atomic_load_n(&screen->throttle_parsing, __ATOMIC_RELAXED)) {
+        // An escape code split between the two regions is seen as incomplete at the end of the first
+        size_t first = MIN((size_t)len, iov[0].iov_len);
+        has_query = has_terminal_query(iov[0].iov_base, first) || ((size_t)len > first && has_terminal_query(iov[1].iov_base, len - first));
+    }
 
     screen_mutex(lock, read);
+    ring_commit_write(&screen->read_ring, len);
+    // The main thread only needs to be woken up for throttled input when the
+    // timer for the batch has to be started or the batch must be parsed now
+    *needs_parse = !screen->throttle_parsing || screen->new_input_at == 0 || has_query || input_over_limit(screen);
     if (screen->new_input_at == 0) screen->new_input_at = monotonic();
-    if (orig_sz != screen->read_buf_sz) {
-        // The other thread consumed some of the screen read buffer
-        memmove(screen->read_buf + screen->read_buf_sz, screen->read_buf + orig_sz, len);
+    if (screen->latency) {
+        screen->latency->last_read_at = monotonic();
+        stamp_read(screen->latency, screen->read_ring.head, screen->latency->last_read_at);
     }
-    screen->read_buf_sz += len;
+    if (has_query) screen->has_pending_query = true;
     screen_mutex(unlock, read);
     return true;
 }
 
 
-static inline void
-drain_fd(int fd) {
-    while(true) {
-        ssize_t len = read(fd, drain_buf, sizeof(drain_buf));
-        if (len < 0) {
-            if (errno == EINTR) continue;
-            if (errno != EIO) perror("Call to read() from drain fd failed");
-            break;
-        }
-        break;
-    }
-}
-
-static inline void
+static inline bool
 write_to_child(int fd, Screen *screen) {
-    size_t written = 0;
-    ssize_t ret = 0;
-    screen_mutex(lock, write);
-    while (written < screen->write_buf_used) {
-        ret = write(fd, screen->write_buf + written, screen->write_buf_used - written);
-        if (ret > 0) { written += ret; }
-        else if (ret == 0) { 
-            // could mean anything, ignore
-            break;
-        } else {
+    // Write queued data until the child stops accepting it. Returns true if
+    // the main thread has to release written segments.
+    WriteQueue *q = &screen->write_queue;
+    struct iovec iov[MAX_WRITE_IOVECS];
+    bool has_done = false;
+    while (true) {
+        // The main thread only appends to the queue, so the segments can be
+        // written without holding the lock
+        int num = 0;
+        screen_mutex(lock, write);
+        size_t offset = q->offset;
+        for (WriteSegment *s = q->head; s && num < MAX_WRITE_IOVECS; s = s->next, offset = 0) {
+            iov[num].iov_base = s->data + offset;
+            iov[num++].iov_len = s->sz - offset;
+        }
+        screen_mutex(unlock, write);
+        if (!num) break;
+        size_t written;
+        ssize_t ret = writev(fd, iov, num);
+        if (ret > 0) written = ret;
+        else if (ret == 0) break;  // could mean anything, ignore
+        else {
             if (errno == EINTR) continue;
             if (errno == EWOULDBLOCK || errno == EAGAIN) break;
-            perror("Call to write() to child fd failed, discarding data.");
-            written = screen->write_buf_used;
+            perror("Call to writev() to child fd failed, discarding data.");
+            written = SIZE_MAX;
         }
+        screen_mutex(lock, write);
+        if (consume_written(q, written)) has_done = true;
+        if (screen->latency && screen->latency->key_at && !q->queued) latency_key_written(screen->latency, monotonic());
+        screen_mutex(unlock, write);
     }
-    screen->write_buf_used -= written;
-    screen_mutex(unlock, write);
+    return has_done;
 }
 
 static void*
 io_loop(void *data) {
-    // The I/O thread loop
-    size_t i;
-    int ret;
-    bool has_more, data_received; 
-    Screen *screen;
-    ChildMonitor *self = (ChildMonitor*)data;
-    set_thread_name("KittyChildMon");
+    // The loop of an I/O worker thread
+    size_t i, num_ready;
+    int revents;
+    bool has_more, data_received, needs_parse, signalled;
+    IOWorker *w = (IOWorker*)data;
+    ChildMonitor *self = the_monitor;
+    // Thread names are limited to 15 characters, which leaves room for the
+    // two digits of indices below MAX_IO_WORKERS
+    char name[24] = "KittyChildMon";
+    if (w->idx) { snprintf(name, sizeof(name), "KittyChildMon%u", w->idx); name[15] = 0; }
+    set_thread_name(name);
 
     while (LIKELY(!self->shutting_down)) {
-        children_mutex(lock);
-        remove_children(self);
-        add_children(self);
-        children_mutex(unlock);
-        data_received = false;
-        for (i = 0; i < self->count + EXTRA_FDS; i++) fds[i].revents = 0;
-        for (i = 0; i < self->count; i++) {
-            screen = children[i].screen;
-            /* printf("i:%lu id:%lu fd: %d read_buf_sz: %lu write_buf_used: %lu\n", i, children[i].id, children[i].fd, screen->read_buf_sz, screen->write_buf_used); */
-            screen_mutex(lock, read); screen_mutex(lock, write);
-            fds[EXTRA_FDS + i].events = (screen->read_buf_sz < READ_BUF_SZ ? POLLIN : 0) | (screen->write_buf_used ? POLLOUT  : 0);
-            screen_mutex(unlock, read); screen_mutex(unlock, write);
-        }
-        ret = poll(fds, self->count + EXTRA_FDS, -1);
-        if (ret > 0) {
-            if (fds[0].revents && POLLIN) drain_fd(fds[0].fd); // wakeup
-            if (fds[1].revents && POLLIN) { 
-                data_received = true;
-                drain_fd(fds[1].fd);
-                children_mutex(lock);
-                signal_received = true;
-                children_mutex(unlock);
-            }
-            for (i = 0; i < self->count; i++) {
-                if (fds[EXTRA_FDS + i].revents & (POLLIN | POLLHUP)) {
+        if (__atomic_load_n(&w->has_changes, __ATOMIC_ACQUIRE)) {
+            children_mutex(lock);
+            __atomic_store_n(&w->has_changes, false, __ATOMIC_RELAXED);
+            rearm_children(w);
+            // Children are added first, so that those marked for removal
+            // while in the add queue are removed
+            add_children(w);
+            remove_children(w);
+            children_mutex(unlock);
+        }
+        data_received = false; signalled = false;
+        num_ready = poller_wait(w, &signalled);
+        if (signalled) {
+            data_received = true;
+            children_mutex(lock);
+            signal_received = true;
+            children_mutex(unlock);
+        }
+        for (size_t k = 0; k < num_ready; k++) {
+            i = w->ready.items[k].idx; revents = w->ready.items[k].revents;
+            Child *c = w->children.items + i;
+            __atomic_add_fetch(&c->load, 1, __ATOMIC_RELAXED);
+            if (revents & (POLLIN | POLLHUP)) {
+                needs_parse = true;
+                has_more = read_bytes(c->fd, c->screen, &needs_parse);
+                if (needs_parse) data_received = true;
+                if (!has_more) { 
+                    // child is dead
                     data_received = true;
-                    has_more = read_bytes(fds[EXTRA_FDS + i].fd, children[i].screen);
-                    if (!has_more) { 
-                        // child is dead
-                        children_mutex(lock);
-                        children[i].needs_removal = true;
-                        children_mutex(unlock);
-                    }
-                }
-                if (fds[EXTRA_FDS + i].revents & POLLOUT) {
-                    write_to_child(children[i].fd, children[i].screen);
-                }
-                if (fds[EXTRA_FDS + i].revents & POLLNVAL) {
-                    // fd was closed
                     children_mutex(lock);
-                    children[i].needs_removal = true;
+                    c->needs_removal = true;
+                    queue_changes(w);
                     children_mutex(unlock);
-                    fprintf(stderr, "The child %lu had its fd unexpectedly closed\n", children[i].id);
                 }
             }
+            if (revents & POLLOUT) {
+                if (write_to_child(c->fd, c->screen)) data_received = true;
+            }
+            if (revents & POLLNVAL) {
+                // fd was closed
+                children_mutex(lock);
+                c->needs_removal = true;
+                queue_changes(w);
+                children_mutex(unlock);
+                fprintf(stderr, "The child %lu had its fd unexpectedly closed\n", c->id);
+            }
+            update_events(w, i);
 #ifdef DEBUG_POLL_EVENTS
-            for (i = 0; i < self->count + EXTRA_FDS; i++) {
-#define P(w) if (fds[i].revents & w) printf("i:%lu %s\n", i, #w);
-                P(POLLIN); P(POLLPRI); P(POLLOUT); P(POLLERR); P(POLLHUP); P(POLLNVAL);
+#define P(w) if (revents & w) printf("i:%lu %s\n", i, #w);
+            P(POLLIN); P(POLLOUT); P(POLLHUP); P(POLLNVAL);
 #undef P
-            }
 #endif
-        } else if (ret < 0) {
-            if (errno != EAGAIN && errno != EINTR) {
-                perror("Call to poll() failed");
-            }
         }
         if (data_received) wakeup_main_loop();
     }
     children_mutex(lock);
-    for (i = 0; i < self->count; i++) children[i].needs_removal = true;
-    remove_children(self);
+    remove_all_children(w);
     children_mutex(unlock);
     return 0;
 }
 // }}}
 
+// Byte ring test {{{
+// Streams bytes through a ByteRing from a producer thread to a consumer
+// thread, the way the I/O thread hands input to the main thread. The bytes
+// repeat with a period that is not a power of two, so that data ending up at
+// the wrong place in the ring is detected.
+
+#define RING_TEST_PERIOD 65521
+
+typedef struct {
+    ByteRing ring;
+    uint8_t *pattern;
+    size_t total, max_chunk;
+    uint64_t rng;
+} RingTest;
+
+static inline size_t
+ring_test_chunk(RingTest *t, size_t limit) {
+    // xorshift64
+    t->rng ^= t->rng << 13; t->rng ^= t->rng >> 7; t->rng ^= t->rng << 17;
+    return MIN(limit, 1 + t->rng % t->max_chunk);
+}
+
+static void*
+ring_test_producer(void *data) {
+    RingTest *t = (RingTest*)data;
+    struct iovec iov[2];
+    size_t pos = 0;
+    while (pos < t->total) {
+        unsigned int num = ring_write_space(&t->ring, iov);
+        if (!num) { sched_yield(); continue; }
+        size_t n = ring_test_chunk(t, t->total - pos), written = 0;
+        for (unsigned int i = 0; i < num && written < n; i++) {
+            size_t k = MIN(iov[i].iov_len, n - written);
+            memcpy(iov[i].iov_base, t->pattern + (pos + written) % RING_TEST_PERIOD, k);
+            written += k;
+        }
+        ring_commit_write(&t->ring, written);
+        pos += written;
+    }
+    return NULL;
+}
+
+static PyObject*
+test_byte_ring(PyObject UNUSED *self, PyObject *args) {
+#define test_byte_ring_doc "test_byte_ring(total, capacity, max_chunk, seed) -> Stream total bytes through a ring of the specified capacity between two threads, in randomly sized chunks, checking that every byte arrives intact and in order"
+    unsigned long long total, seed;
+    unsigned long capacity, max_chunk;
+    if (!PyArg_ParseTuple(args, "KkkK", &total, &capacity, &max_chunk, &seed)) return NULL;
+    if (!capacity || (capacity & (capacity - 1)) || !max_chunk || !seed) { PyErr_SetString(PyExc_ValueError, "capacity must be a power of two, max_chunk and seed must be non-zero"); return NULL; }
+    RingTest producer = {.total = total, .max_chunk = max_chunk, .rng = seed}, consumer;
+    uint8_t *buf = malloc(capacity);
+    // Large enough for a chunk starting anywhere in the period to be contiguous
+    producer.pattern = malloc(RING_TEST_PERIOD + MAX(capacity, max_chunk));
+    if (buf == NULL || producer.pattern == NULL) { free(buf); free(producer.pattern); return PyErr_NoMemory(); }
+    for (size_t i = 0; i < RING_TEST_PERIOD + MAX(capacity, max_chunk); i++) {
+        producer.pattern[i] = i < RING_TEST_PERIOD ? (uint8_t)ring_test_chunk(&producer, 256) : producer.pattern[i - RING_TEST_PERIOD];
+    }
+    ring_init(&producer.ring, buf, capacity);
+    consumer = producer;
+    ByteRing *ring = &producer.ring;
+    pthread_t thread;
+    size_t pos = 0, bad = SIZE_MAX;
+    int ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = pthread_create(&thread, NULL, ring_test_producer, &producer);
+    if (ret == 0) {
+        struct iovec iov[2];
+        while (pos < total) {
+            unsigned int num = ring_read_space(ring, iov);
+            if (!num) { sched_yield(); continue; }
+            size_t n = ring_test_chunk(&consumer, total - pos), consumed = 0;
+            for (unsigned int i = 0; i < num && consumed < n; i++) {
+                size_t k = MIN(iov[i].iov_len, n - consumed);
+                if (bad == SIZE_MAX && memcmp(iov[i].iov_base, producer.pattern + (pos + consumed) % RING_TEST_PERIOD, k) != 0) bad = pos + consumed;
+                consumed += k;
+            }
+            ring_commit_read(ring, consumed);
+            pos += consumed;
+        }
+        pthread_join(thread, NULL);
+    }
+    Py_END_ALLOW_THREADS
+    free(buf); free(producer.pattern);
+    if (ret != 0) { errno = ret; return PyErr_SetFromErrno(PyExc_OSError); }
+    if (bad != SIZE_MAX) { PyErr_Format(PyExc_ValueError, "Corrupted data in the chunk starting at byte: %zu", bad); return NULL; }
+    if (ring_used(ring)) { PyErr_SetString(PyExc_ValueError, "Ring not empty after all data was consumed"); return NULL; }
+    Py_RETURN_NONE;
+}
+
+#undef RING_TEST_PERIOD
+// }}}
+
+// Latency histogram test {{{
+
+static PyObject*
+test_latency_histogram(PyObject UNUSED *self, PyObject *values) {
+#define test_latency_histogram_doc "test_latency_histogram(values) -> The stats of a latency histogram of values, in seconds, as returned by Screen.latency_stats()"
+    PyObject *seq = PySequence_Fast(values, "values must be a sequence");
+    if (seq == NULL) return NULL;
+    LatencyHistogram *h = PyMem_Calloc(1, sizeof(LatencyHistogram));
+    if (h == NULL) { Py_DECREF(seq); return PyErr_NoMemory(); }
+    PyObject *ans = NULL;
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        double val = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+        if (PyErr_Occurred()) goto end;
+        latency_record(h, val);
+    }
+    ans = latency_histogram_stats(h);
+end:
+    PyMem_Free(h); Py_DECREF(seq);
+    return ans;
+}
+
+// }}}
+
 // Boilerplate {{{
 static PyMethodDef methods[] = {
     METHOD(add_child, METH_VARARGS)
@@ -844,7 +2588,10 @@ static PyMethodDef methods[] = {
     METHOD(join, METH_NOARGS)
     METHOD(wakeup, METH_NOARGS)
     METHOD(shutdown, METH_NOARGS)
-    METHOD(main_loop, METH_NOARGS)
+    METHOD(main_loop, METH_VARARGS)
+    {"parse_input", (PyCFunction)pyparse_input, METH_NOARGS, pyparse_input_doc},
+    {"close", (PyCFunction)pyclose, METH_NOARGS, pyclose_doc},
+    METHOD(pacing_stats, METH_NOARGS)
     METHOD(mark_for_close, METH_VARARGS)
     METHOD(resize_pty, METH_VARARGS)
     {"set_iutf8", (PyCFunction)pyset_iutf8, METH_VARARGS, ""},
@@ -865,6 +2612,10 @@ PyTypeObject ChildMonitor_Type = {
 
 static PyMethodDef module_methods[] = {
     METHOD(simple_render_screen, METH_VARARGS)
+    METHOD(clear_handled_signals, METH_NOARGS)
+    METHOD(test_byte_ring, METH_VARARGS)
+    METHOD(test_frame_pacer, METH_VARARGS)
+    METHOD(test_latency_histogram, METH_O)
     {NULL}  /* Sentinel */
 };
 
@@ -39,6 +39,7 @@ class Child:
             remove_cloexec(stdin_read_fd)
         pid = os.fork()
         if pid == 0:  # child
+            fast_data_types.clear_handled_signals()
             try:
                 os.chdir(self.cwd)
             except EnvironmentError:
@@ -74,5 +75,9 @@ class Child:
             self.child_fd = master
             if stdin is not None:
                 os.close(stdin_read_fd)
-                fast_data_types.thread_write(stdin_write_fd, stdin)
+                # The write is cancelled if the child is closed before it reads everything
+                if isinstance(stdin, fast_data_types.Screen):
+                    fast_data_types.stream_scrollback(stdin_write_fd, stdin, pid)
+                else:
+                    fast_data_types.thread_write(stdin_write_fd, stdin, pid)
             return pid
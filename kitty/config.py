@@ -223,6 +223,7 @@ def adjust_line_height(x):
 type_map = {
     'adjust_line_height': adjust_line_height,
     'scrollback_lines': positive_int,
+    'scrollback_in_memory_lines': positive_int,
     'scrollback_pager': shlex.split,
     'scrollback_in_new_tab': to_bool,
     'font_size': to_font_size,
@@ -232,6 +233,9 @@ type_map = {
     'open_url_modifiers': to_open_url_modifiers,
     'repaint_delay': positive_int,
     'input_delay': positive_int,
+    'background_input_delay': positive_int,
+    'resize_debounce_time': positive_int,
+    'io_threads': positive_int,
     'window_border_width': positive_float,
     'window_margin_width': positive_float,
     'window_padding_width': positive_float,
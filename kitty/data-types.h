@@ -38,7 +38,6 @@ typedef enum MouseTrackingModes { NO_TRACKING, BUTTON_MODE, MOTION_MODE, ANY_MOD
 typedef enum MouseTrackingProtocols { NORMAL_PROTOCOL, UTF8_PROTOCOL, SGR_PROTOCOL, URXVT_PROTOCOL} MouseTrackingProtocol;
 typedef enum MouseShapes { BEAM, HAND, ARROW } MouseShape;
 
-#define MAX_CHILDREN 256
 #define BLANK_CHAR 0
 #define ATTRS_MASK_WITHOUT_WIDTH 0xFFC
 #define WIDTH_MASK  3
@@ -52,6 +51,10 @@ typedef enum MouseShapes { BEAM, HAND, ARROW } MouseShape;
 #define COL_MASK 0xFFFFFFFF
 #define CC_MASK 0xFFFF
 #define CC_SHIFT 16
+// Marks a cc that refers to an interned cluster, the index is in the upper bits
+#define CC_CLUSTER_MARKER CC_MASK
+#define MAX_NUM_CLUSTERS (CC_MASK + 1)
+#define MAX_NUM_COMBINING_CHARS 8
 #define UTF8_ACCEPT 0
 #define UTF8_REJECT 1
 #define UNDERCURL_CODE 6
@@ -59,6 +62,10 @@ typedef enum MouseShapes { BEAM, HAND, ARROW } MouseShape;
 #define CHAR_IS_BLANK(ch) ((ch) == 32 || (ch) == 0)
 #define CONTINUED_MASK 1
 #define TEXT_DIRTY_MASK 2
+// Shell integration marks (OSC 133) of the lines where a prompt and the output of a command start
+#define PROMPT_START_MASK 4
+#define OUTPUT_START_MASK 8
+#define LINE_MARKS_MASK (PROMPT_START_MASK | OUTPUT_START_MASK)
 
 #define FG 1
 #define BG 2
@@ -152,13 +159,67 @@ typedef struct {
 
 
 typedef struct {
+    // The position and number of the cells of a line in its segment
+    index_type offset, length;
+} LineExtent;
+
+typedef struct {
+    // An append-only arena of the cells of the lines, trimmed to their
+    // content. cells is NULL while the segment is only held compressed
+    Cell *cells;
+    index_type num_cells, capacity;
+    LineExtent *extents;
+    line_attrs_type *line_attrs;
+    // A bloom filter of the trigrams in the text of the lines, see history.c
+    uint64_t *trigrams;
+    // The indices of the long grapheme clusters used by the cells
+    uint16_t *clusters;
+    index_type num_clusters, clusters_capacity;
+    uint8_t *compressed;
+    uint32_t compressed_size, encoded_size, last_used;
+    struct CompressionJob *job;
+    // The location of the extents and the compressed cells in the spill
+    // file, when the segment has been spilled to disk
+    bool spilled;
+    uint64_t spill_offset;
+    uint32_t spill_size;
+} HistoryBufSegment;
+
+typedef struct {
+    // A line with shell integration marks, see history.c
+    int64_t id;
+    line_attrs_type marks;
+} LineMark;
+
+typedef struct HistoryBuf {
     PyObject_HEAD
 
-    Cell *buf;
-    index_type xnum, ynum;
+    index_type xnum, ynum, num_segments;
+    // The lines, in blocks that are allocated as lines are added
+    HistoryBufSegment *segments, spare_segment;
     Line *line;
+    // The newest line is written in full in staging until the next line is
+    // added, lines shorter than xnum are expanded into expanded
+    Cell *staging, *expanded;
+    index_type staged, expanded_pos;
+    bool has_staged;
     index_type start_of_data, count;
-    line_attrs_type *line_attrs;
+    // The buffer this one was rewrapped from and the number of its oldest
+    // lines that have not yet been rewrapped into this one
+    struct HistoryBuf *pending;
+    index_type pending_count;
+    // The total number of lines ever added to this buffer from the screen
+    uint64_t num_added;
+    // Bookkeeping for the compression of cold segments
+    index_type num_jobs;
+    // If non-zero, compressed segments older than this many lines are spilled to disk
+    index_type in_memory_lines;
+    // The lines with marks, oldest first, as marks[marks_start:marks_start + num_marks]
+    LineMark *marks;
+    size_t marks_start, num_marks, marks_capacity;
+    // The id of the line at buffer position y is id_base + y
+    int64_t id_base;
+    uint32_t access_count;
 } HistoryBuf;
 
 typedef struct {
@@ -203,6 +264,7 @@ typedef struct {
 
 
 #define PARSER_BUF_SZ (8 * 1024)
+// The size of the ring the input from a child is read into, must be a power of two
 #define READ_BUF_SZ (1024*1024)
 
 typedef struct {
@@ -215,9 +277,7 @@ typedef struct {
     PyObject_HEAD
 
     PyObject *dump_callback, *update_screen, *death_notify;
-    unsigned int count;
     bool shutting_down;
-    pthread_t io_thread;
 } ChildMonitor;
 
 #define clear_sprite_position(cell) (cell).sprite_x = 0; (cell).sprite_y = 0; (cell).sprite_z = 0; 
@@ -259,9 +319,31 @@ Cursor* cursor_copy(Cursor*);
 void cursor_copy_to(Cursor *src, Cursor *dest);
 void cursor_reset_display_attrs(Cursor*);
 
+unsigned int cluster_combining_chars(uint32_t idx, char_type *buf);
+combining_type append_combining_char(combining_type cc, char_type ch);
+// Objects that hold cells must be registered as holders of the clusters their
+// cells use for as long as they hold them, see graphemes.c
+typedef void (*cluster_marker_func)(void *holder);
+void add_cluster_holder(void *holder, cluster_marker_func mark);
+void remove_cluster_holder(void *holder);
+void mark_clusters(const Cell *cells, size_t num);
+void mark_cluster_indices(const uint16_t *indices, size_t num);
+PyObject* cluster_table_stats(PyObject *self);
+
+static inline unsigned int
+cell_combining_chars(combining_type cc, char_type *buf) {
+    // Fill buf, which must have space for MAX_NUM_COMBINING_CHARS, with the combining chars in cc
+    if (LIKELY(!cc)) return 0;
+    if ((cc & CC_MASK) == CC_CLUSTER_MARKER) return cluster_combining_chars(cc >> CC_SHIFT, buf);
+    buf[0] = cc & CC_MASK;
+    if (!(cc >> CC_SHIFT)) return 1;
+    buf[1] = cc >> CC_SHIFT;
+    return 2;
+}
+
 double monotonic();
 PyObject* cm_thread_write(PyObject *self, PyObject *args);
-bool schedule_write_to_child(unsigned long id, const char *data, size_t sz);
+PyObject* cm_stream_scrollback(PyObject *self, PyObject *args);
 bool set_iutf8(int, bool);
 
 color_type colorprofile_to_color(ColorProfile *self, color_type entry, color_type defval);
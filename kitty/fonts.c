@@ -301,9 +301,11 @@ static inline bool
 has_cell_text(Font *self, Cell *cell) {
     if (!face_has_codepoint(self->face, cell->ch)) return false;
     if (cell->cc) {
-        if (!face_has_codepoint(self->face, cell->cc & CC_MASK)) return false;
-        char_type cc = cell->cc >> 16;
-        if (cc && !face_has_codepoint(self->face, cc)) return false;
+        char_type cc[MAX_NUM_COMBINING_CHARS];
+        unsigned int num = cell_combining_chars(cell->cc, cc);
+        for (unsigned int i = 0; i < num; i++) {
+            if (!face_has_codepoint(self->face, cc[i])) return false;
+        }
     }
     return true;
 }
@@ -432,15 +434,11 @@ load_hb_buffer(Cell *first_cell, index_type num_cells) {
     hb_buffer_clear_contents(harfbuzz_buffer);
     while (num_cells) {
         attrs_type prev_width = 0;
-        for (num = 0; num_cells && num < sizeof(shape_buffer)/sizeof(shape_buffer[0]) - 20; first_cell++, num_cells--) {
+        for (num = 0; num_cells && num < sizeof(shape_buffer)/sizeof(shape_buffer[0]) - (MAX_NUM_COMBINING_CHARS + 1); first_cell++, num_cells--) {
             if (prev_width == 2) { prev_width = 0; continue; }
             shape_buffer[num++] = first_cell->ch;
             prev_width = first_cell->attrs & WIDTH_MASK;
-            if (first_cell->cc) {
-                shape_buffer[num++] = first_cell->cc & CC_MASK;
-                combining_type cc2 = first_cell->cc >> 16;
-                if (cc2) shape_buffer[num++] = cc2 & CC_MASK;
-            }
+            if (first_cell->cc) num += cell_combining_chars(first_cell->cc, shape_buffer + num);
         }
         hb_buffer_add_utf32(harfbuzz_buffer, shape_buffer, num, 0, num);
     }
@@ -514,7 +512,10 @@ is_special_glyph(glyph_index glyph_id, Font *font, CellData* cell_data) {
 static inline unsigned int
 num_codepoints_in_cell(Cell *cell) {
     unsigned int ans = 1;
-    if (cell->cc) ans += ((cell->cc >> CC_SHIFT) & CC_MASK) ? 2 : 1;
+    if (cell->cc) {
+        char_type cc[MAX_NUM_COMBINING_CHARS];
+        ans += cell_combining_chars(cell->cc, cc);
+    }
     return ans;
 }
 
@@ -531,19 +532,11 @@ check_cell_consumed(CellData *cell_data, Cell *last_cell) {
         } else cell_data->current_codepoint = 0;
         return width;
     } else {
-        switch(cell_data->codepoints_consumed) {
-            case 0:
-                cell_data->current_codepoint = cell_data->cell->ch;
-                break;
-            case 1:
-                cell_data->current_codepoint = cell_data->cell->cc & CC_MASK;
-                break;
-            case 2:
-                cell_data->current_codepoint = (cell_data->cell->cc >> CC_SHIFT) & CC_MASK;
-                break;
-            default:
-                cell_data->current_codepoint = 0;
-                break;
+        if (cell_data->codepoints_consumed == 0) cell_data->current_codepoint = cell_data->cell->ch;
+        else {
+            char_type cc[MAX_NUM_COMBINING_CHARS];
+            unsigned int num = cell_combining_chars(cell_data->cell->cc, cc);
+            cell_data->current_codepoint = cell_data->codepoints_consumed <= num ? cc[cell_data->codepoints_consumed - 1] : 0;
         }
     }
     return 0;
@@ -695,6 +688,8 @@ render_run(Cell *first_cell, index_type num_cells, ssize_t font_idx) {
 
 void
 render_line(Line *line) {
+    // No fonts are loaded when running headless without them, the cells are then left without sprites
+    if (!fonts.fonts_count) return;
 #define RENDER if (run_font_idx != NO_FONT && i > first_cell_in_run) render_run(line->cells + first_cell_in_run, i - first_cell_in_run, run_font_idx);
     ssize_t run_font_idx = NO_FONT;
     index_type first_cell_in_run, i;
@@ -874,8 +869,7 @@ get_fallback_font(PyObject UNUSED *self, PyObject *args) {
     if (!PyUnicode_AsUCS4(text, char_buf, sizeof(char_buf)/sizeof(char_buf[0]), 1)) return NULL;
     Cell cell = {0};
     cell.ch = char_buf[0];
-    if (PyUnicode_GetLength(text) > 1) cell.cc |= char_buf[1] & CC_MASK;
-    if (PyUnicode_GetLength(text) > 2) cell.cc |= (char_buf[2] & CC_MASK) << 16;
+    for (Py_ssize_t i = 1; i < MIN(PyUnicode_GetLength(text), (Py_ssize_t)(sizeof(char_buf)/sizeof(char_buf[0]))); i++) cell.cc = append_combining_char(cell.cc, char_buf[i]);
     if (bold) cell.attrs |= 1 << BOLD_SHIFT;
     if (italic) cell.attrs |= 1 << ITALIC_SHIFT;
     ssize_t ans = fallback_font(&cell);
@@ -65,9 +65,13 @@ gl_init(PyObject UNUSED *self, PyObject *args) {
     Py_RETURN_NONE;
 }
 
+static GLint viewport_y = 0;
+
 void
-update_viewport_size(int w, int h) {
-    glViewport(0, 0, w, h); 
+update_viewport_size(int w, int h, int framebuffer_height) {
+    // The viewport is anchored at the top left corner of the framebuffer
+    viewport_y = framebuffer_height - h;
+    glViewport(0, viewport_y, w, h); 
 }
 
 void
@@ -188,46 +192,43 @@ typedef struct {
 } Buffer;
 
 
-static Buffer buffers[MAX_CHILDREN * 6 + 4] = {{0}};
+// Buffers and VAOs are referred to by their index, which stays valid when the arrays grow
+static struct { Buffer *items; size_t capacity; } buffers = {0};
 
 static ssize_t
 create_buffer(GLenum usage) {
     GLuint buffer_id;
     glGenBuffers(1, &buffer_id);
-    for (size_t i = 0; i < sizeof(buffers)/sizeof(buffers[0]); i++) {
-        if (buffers[i].id == 0) {
-            buffers[i].id = buffer_id;
-            buffers[i].size = 0;
-            buffers[i].usage = usage;
-            return i;
-        }
-    }
-    glDeleteBuffers(1, &buffer_id);
-    fatal("too many buffers");
-    return -1;
+    size_t i = 0;
+    while (i < buffers.capacity && buffers.items[i].id) i++;
+    ensure_space_for(&buffers, items, Buffer, i + 1, capacity, 64, true);
+    buffers.items[i].id = buffer_id;
+    buffers.items[i].size = 0;
+    buffers.items[i].usage = usage;
+    return i;
 }
 
 static void
 delete_buffer(ssize_t buf_idx) {
-    glDeleteBuffers(1, &(buffers[buf_idx].id));
-    buffers[buf_idx].id = 0;
-    buffers[buf_idx].size = 0;
+    glDeleteBuffers(1, &(buffers.items[buf_idx].id));
+    buffers.items[buf_idx].id = 0;
+    buffers.items[buf_idx].size = 0;
 }
 
 static GLuint
 bind_buffer(ssize_t buf_idx) {
-    glBindBuffer(buffers[buf_idx].usage, buffers[buf_idx].id);
-    return buffers[buf_idx].id;
+    glBindBuffer(buffers.items[buf_idx].usage, buffers.items[buf_idx].id);
+    return buffers.items[buf_idx].id;
 }
 
 static void
 unbind_buffer(ssize_t buf_idx) {
-    glBindBuffer(buffers[buf_idx].usage, 0);
+    glBindBuffer(buffers.items[buf_idx].usage, 0);
 }
 
 static inline void
 alloc_buffer(ssize_t idx, GLsizeiptr size, GLenum usage) {
-    Buffer *b = buffers + idx;
+    Buffer *b = buffers.items + idx;
     if (b->size == size) return;
     b->size = size;
     glBufferData(b->usage, size, NULL, usage);
@@ -235,13 +236,13 @@ alloc_buffer(ssize_t idx, GLsizeiptr size, GLenum usage) {
 
 static inline void*
 map_buffer(ssize_t idx, GLenum access) {
-    void *ans = glMapBuffer(buffers[idx].usage, access);
+    void *ans = glMapBuffer(buffers.items[idx].usage, access);
     return ans;
 }
 
 static inline void
 unmap_buffer(ssize_t idx) {
-    glUnmapBuffer(buffers[idx].usage);
+    glUnmapBuffer(buffers.items[idx].usage);
 }
 
 // }}}
@@ -254,28 +255,24 @@ typedef struct {
     ssize_t buffers[10];
 } VAO;
 
-static VAO vaos[2*MAX_CHILDREN + 10] = {{0}};
+static struct { VAO *items; size_t capacity; } vaos = {0};
 
 static ssize_t
 create_vao() {
     GLuint vao_id;
     glGenVertexArrays(1, &vao_id);
-    for (size_t i = 0; i < sizeof(vaos)/sizeof(vaos[0]); i++) {
-        if (!vaos[i].id) {
-            vaos[i].id = vao_id;
-            vaos[i].num_buffers = 0;
-            glBindVertexArray(vao_id);
-            return i;
-        }
-    }
-    glDeleteVertexArrays(1, &vao_id);
-    fatal("too many VAOs");
-    return -1;
+    size_t i = 0;
+    while (i < vaos.capacity && vaos.items[i].id) i++;
+    ensure_space_for(&vaos, items, VAO, i + 1, capacity, 16, true);
+    vaos.items[i].id = vao_id;
+    vaos.items[i].num_buffers = 0;
+    glBindVertexArray(vao_id);
+    return i;
 }
 
 static size_t
 add_buffer_to_vao(ssize_t vao_idx, GLenum usage) {
-    VAO* vao = vaos + vao_idx;
+    VAO* vao = vaos.items + vao_idx;
     if (vao->num_buffers >= sizeof(vao->buffers) / sizeof(vao->buffers[0])) {
         fatal("too many buffers in a single VAO");
     }
@@ -286,7 +283,7 @@ add_buffer_to_vao(ssize_t vao_idx, GLenum usage) {
 
 static void
 add_located_attribute_to_vao(ssize_t vao_idx, GLint aloc, GLint size, GLenum data_type, GLsizei stride, void *offset, GLuint divisor) {
-    VAO *vao = vaos + vao_idx;
+    VAO *vao = vaos.items + vao_idx;
     if (!vao->num_buffers) fatal("You must create a buffer for this attribute first"); 
     ssize_t buf = vao->buffers[vao->num_buffers - 1];
     bind_buffer(buf);
@@ -320,18 +317,18 @@ add_attribute_to_vao(int p, ssize_t vao_idx, const char *name, GLint size, GLenu
 
 static void
 remove_vao(ssize_t vao_idx) {
-    VAO *vao = vaos + vao_idx;
+    VAO *vao = vaos.items + vao_idx;
     while (vao->num_buffers) {
         vao->num_buffers--;
         delete_buffer(vao->buffers[vao->num_buffers]);
     }
     glDeleteVertexArrays(1, &(vao->id));
-    vaos[vao_idx].id = 0;
+    vaos.items[vao_idx].id = 0;
 }
 
 static void
 bind_vertex_array(ssize_t vao_idx) {
-    glBindVertexArray(vaos[vao_idx].id);
+    glBindVertexArray(vaos.items[vao_idx].id);
 }
 
 static void
@@ -341,7 +338,7 @@ unbind_vertex_array() {
 
 static ssize_t
 alloc_vao_buffer(ssize_t vao_idx, GLsizeiptr size, size_t bufnum, GLenum usage) {
-    ssize_t buf_idx = vaos[vao_idx].buffers[bufnum];
+    ssize_t buf_idx = vaos.items[vao_idx].buffers[bufnum];
     bind_buffer(buf_idx);
     alloc_buffer(buf_idx, size, usage);
     return buf_idx;
@@ -349,7 +346,7 @@ alloc_vao_buffer(ssize_t vao_idx, GLsizeiptr size, size_t bufnum, GLenum usage)
 
 static void*
 map_vao_buffer(ssize_t vao_idx, size_t bufnum, GLenum access) {
-    ssize_t buf_idx = vaos[vao_idx].buffers[bufnum];
+    ssize_t buf_idx = vaos.items[vao_idx].buffers[bufnum];
     bind_buffer(buf_idx);
     return map_buffer(buf_idx, access);
 }
@@ -362,13 +359,13 @@ alloc_and_map_vao_buffer(ssize_t vao_idx, GLsizeiptr size, size_t bufnum, GLenum
 
 static void
 bind_vao_uniform_buffer(ssize_t vao_idx, size_t bufnum, GLuint block_index) {
-    ssize_t buf_idx = vaos[vao_idx].buffers[bufnum];
-    glBindBufferBase(GL_UNIFORM_BUFFER, block_index, buffers[buf_idx].id);
+    ssize_t buf_idx = vaos.items[vao_idx].buffers[bufnum];
+    glBindBufferBase(GL_UNIFORM_BUFFER, block_index, buffers.items[buf_idx].id);
 }
 
 static void
 unmap_vao_buffer(ssize_t vao_idx, size_t bufnum) {
-    ssize_t buf_idx = vaos[vao_idx].buffers[bufnum];
+    ssize_t buf_idx = vaos.items[vao_idx].buffers[bufnum];
     unmap_buffer(buf_idx);
     unbind_buffer(buf_idx);
 }
@@ -63,15 +63,30 @@ static void update_viewport(GLFWwindow *window) {
 static WindowWrapper* the_window = NULL;
 
 static void 
-framebuffer_size_callback(GLFWwindow *w, int width, int height) {
+framebuffer_size_callback(GLFWwindow UNUSED *w, int width, int height) {
     if (width > 100 && height > 100) {
-        update_viewport_size(width, height);
-        update_viewport(w);
-        WINDOW_CALLBACK(framebuffer_size_callback, "ii", width, height);
+        // Keep drawing the current layout, clipped or padded, until the size
+        // has been stable for resize_debounce_time, see apply_pending_resize()
+        update_viewport_size(global_state.viewport_width, global_state.viewport_height, height);
+        global_state.has_pending_resizes = true;
+        global_state.last_resize_event_at = monotonic();
         glfwPostEmptyEvent();
     } else fprintf(stderr, "Ignoring resize request for tiny size: %dx%d\n", width, height);
 }
 
+void
+apply_pending_resize() {
+    int width, height;
+    global_state.has_pending_resizes = false;
+    if (the_window == NULL) return;
+    glfwGetFramebufferSize(the_window->window, &width, &height);
+    if (width > 100 && height > 100) {
+        update_viewport_size(width, height, height);
+        update_viewport(the_window->window);
+        WINDOW_CALLBACK(framebuffer_size_callback, "ii", width, height);
+    }
+}
+
 static void 
 char_mods_callback(GLFWwindow UNUSED *w, unsigned int codepoint, int mods) {
     global_state.cursor_blink_zero_time = monotonic();
@@ -80,7 +95,9 @@ char_mods_callback(GLFWwindow UNUSED *w, unsigned int codepoint, int mods) {
 
 static void 
 key_callback(GLFWwindow UNUSED *w, int key, int scancode, int action, int mods) {
-    global_state.cursor_blink_zero_time = monotonic();
+    double now = monotonic();
+    global_state.cursor_blink_zero_time = now;
+    global_state.last_key_input_at = now;
     if (key >= 0 && key <= GLFW_KEY_LAST) {
         global_state.is_key_pressed[key] = action == GLFW_RELEASE ? false : true;
         on_key_input(key, scancode, action, mods);
@@ -0,0 +1,199 @@
+/*
+ * graphemes.c
+ * Copyright (C) 2017 Kovid Goyal <kovid at kovidgoyal.net>
+ *
+ * Distributed under terms of the GPL3 license.
+ */
+
+#include "data-types.h"
+
+// Interned table of the combining chars of grapheme clusters that do not fit
+// inline in Cell.cc. Entries are de-duplicated, so the table grows only with
+// the number of distinct clusters in use, not with the number of cells that
+// use them. Cells are freely memcpy-ed between the line buffers, the history
+// buffer and during rewrap, so they cannot hold references to the entries.
+// Instead, entries are reclaimed by a mark and sweep collection, run when the
+// table has doubled since the last one or is full: every object that holds
+// cells registers itself as a holder and marks the clusters its cells use,
+// see add_cluster_holder(). A collection is run once as many new clusters
+// have been interned as were in use after the last one, or as soon as the
+// table is full, unless the last collection of the full table freed less
+// than a quarter of it, so that its cost is amortized even when the table is
+// full of clusters that are all in use. The table is only used from the main thread, by
+// the parser, shaping and export, so it is not locked.
+
+typedef struct {
+    uint8_t num;
+    char_type chars[MAX_NUM_COMBINING_CHARS];
+} Cluster;
+
+static Cluster *clusters = NULL;
+static uint32_t num_clusters = 0, clusters_capacity = 0;
+// Open addressing hash of cluster index + 1, zero means an empty slot
+static uint32_t *lookup = NULL;
+static uint32_t lookup_size = 0;
+// Indices of reclaimed entries, which have num == 0, for re-use
+static struct { uint32_t *items; size_t capacity, count; } free_clusters = {0};
+// The number of entries in use after the last collection and the number of
+// new clusters interned since then
+static uint32_t live_clusters = 0, interned_since_collect = 0;
+static bool full_collect_failed = false;
+#define MIN_COLLECT_AT 4096u
+
+typedef struct {
+    void *holder;
+    cluster_marker_func mark;
+} ClusterHolder;
+static struct { ClusterHolder *items; size_t capacity, count; } holders = {0};
+static uint8_t *marks = NULL;
+
+static inline uint32_t
+hash_chars(const char_type *chars, unsigned int num) {
+    uint32_t h = 2166136261u;
+    for (unsigned int i = 0; i < num; i++) { h ^= chars[i]; h *= 16777619u; }
+    return h;
+}
+
+static inline bool
+cluster_eq(const Cluster *c, const char_type *chars, unsigned int num) {
+    return c->num == num && memcmp(c->chars, chars, sizeof(char_type) * num) == 0;
+}
+
+static inline void
+add_to_lookup(uint32_t *table, uint32_t sz, uint32_t idx) {
+    uint32_t slot = hash_chars(clusters[idx].chars, clusters[idx].num) & (sz - 1);
+    while (table[slot]) slot = (slot + 1) & (sz - 1);
+    table[slot] = idx + 1;
+}
+
+static inline bool
+ensure_space() {
+    if (num_clusters >= clusters_capacity) {
+        uint32_t cap = MAX(64u, clusters_capacity * 2);
+        Cluster *n = realloc(clusters, sizeof(Cluster) * cap);
+        if (n == NULL) return false;
+        clusters = n; clusters_capacity = cap;
+    }
+    if ((num_clusters + 1) * 2 > lookup_size) {
+        uint32_t sz = MAX(128u, lookup_size * 2);
+        uint32_t *n = calloc(sz, sizeof(uint32_t));
+        if (n == NULL) return false;
+        for (uint32_t i = 0; i < num_clusters; i++) {
+            if (clusters[i].num) add_to_lookup(n, sz, i);
+        }
+        free(lookup); lookup = n; lookup_size = sz;
+    }
+    return true;
+}
+
+// Collection {{{
+
+void
+add_cluster_holder(void *holder, cluster_marker_func mark) {
+    ensure_space_for(&holders, items, ClusterHolder, holders.count + 1, capacity, 16, false);
+    holders.items[holders.count++] = (ClusterHolder){.holder=holder, .mark=mark};
+}
+
+void
+remove_cluster_holder(void *holder) {
+    for (size_t i = 0; i < holders.count; i++) {
+        if (holders.items[i].holder == holder) {
+            holders.items[i] = holders.items[--holders.count];
+            return;
+        }
+    }
+}
+
+void
+mark_clusters(const Cell *cells, size_t num) {
+    for (size_t i = 0; i < num; i++) {
+        if ((cells[i].cc & CC_MASK) == CC_CLUSTER_MARKER && (cells[i].cc >> CC_SHIFT) < num_clusters) marks[cells[i].cc >> CC_SHIFT] = 1;
+    }
+}
+
+void
+mark_cluster_indices(const uint16_t *indices, size_t num) {
+    for (size_t i = 0; i < num; i++) {
+        if (indices[i] < num_clusters) marks[indices[i]] = 1;
+    }
+}
+
+static void
+collect_clusters(void) {
+    // Free the entries that are not used by the cells of any holder
+    marks = calloc(num_clusters, sizeof(uint8_t));
+    if (marks == NULL) return;
+    for (size_t i = 0; i < holders.count; i++) holders.items[i].mark(holders.items[i].holder);
+    free_clusters.count = 0;
+    live_clusters = 0; interned_since_collect = 0;
+    memset(lookup, 0, lookup_size * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_clusters; i++) {
+        if (marks[i] && clusters[i].num) {
+            add_to_lookup(lookup, lookup_size, i);
+            live_clusters++;
+        } else {
+            clusters[i].num = 0;
+            ensure_space_for(&free_clusters, items, uint32_t, free_clusters.count + 1, capacity, 64, false);
+            free_clusters.items[free_clusters.count++] = i;
+        }
+    }
+    free(marks); marks = NULL;
+    full_collect_failed = num_clusters >= MAX_NUM_CLUSTERS && free_clusters.count < num_clusters / 4;
+}
+
+static inline bool
+should_collect(void) {
+    if (free_clusters.count) return false;
+    bool due = interned_since_collect >= MAX(MIN_COLLECT_AT, live_clusters);
+    if (num_clusters < MAX_NUM_CLUSTERS) return due;
+    return due || !full_collect_failed;
+}
+// }}}
+
+static inline bool
+intern_cluster(const char_type *chars, unsigned int num, uint32_t *idx) {
+    if (lookup_size) {
+        uint32_t slot = hash_chars(chars, num) & (lookup_size - 1);
+        while (lookup[slot]) {
+            if (cluster_eq(clusters + lookup[slot] - 1, chars, num)) { *idx = lookup[slot] - 1; return true; }
+            slot = (slot + 1) & (lookup_size - 1);
+        }
+    }
+    interned_since_collect++;
+    if (should_collect()) collect_clusters();
+    if (free_clusters.count) *idx = free_clusters.items[--free_clusters.count];
+    else if (num_clusters < MAX_NUM_CLUSTERS && ensure_space()) *idx = num_clusters++;
+    else return false;
+    Cluster *c = clusters + *idx;
+    c->num = num; memcpy(c->chars, chars, sizeof(char_type) * num);
+    add_to_lookup(lookup, lookup_size, *idx);
+    return true;
+}
+
+unsigned int
+cluster_combining_chars(uint32_t idx, char_type *buf) {
+    if (idx >= num_clusters) return 0;
+    memcpy(buf, clusters[idx].chars, sizeof(char_type) * clusters[idx].num);
+    return clusters[idx].num;
+}
+
+combining_type
+append_combining_char(combining_type cc, char_type ch) {
+    // Returns cc with ch appended. If there is no more space, cc is returned
+    // unchanged, i.e. the char is dropped
+    if (LIKELY(!cc) && ch < CC_CLUSTER_MARKER) return ch;
+    if (cc && !(cc >> CC_SHIFT) && (cc & CC_MASK) != CC_CLUSTER_MARKER && ch <= CC_MASK) return cc | (ch << CC_SHIFT);
+    char_type chars[MAX_NUM_COMBINING_CHARS + 1];
+    unsigned int num = cell_combining_chars(cc, chars);
+    if (num >= MAX_NUM_COMBINING_CHARS) return cc;
+    chars[num++] = ch;
+    uint32_t idx;
+    if (!intern_cluster(chars, num, &idx)) return cc;
+    return CC_CLUSTER_MARKER | (idx << CC_SHIFT);
+}
+
+PyObject*
+cluster_table_stats(PyObject UNUSED *self) {
+    // The number of entries in the table, of them the number free for re-use, and the number of holders
+    return Py_BuildValue("{sI sn sn}", "size", num_clusters, "free", (Py_ssize_t)free_clusters.count, "holders", (Py_ssize_t)holders.count);
+}
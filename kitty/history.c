@@ -5,15 +5,768 @@
  * Distributed under terms of the GPL3 license.
  */
 
-#include "data-types.h"
+#ifdef __linux__
+// Need _GNU_SOURCE for fallocate(). It must be defined before the first
+// system header, and is defined the same way as by pyconfig.h, so it is not
+// undefined again.
+#define _GNU_SOURCE 1
+#endif
+#include "state.h"
 #include "lineops.h"
 #include <structmember.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
 
 extern PyTypeObject Line_Type;
 
+// Lines are stored in segments of SEGMENT_SIZE lines, that are allocated as
+// lines are added and freed once all their lines have been evicted, so a large
+// scrollback only costs memory for the lines actually in it. Buffer positions
+// count lines from the start of the first segment, so start_of_data is always
+// less than SEGMENT_SIZE.
+//
+// Within a segment, lines are appended to an arena of cells, with a trailing
+// run of identical blank cells stored as a single cell, see stored_length().
+// Lines are expanded to their full width only when a Line is initialized for
+// them.
+#define SEGMENT_SIZE 256u
+
+// Compression of cold segments {{{
+// All but the newest HOT_SEGMENTS segments are compressed by a background
+// thread. The cells are split into planes of their chars, colors, combining
+// chars and attrs, each plane is run-length encoded with varint values and the
+// result is deflated. Sprite positions are not stored, the lines are marked
+// dirty on decompression so they are recomputed when rendered. Lines in the
+// history are never modified, so the compressed copy is kept when a segment is
+// decompressed and the cells of the least recently used decompressed segments
+// are simply freed.
+
+#define HOT_SEGMENTS 2u
+#define MAX_DECOMPRESSED_SEGMENTS 4u
+#define NUM_PLANES 6
+// The worst case of a varint value and a token header for every cell
+#define MAX_ENCODED_SIZE(num_cells) (NUM_PLANES * 10 * (num_cells))
+#define MIN_RUN 3
+
+typedef enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE } JobState;
+
+typedef struct CompressionJob {
+    const Cell *cells;
+    size_t num_cells;
+    JobState state;
+    uint8_t *result;
+    uint32_t result_size, encoded_size;
+    struct CompressionJob *next;
+} CompressionJob;
+
+static pthread_mutex_t compression_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_available = PTHREAD_COND_INITIALIZER, job_finished = PTHREAD_COND_INITIALIZER;
+static CompressionJob *queue_head = NULL, *queue_tail = NULL;
+static bool worker_started = false;
+
+static inline uint8_t*
+put_varint(uint8_t *p, uint32_t val) {
+    while (val >= 0x80) { *(p++) = (val & 0x7f) | 0x80; val >>= 7; }
+    *(p++) = val;
+    return p;
+}
+
+static inline const uint8_t*
+get_varint(const uint8_t *p, const uint8_t *end, uint32_t *val) {
+    uint32_t ans = 0;
+    for (unsigned int shift = 0; p < end && shift < 32; shift += 7) {
+        uint8_t b = *(p++);
+        ans |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) { *val = ans; return p; }
+    }
+    return NULL;
+}
+
+static size_t
+encode_cells(const Cell *cells, size_t num, uint8_t *buf) {
+    // Each plane is a sequence of tokens: a varint header of (count << 1) | is_run
+    // followed by a single value for runs or count values otherwise
+    uint8_t *p = buf;
+#define flush_literals(field, end) if (lit < end) { \
+    p = put_varint(p, (uint32_t)(end - lit) << 1); \
+    for (; lit < end; lit++) p = put_varint(p, cells[lit].field); \
+}
+#define encode_plane(field) { \
+    size_t i = 0, lit = 0; \
+    while (i < num) { \
+        uint32_t v = cells[i].field; size_t run = 1; \
+        while (i + run < num && cells[i + run].field == v) run++; \
+        if (run >= MIN_RUN) { \
+            flush_literals(field, i); \
+            p = put_varint(p, ((uint32_t)run << 1) | 1); p = put_varint(p, v); \
+            lit = i + run; \
+        } \
+        i += run; \
+    } \
+    flush_literals(field, num); \
+}
+    encode_plane(ch); encode_plane(fg); encode_plane(bg); encode_plane(decoration_fg); encode_plane(cc); encode_plane(attrs);
+#undef encode_plane
+#undef flush_literals
+    return p - buf;
+}
+
+static bool
+decode_cells(Cell *cells, size_t num, const uint8_t *p, const uint8_t *end) {
+    uint32_t h, v;
+#define decode_plane(field) for (size_t i = 0; i < num;) { \
+    if ((p = get_varint(p, end, &h)) == NULL) return false; \
+    size_t n = h >> 1; \
+    if (!n || n > num - i) return false; \
+    if (h & 1) { \
+        if ((p = get_varint(p, end, &v)) == NULL) return false; \
+        for (size_t limit = i + n; i < limit; i++) cells[i].field = v; \
+    } else { \
+        for (size_t limit = i + n; i < limit; i++) { \
+            if ((p = get_varint(p, end, &v)) == NULL) return false; \
+            cells[i].field = v; \
+        } \
+    } \
+}
+    decode_plane(ch); decode_plane(fg); decode_plane(bg); decode_plane(decoration_fg); decode_plane(cc); decode_plane(attrs);
+#undef decode_plane
+    return p == end;
+}
+
+static void
+compress_job(CompressionJob *job, uint8_t **buf, size_t *bufsz) {
+    size_t needed = MAX_ENCODED_SIZE(job->num_cells);
+    if (needed > *bufsz) {
+        free(*buf); *buf = malloc(needed);
+        *bufsz = *buf ? needed : 0;
+        if (*buf == NULL) return;
+    }
+    size_t encoded = encode_cells(job->cells, job->num_cells, *buf);
+    uLongf sz = compressBound(encoded);
+    uint8_t *out = malloc(sz);
+    if (out == NULL) return;
+    if (compress2(out, &sz, *buf, encoded, Z_BEST_SPEED) != Z_OK || sz >= encoded) {
+        // Incompressible, store the encoded planes as is
+        memcpy(out, *buf, encoded); sz = encoded;
+    }
+    uint8_t *shrunk = realloc(out, sz);
+    job->result = shrunk ? shrunk : out;
+    job->result_size = sz; job->encoded_size = encoded;
+}
+
+static void*
+compression_worker(void UNUSED *data) {
+    uint8_t *buf = NULL;
+    size_t bufsz = 0;
+    pthread_mutex_lock(&compression_lock);
+    while (true) {
+        while (queue_head == NULL) pthread_cond_wait(&work_available, &compression_lock);
+        CompressionJob *job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL) queue_tail = NULL;
+        job->state = JOB_RUNNING;
+        pthread_mutex_unlock(&compression_lock);
+        // The cells of a queued segment are not modified until its job is
+        // cancelled, which waits for a running job to finish
+        compress_job(job, &buf, &bufsz);
+        pthread_mutex_lock(&compression_lock);
+        job->state = JOB_DONE;
+        pthread_cond_broadcast(&job_finished);
+    }
+    return NULL;
+}
+
+static void
+queue_compression(HistoryBuf *self, HistoryBufSegment *s) {
+    CompressionJob *job = calloc(1, sizeof(CompressionJob));
+    if (job == NULL) return;
+    job->cells = s->cells; job->num_cells = s->num_cells;
+    pthread_mutex_lock(&compression_lock);
+    if (!worker_started) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, compression_worker, NULL) != 0) {
+            pthread_mutex_unlock(&compression_lock);
+            free(job);
+            return;
+        }
+        pthread_detach(worker);
+        worker_started = true;
+    }
+    if (queue_tail) queue_tail->next = job;
+    else queue_head = job;
+    queue_tail = job;
+    pthread_cond_signal(&work_available);
+    pthread_mutex_unlock(&compression_lock);
+    s->job = job; self->num_jobs++;
+}
+
+static void
+cancel_compression(HistoryBuf *self, HistoryBufSegment *s) {
+    CompressionJob *job = s->job;
+    pthread_mutex_lock(&compression_lock);
+    if (job->state == JOB_QUEUED) {
+        for (CompressionJob *q = queue_head, *prev = NULL; q; prev = q, q = q->next) {
+            if (q != job) continue;
+            if (prev) prev->next = q->next;
+            else queue_head = q->next;
+            if (queue_tail == q) queue_tail = prev;
+            break;
+        }
+    } else while (job->state == JOB_RUNNING) pthread_cond_wait(&job_finished, &compression_lock);
+    pthread_mutex_unlock(&compression_lock);
+    free(job->result); free(job);
+    s->job = NULL; self->num_jobs--;
+}
+
+// Spilling to disk {{{
+// When in_memory_lines is set, compressed segments older than that many lines
+// are written, together with the extents of their lines, to a temporary file
+// that is deleted as soon as it is created and are mapped back in when
+// accessed. Blocks are only ever appended to the file, the space of released
+// blocks is freed by punching holes, where supported, and by truncating the
+// file once no block is in use.
+
+#define EXTENTS_SIZE (SEGMENT_SIZE * sizeof(LineExtent))
+
+static int spill_fd = -1;
+static uint64_t spill_end = 0, spill_in_use = 0;
+
+static bool
+open_spill_file() {
+    const char *dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/kitty-scrollback-XXXXXX", dir && dir[0] ? dir : "/tmp");
+    spill_fd = mkstemp(path);
+    if (spill_fd < 0) return false;
+    unlink(path);
+    fcntl(spill_fd, F_SETFD, FD_CLOEXEC);
+    return true;
+}
+
+static bool
+write_at(const void *data, size_t sz, uint64_t offset) {
+    const uint8_t *p = data;
+    while (sz) {
+        ssize_t n = pwrite(spill_fd, p, sz, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n; sz -= n; offset += n;
+    }
+    return true;
+}
+
+static inline void
+release_spill(HistoryBufSegment *s) {
+    if (!s->spilled) return;
+    s->spilled = false;
+    spill_in_use -= s->spill_size;
+    if (!spill_in_use) { if (ftruncate(spill_fd, 0) == 0) spill_end = 0; }
+#ifdef FALLOC_FL_PUNCH_HOLE
+    else if (fallocate(spill_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, s->spill_offset, s->spill_size) != 0) {}
+#endif
+}
+
+static bool
+spill_segment(HistoryBufSegment *s) {
+    if (spill_fd < 0 && !open_spill_file()) return false;
+    if (!write_at(s->extents, EXTENTS_SIZE, spill_end) || !write_at(s->compressed, s->compressed_size, spill_end + EXTENTS_SIZE)) return false;
+    s->spilled = true;
+    s->spill_offset = spill_end; s->spill_size = EXTENTS_SIZE + s->compressed_size;
+    spill_end += s->spill_size; spill_in_use += s->spill_size;
+    free(s->compressed); s->compressed = NULL;
+    if (s->cells == NULL) { PyMem_Free(s->extents); s->extents = NULL; }
+    return true;
+}
+
+static void
+spill_old_segments(HistoryBuf *self) {
+    if (!self->in_memory_lines) return;
+    index_type keep = self->in_memory_lines / SEGMENT_SIZE + 1;
+    for (index_type i = 0; i + keep < self->num_segments; i++) {
+        HistoryBufSegment *s = self->segments + i;
+        // If the disk is full, keep the segments in memory
+        if (s->compressed && !spill_segment(s)) break;
+    }
+}
+
+static const uint8_t*
+map_spilled(HistoryBufSegment *s, void **map, size_t *map_size) {
+    // Map the block of a spilled segment, loading its extents, and return its compressed cells
+    size_t delta = s->spill_offset % sysconf(_SC_PAGESIZE);
+    *map_size = delta + s->spill_size;
+    *map = mmap(NULL, *map_size, PROT_READ, MAP_SHARED, spill_fd, s->spill_offset - delta);
+    if (*map == MAP_FAILED) fatal("Failed to map the scrollback spill file with error: %s", strerror(errno));
+    const uint8_t *block = (uint8_t*)*map + delta;
+    if (s->extents == NULL) {
+        s->extents = PyMem_Malloc(EXTENTS_SIZE);
+        if (s->extents == NULL) fatal("Out of memory.");
+        memcpy(s->extents, block, EXTENTS_SIZE);
+    }
+    return block + EXTENTS_SIZE;
+}
+
+// }}}
+
+static inline void
+discard_compressed(HistoryBuf *self, HistoryBufSegment *s) {
+    if (s->job) cancel_compression(self, s);
+    free(s->compressed); s->compressed = NULL;
+    release_spill(s);
+}
+
+static inline void
+maybe_compress(HistoryBuf *self, index_type i) {
+    // Queue the segment i for compression if it is cold
+    HistoryBufSegment *s = self->segments + i;
+    if (i + HOT_SEGMENTS < self->num_segments && s->num_cells && s->cells && !s->compressed && !s->spilled && !s->job) queue_compression(self, s);
+}
+
+static void
+trim_decompressed_segments(HistoryBuf *self) {
+    // Free the cells of the least recently used segments that are also held compressed or on disk
+    while (true) {
+        index_type num = 0;
+        HistoryBufSegment *lru = NULL;
+        for (index_type i = 0; i < self->num_segments; i++) {
+            HistoryBufSegment *s = self->segments + i;
+            if (s->cells && (s->compressed || s->spilled)) {
+                num++;
+                if (lru == NULL || s->last_used < lru->last_used) lru = s;
+            }
+        }
+        if (num <= MAX_DECOMPRESSED_SEGMENTS) break;
+        PyMem_Free(lru->cells); lru->cells = NULL;
+        if (lru->spilled) { PyMem_Free(lru->extents); lru->extents = NULL; }
+    }
+}
+
+static void
+collect_compressed_segments(HistoryBuf *self, bool wait) {
+    if (!self->num_jobs) return;
+    pthread_mutex_lock(&compression_lock);
+    for (index_type i = 0; i < self->num_segments; i++) {
+        HistoryBufSegment *s = self->segments + i;
+        if (s->job == NULL) continue;
+        if (wait) { while (s->job->state != JOB_DONE) pthread_cond_wait(&job_finished, &compression_lock); }
+        else if (s->job->state != JOB_DONE) continue;
+        s->compressed = s->job->result;
+        s->compressed_size = s->job->result_size; s->encoded_size = s->job->encoded_size;
+        free(s->job); s->job = NULL; self->num_jobs--;
+    }
+    pthread_mutex_unlock(&compression_lock);
+    spill_old_segments(self);
+    trim_decompressed_segments(self);
+}
+
+static void
+decompress_segment(HistoryBuf *self, HistoryBufSegment *s) {
+    static uint8_t *buf = NULL;
+    static size_t bufsz = 0;
+    void *map = NULL;
+    size_t map_size = 0, num = s->num_cells;
+    const uint8_t *data = s->spilled ? map_spilled(s, &map, &map_size) : s->compressed, *compressed = data;
+    if (s->compressed_size < s->encoded_size) {
+        if (bufsz < s->encoded_size) {
+            free(buf); buf = malloc(s->encoded_size);
+            if (buf == NULL) fatal("Out of memory.");
+            bufsz = s->encoded_size;
+        }
+        uLongf sz = s->encoded_size;
+        if (uncompress(buf, &sz, compressed, s->compressed_size) != Z_OK || sz != s->encoded_size) fatal("Corrupted history segment.");
+        data = buf;
+    }
+    s->cells = PyMem_Calloc(num, sizeof(Cell));
+    if (s->cells == NULL) fatal("Out of memory.");
+    s->capacity = num;
+    if (!decode_cells(s->cells, num, data, data + s->encoded_size)) fatal("Corrupted history segment.");
+    if (map) munmap(map, map_size);
+    for (index_type i = 0; i < SEGMENT_SIZE; i++) s->line_attrs[i] |= TEXT_DIRTY_MASK;
+    trim_decompressed_segments(self);
+}
+
+static inline void
+ensure_cells(HistoryBuf *self, HistoryBufSegment *s) {
+    if (s->compressed || s->spilled) {
+        s->last_used = ++self->access_count;
+        if (UNLIKELY(s->cells == NULL)) decompress_segment(self, s);
+    }
+}
+
+static inline void
+make_writable(HistoryBuf *self, HistoryBufSegment *s) {
+    // Cells of segments that are (being) compressed must not be modified
+    ensure_cells(self, s);
+    if (UNLIKELY(s->compressed || s->spilled || s->job)) discard_compressed(self, s);
+}
+// }}}
+
+static inline line_attrs_type*
+attrptr(HistoryBuf *self, index_type y) {
+    return self->segments[y / SEGMENT_SIZE].line_attrs + (y % SEGMENT_SIZE);
+}
+
+static inline index_type 
+index_of(HistoryBuf *self, index_type lnum) {
+    // The index (buffer position) of the line with line number lnum
+    // This is reverse indexing, i.e. lnum = 0 corresponds to the *last* line in the buffer.
+    if (self->count == 0) return 0;
+    return self->start_of_data + self->count - 1 - MIN(self->count - 1, lnum);
+}
+
+// Line storage {{{
+
+static inline index_type
+stored_length(const Cell *cells, index_type xnum) {
+    // The number of cells stored for a line. A trailing run of identical
+    // blank cells is stored as its first cell, which is repeated to the end
+    // of the line on expansion. Completely empty lines store nothing.
+    static const Cell empty = {0};
+    const Cell *last = cells + xnum - 1;
+    if (last->ch != BLANK_CHAR) return xnum;
+    index_type x = xnum - 1;
+    while (x > 0 && memcmp(cells + x - 1, last, sizeof(Cell)) == 0) x--;
+    if (x == 0 && memcmp(last, &empty, sizeof(Cell)) == 0) return 0;
+    return x + 1;
+}
+
 static inline Cell*
-lineptr(HistoryBuf *linebuf, index_type y) {
-    return linebuf->buf + y * linebuf->xnum;
+stored_line(HistoryBuf *self, index_type y, index_type *length) {
+    if (self->has_staged && y == self->staged) { *length = self->xnum; return self->staging; }
+    HistoryBufSegment *s = self->segments + y / SEGMENT_SIZE;
+    ensure_cells(self, s);
+    LineExtent *e = s->extents + y % SEGMENT_SIZE;
+    *length = e->length;
+    return e->length ? s->cells + e->offset : NULL;
+}
+
+static inline void
+copy_line_cells(HistoryBuf *self, index_type y, index_type x, index_type num, Cell *dest) {
+    // Copy num cells starting at x from the line at y to dest
+    index_type length, i = 0;
+    const Cell *cells = stored_line(self, y, &length);
+    if (x < length) {
+        i = MIN(num, length - x);
+        memcpy(dest, cells + x, i * sizeof(Cell));
+    }
+    if (i < num) {
+        if (length) { for (; i < num; i++) dest[i] = cells[length - 1]; }
+        else memset(dest + i, 0, (num - i) * sizeof(Cell));
+    }
+}
+
+static void
+store_line(HistoryBuf *self, index_type y, const Cell *cells) {
+    HistoryBufSegment *s = self->segments + y / SEGMENT_SIZE;
+    index_type length = stored_length(cells, self->xnum);
+    make_writable(self, s);
+    if (s->num_cells + length > s->capacity) {
+        // Initially assume that all lines in the segment are as long as this one
+        index_type capacity = s->capacity ? s->capacity * 2 : MAX(length, 8u) * SEGMENT_SIZE;
+        capacity = MAX(s->num_cells + length, MIN(capacity, self->xnum * SEGMENT_SIZE));
+        Cell *c = PyMem_Realloc(s->cells, capacity * sizeof(Cell));
+        if (c == NULL) fatal("Out of memory.");
+        s->cells = c; s->capacity = capacity;
+    }
+    memcpy(s->cells + s->num_cells, cells, length * sizeof(Cell));
+    // The clusters stay in use for as long as the segment, even while it is only held compressed
+    for (index_type i = 0; i < length; i++) {
+        if ((cells[i].cc & CC_MASK) != CC_CLUSTER_MARKER) continue;
+        uint16_t idx = cells[i].cc >> CC_SHIFT;
+        if (s->num_clusters && s->clusters[s->num_clusters - 1] == idx) continue;
+        ensure_space_for(s, clusters, uint16_t, s->num_clusters + 1, clusters_capacity, 16, false);
+        s->clusters[s->num_clusters++] = idx;
+    }
+    s->extents[y % SEGMENT_SIZE] = (LineExtent){.offset=s->num_cells, .length=length};
+    s->num_cells += length;
+}
+
+// }}}
+
+// Search index {{{
+// Every segment has a bloom filter of the trigrams in the text of its lines,
+// so that searches can skip the segments, compressed or on disk, that cannot
+// contain a match. The trigrams that span the boundary between a line and the
+// line it continues are included, in the segment of the line indexed last.
+// Chars are case folded, so the same filter serves case insensitive searches.
+// The staged line is indexed only when it is committed.
+
+#define INDEX_WORDS 128u
+#define INDEX_BITS (INDEX_WORDS * 64u)
+
+static inline uint32_t
+trigram_bit(char_type a, char_type b, char_type c) {
+    // The chars must be case folded
+    uint32_t h = (a * 0x9e3779b1u) ^ (b * 0x85ebca77u) ^ (c * 0xc2b2ae3du);
+    return (h ^ (h >> 15) ^ (h >> 26)) & (INDEX_BITS - 1);
+}
+
+static inline const Cell*
+text_cells(HistoryBuf *self, index_type y, index_type *length) {
+    // The cells of the line at y, without the trailing blank cells, which are not part of its text
+    const Cell *cells = stored_line(self, y, length);
+    while (*length && cells[*length - 1].ch == BLANK_CHAR) (*length)--;
+    return cells;
+}
+
+static inline index_type
+line_text(HistoryBuf *self, index_type y, char_type *buf) {
+    index_type length;
+    const Cell *cells = text_cells(self, y, &length);
+    return search_text_for_cells(cells, length, buf, NULL);
+}
+
+#define is_continued(y) (*attrptr(self, y) & CONTINUED_MASK)
+
+static void
+index_line(HistoryBuf *self, index_type y) {
+    static char_type *buf = NULL;
+    static size_t buf_size = 0;
+    size_t line_size = self->xnum * (MAX_NUM_COMBINING_CHARS + 1);
+    if (buf_size < 2 * line_size + 4) {
+        PyMem_Free(buf); buf = PyMem_Malloc((2 * line_size + 4) * sizeof(char_type));
+        if (buf == NULL) fatal("Out of memory.");
+        buf_size = 2 * line_size + 4;
+    }
+    char_type *scratch = buf, *text = buf + line_size;
+    uint64_t *trigrams = self->segments[y / SEGMENT_SIZE].trigrams;
+    bool incomplete = false;
+    // The text of the line, with up to two chars of context from the lines it is joined to
+    index_type start = 2, end = 2 + line_text(self, y, text + 2), n, k;
+    if (y > self->start_of_data && is_continued(y)) {
+        n = line_text(self, y - 1, scratch); k = MIN(2u, n);
+        if (n < 2 && is_continued(y - 1)) incomplete = true;
+        start -= k; memcpy(text + start, scratch + n - k, k * sizeof(char_type));
+    }
+    if (y + 1 < self->start_of_data + self->count && is_continued(y + 1)) {
+        n = line_text(self, y + 1, scratch); k = MIN(2u, n);
+        if (n < 2 && y + 2 < self->start_of_data + self->count && is_continued(y + 2)) incomplete = true;
+        memcpy(text + end, scratch, k * sizeof(char_type)); end += k;
+    }
+    // The context of a line made of less than two chars is in lines further away, rare enough to just give up
+    if (incomplete) { memset(trigrams, 0xff, INDEX_WORDS * sizeof(uint64_t)); return; }
+    for (index_type i = start; i < end; i++) text[i] = search_fold_char(text[i]);
+    for (index_type i = start; i + 2 < end; i++) {
+        uint32_t bit = trigram_bit(text[i], text[i + 1], text[i + 2]);
+        trigrams[bit >> 6] |= 1ull << (bit & 63);
+    }
+}
+
+index_type
+historybuf_trigram_bits(const char_type *chars, index_type num, bool case_sensitive, uint32_t *bits) {
+    // Fill bits, which must have space for num entries, with the filter bits
+    // of the trigrams of chars and return their number. Chars other than
+    // ASCII can have case variants that fold differently, so when ignoring
+    // case the trigrams containing them are left out.
+    index_type ans = 0;
+    for (index_type i = 0; i + 2 < num; i++) {
+        if (!case_sensitive && (chars[i] > 127 || chars[i + 1] > 127 || chars[i + 2] > 127)) continue;
+        bits[ans++] = trigram_bit(search_fold_char(chars[i]), search_fold_char(chars[i + 1]), search_fold_char(chars[i + 2]));
+    }
+    return ans;
+}
+
+bool
+historybuf_is_continued(HistoryBuf *self, index_type lnum) {
+    return is_continued(index_of(self, lnum));
+}
+
+bool
+historybuf_lines_may_contain(HistoryBuf *self, index_type first, index_type last, const uint32_t *bits, index_type num) {
+    // Whether the lines with line numbers from first to last can contain text
+    // with all the trigrams in bits, as returned by historybuf_trigram_bits()
+    index_type seg = index_of(self, first) / SEGMENT_SIZE;
+    if (index_of(self, last) / SEGMENT_SIZE != seg || (self->has_staged && self->staged / SEGMENT_SIZE == seg)) return true;
+    const uint64_t *trigrams = self->segments[seg].trigrams;
+    for (index_type i = 0; i < num; i++) {
+        if (!(trigrams[bits[i] >> 6] & (1ull << (bits[i] & 63)))) return false;
+    }
+    return true;
+}
+
+const Cell*
+historybuf_text_cells(HistoryBuf *self, index_type lnum, index_type *length) {
+    return text_cells(self, index_of(self, lnum), length);
+}
+
+index_type
+historybuf_oldest_in_segment(HistoryBuf *self, index_type lnum) {
+    // The line number of the oldest line in the segment of the line with line number lnum
+    index_type idx = index_of(self, lnum);
+    idx = MAX(idx - idx % SEGMENT_SIZE, self->start_of_data);
+    return self->start_of_data + self->count - 1 - idx;
+}
+
+#undef is_continued
+// }}}
+
+// Shell integration marks {{{
+// The marked lines are kept sorted by line id, appended to as lines are
+// added, prepended to as older lines are rewrapped into the buffer and
+// trimmed from the front as lines are evicted, so that the nearest marked
+// line is found by a binary search. Unlike buffer positions, line ids do not
+// change when segments are released or prepended.
+
+static inline size_t
+first_mark_at(HistoryBuf *self, int64_t id) {
+    // The index of the first mark with a line id not less than id
+    const LineMark *m = self->marks + self->marks_start;
+    size_t lo = 0, hi = self->num_marks;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (m[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void
+add_marks(HistoryBuf *self, index_type y, line_attrs_type marks) {
+    marks &= LINE_MARKS_MASK;
+    if (!marks) return;
+    *attrptr(self, y) |= marks;
+    int64_t id = self->id_base + y;
+    size_t pos = self->num_marks && self->marks[self->marks_start + self->num_marks - 1].id < id ? self->num_marks : first_mark_at(self, id);
+    if (pos < self->num_marks && self->marks[self->marks_start + pos].id == id) { self->marks[self->marks_start + pos].marks |= marks; return; }
+    if ((pos == 0 && !self->marks_start) || self->marks_start + self->num_marks >= self->marks_capacity) {
+        // Re-allocate with room at both ends, since lines are both appended and prepended
+        size_t capacity = MAX(64u, 2 * (self->num_marks + 1)), start = (capacity - self->num_marks) / 2;
+        LineMark *m = PyMem_Malloc(capacity * sizeof(LineMark));
+        if (m == NULL) fatal("Out of memory.");
+        if (self->num_marks) memcpy(m + start, self->marks + self->marks_start, self->num_marks * sizeof(LineMark));
+        PyMem_Free(self->marks);
+        self->marks = m; self->marks_start = start; self->marks_capacity = capacity;
+    }
+    LineMark *m = self->marks + self->marks_start;
+    if (pos == 0) { self->marks_start--; m--; }
+    else memmove(m + pos + 1, m + pos, (self->num_marks - pos) * sizeof(LineMark));
+    m[pos] = (LineMark){.id=id, .marks=marks};
+    self->num_marks++;
+}
+
+static inline void
+drop_evicted_marks(HistoryBuf *self) {
+    int64_t oldest = self->id_base + self->start_of_data;
+    while (self->num_marks && self->marks[self->marks_start].id < oldest) { self->marks_start++; self->num_marks--; }
+}
+
+static bool materialize_mark(HistoryBuf *self, line_attrs_type mask);
+
+bool
+historybuf_find_mark(HistoryBuf *self, int y, bool up, line_attrs_type mask, int *ans) {
+    // Find the nearest line above (or below) y that has a mark in mask. y and
+    // ans count lines from the bottom of this buffer, -1 is the newest line and
+    // non-negative numbers are after the newest line.
+    // Lines not yet rewrapped after a resize are older than all others, so
+    // only a search upwards has to rewrap them, and only up to a marked line.
+    int64_t bottom = self->id_base + self->start_of_data + self->count, id = bottom + y;
+    const LineMark *m;
+    size_t i;
+    if (up) {
+        do {
+            m = self->marks + self->marks_start;
+            i = first_mark_at(self, id);
+            while (i-- > 0) { if (m[i].marks & mask) { *ans = m[i].id - bottom; return true; } }
+        } while (materialize_mark(self, mask));
+        return false;
+    }
+    m = self->marks + self->marks_start;
+    i = first_mark_at(self, id);
+    if (i < self->num_marks && m[i].id == id) i++;
+    for (; i < self->num_marks; i++) { if (m[i].marks & mask) { *ans = m[i].id - bottom; return true; } }
+    return false;
+}
+
+// }}}
+
+static inline void
+commit_staged_line(HistoryBuf *self) {
+    if (!self->has_staged) return;
+    self->has_staged = false;
+    store_line(self, self->staged, self->staging);
+    index_line(self, self->staged);
+}
+
+static inline index_type
+max_segments(index_type ynum) {
+    // The lines can straddle one more segment than they fill
+    return ynum / SEGMENT_SIZE + 2;
+}
+
+static inline void
+free_segment(HistoryBuf *self, HistoryBufSegment *s) {
+    discard_compressed(self, s);
+    PyMem_Free(s->cells); PyMem_Free(s->extents); PyMem_Free(s->line_attrs); PyMem_Free(s->trigrams);
+    free(s->clusters);
+    *s = (HistoryBufSegment){0};
+}
+
+static inline void
+alloc_segment(HistoryBuf *self, HistoryBufSegment *s) {
+    if (self->spare_segment.extents) {
+        // Re-use the last evicted segment, its lines are overwritten when added
+        *s = self->spare_segment;
+        s->num_cells = 0; s->num_clusters = 0;
+        memset(s->trigrams, 0, INDEX_WORDS * sizeof(uint64_t));
+        self->spare_segment = (HistoryBufSegment){0};
+        return;
+    }
+    *s = (HistoryBufSegment){0};
+    s->extents = PyMem_Calloc(SEGMENT_SIZE, sizeof(LineExtent));
+    s->line_attrs = PyMem_Calloc(SEGMENT_SIZE, sizeof(line_attrs_type));
+    s->trigrams = PyMem_Calloc(INDEX_WORDS, sizeof(uint64_t));
+    if (s->extents == NULL || s->line_attrs == NULL || s->trigrams == NULL) fatal("Out of memory.");
+}
+
+static inline void
+release_evicted_segments(HistoryBuf *self) {
+    index_type n = self->start_of_data / SEGMENT_SIZE;
+    if (!n) return;
+    for (index_type i = 0; i < n; i++) {
+        HistoryBufSegment *s = self->segments + i;
+        free_segment(self, &self->spare_segment);
+        discard_compressed(self, s);
+        if (s->cells) self->spare_segment = *s;
+        else free_segment(self, s);
+    }
+    self->num_segments -= n;
+    memmove(self->segments, self->segments + n, self->num_segments * sizeof(HistoryBufSegment));
+    self->start_of_data -= n * SEGMENT_SIZE;
+    self->id_base += n * SEGMENT_SIZE;
+    self->staged -= n * SEGMENT_SIZE;
+    self->expanded_pos = UINT_MAX;
+}
+
+static inline void
+clear_segments(HistoryBuf *self) {
+    for (index_type i = 0; i < self->num_segments; i++) free_segment(self, self->segments + i);
+    free_segment(self, &self->spare_segment);
+    self->num_segments = 0; self->count = 0; self->start_of_data = 0;
+    self->has_staged = false; self->expanded_pos = UINT_MAX;
+    self->num_marks = 0; self->marks_start = 0; self->id_base = 0;
+}
+
+static void
+mark_clusters_in_use(void *holder) {
+    HistoryBuf *self = holder;
+    mark_clusters(self->staging, self->xnum);
+    mark_clusters(self->expanded, self->xnum);
+    for (index_type i = 0; i < self->num_segments; i++) {
+        HistoryBufSegment *s = self->segments + i;
+        if (i == 0 && self->start_of_data && s->cells && s->extents) {
+            // Skip the lines of the oldest segment that have already been
+            // evicted, when that does not need decompressing it
+            index_type end = MIN(SEGMENT_SIZE, self->start_of_data + self->count);
+            for (index_type y = self->start_of_data; y < end; y++) {
+                if (s->extents[y].length) mark_clusters(s->cells + s->extents[y].offset, s->extents[y].length);
+            }
+        } else mark_cluster_indices(s->clusters, s->num_clusters);
+    }
 }
 
 static PyObject *
@@ -32,18 +785,18 @@ new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
     if (self != NULL) {
         self->xnum = xnum;
         self->ynum = ynum;
-        self->buf = PyMem_Calloc(xnum * ynum, sizeof(Cell));
-        self->line_attrs = PyMem_Calloc(ynum, sizeof(line_attrs_type));
+        self->segments = PyMem_Calloc(max_segments(ynum), sizeof(HistoryBufSegment));
+        self->staging = PyMem_Calloc(xnum, sizeof(Cell));
+        self->expanded = PyMem_Calloc(xnum, sizeof(Cell));
         self->line = alloc_line();
-        if (self->buf == NULL || self->line == NULL || self->line_attrs == NULL) {
+        if (self->segments == NULL || self->staging == NULL || self->expanded == NULL || self->line == NULL) {
             PyErr_NoMemory();
-            PyMem_Free(self->buf); Py_CLEAR(self->line); PyMem_Free(self->line_attrs);
+            PyMem_Free(self->segments); PyMem_Free(self->staging); PyMem_Free(self->expanded); Py_CLEAR(self->line);
             Py_CLEAR(self);
         } else {
             self->line->xnum = xnum;
-            for(index_type y = 0; y < self->ynum; y++) {
-                clear_chars_in_line(lineptr(self, y), self->xnum, BLANK_CHAR);
-            }
+            self->expanded_pos = UINT_MAX;
+            add_cluster_holder(self, mark_clusters_in_use);
         }
     }
 
@@ -52,27 +805,27 @@ new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
 
 static void
 dealloc(HistoryBuf* self) {
+    remove_cluster_holder(self);
     Py_CLEAR(self->line);
-    PyMem_Free(self->buf);
-    PyMem_Free(self->line_attrs);
+    Py_CLEAR(self->pending);
+    clear_segments(self);
+    PyMem_Free(self->segments); PyMem_Free(self->staging); PyMem_Free(self->expanded); PyMem_Free(self->marks);
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
-static inline index_type 
-index_of(HistoryBuf *self, index_type lnum) {
-    // The index (buffer position) of the line with line number lnum
-    // This is reverse indexing, i.e. lnum = 0 corresponds to the *last* line in the buffer.
-    if (self->count == 0) return 0;
-    index_type idx = self->count - 1 - MIN(self->count - 1, lnum);
-    return (self->start_of_data + idx) % self->ynum;
-}
-
 static inline void 
 init_line(HistoryBuf *self, index_type num, Line *l) {
     // Initialize the line l, setting its pointer to the offsets for the line at index (buffer position) num
-    l->cells = lineptr(self, num);
-    l->continued = self->line_attrs[num] & CONTINUED_MASK;
-    l->has_dirty_text = self->line_attrs[num] & TEXT_DIRTY_MASK ? true : false;
+    index_type length;
+    Cell *cells = stored_line(self, num, &length);
+    if (length == self->xnum) l->cells = cells;
+    else {
+        copy_line_cells(self, num, 0, self->xnum, self->expanded);
+        l->cells = self->expanded;
+        self->expanded_pos = num;
+    }
+    l->continued = *attrptr(self, num) & CONTINUED_MASK;
+    l->has_dirty_text = *attrptr(self, num) & TEXT_DIRTY_MASK ? true : false;
 }
 
 void 
@@ -82,53 +835,163 @@ historybuf_init_line(HistoryBuf *self, index_type lnum, Line *l) {
 
 void 
 historybuf_mark_line_clean(HistoryBuf *self, index_type y) {
-    self->line_attrs[index_of(self, y)] &= ~TEXT_DIRTY_MASK;
+    index_type num = index_of(self, y), length;
+    *attrptr(self, num) &= ~TEXT_DIRTY_MASK;
+    if (num == self->expanded_pos && self->line->cells == self->expanded) {
+        // Store the sprites of the just rendered expanded line, so that it
+        // does not have to be rendered again
+        Cell *cells = stored_line(self, num, &length);
+        for (index_type x = 0; x < length; x++) {
+            cells[x].sprite_x = self->expanded[x].sprite_x; cells[x].sprite_y = self->expanded[x].sprite_y; cells[x].sprite_z = self->expanded[x].sprite_z;
+        }
+    }
 }
 
 void 
 historybuf_mark_line_dirty(HistoryBuf *self, index_type y) {
-    self->line_attrs[index_of(self, y)] |= TEXT_DIRTY_MASK;
+    *attrptr(self, index_of(self, y)) |= TEXT_DIRTY_MASK;
 }
 
 static inline index_type 
 historybuf_push(HistoryBuf *self) {
-    index_type idx = (self->start_of_data + self->count) % self->ynum;
+    commit_staged_line(self);
+    if (self->count == self->ynum) {
+        self->start_of_data++;
+        drop_evicted_marks(self);
+        release_evicted_segments(self);
+        Py_CLEAR(self->pending);  // the pending lines are older than the line just evicted
+    } else self->count++;
+    index_type idx = self->start_of_data + self->count - 1;
+    if (idx / SEGMENT_SIZE >= self->num_segments) {
+        alloc_segment(self, self->segments + self->num_segments++);
+        collect_compressed_segments(self, false);
+        if (self->num_segments > HOT_SEGMENTS) maybe_compress(self, self->num_segments - 1 - HOT_SEGMENTS);
+    }
+    self->staged = idx; self->has_staged = true;
     init_line(self, idx, self->line);
-    if (self->count == self->ynum) self->start_of_data = (self->start_of_data + 1) % self->ynum;
-    else self->count++;
     return idx;
 }
 
+// Lazy rewrap {{{
+
+static void
+rewrap_pending_line(HistoryBuf *self) {
+    // Rewrap the newest logical line not yet rewrapped from self->pending,
+    // adding it before the oldest line in this buffer
+    static Cell *dest = NULL;
+    static index_type dest_size = 0;
+    HistoryBuf *src = self->pending;
+    if (dest_size < self->xnum) {
+        PyMem_Free(dest); dest = PyMem_Malloc(self->xnum * sizeof(Cell));
+        if (dest == NULL) fatal("Out of memory.");
+        dest_size = self->xnum;
+    }
+#define src_idx(y) (src->start_of_data + (y))
+    index_type end = self->pending_count, start = end - 1;
+    while (start > 0 && (*attrptr(src, src_idx(start)) & CONTINUED_MASK)) start--;
+    index_type len = (end - start) * src->xnum;
+    if (!self->count || !(*attrptr(self, self->start_of_data) & CONTINUED_MASK)) {
+        // Trim trailing blanks since there is a hard line break at the end of this line
+        index_type x;
+        const Cell *last = stored_line(src, src_idx(end - 1), &x);
+        while (x && last[x - 1].ch == BLANK_CHAR) x--;
+        len -= src->xnum - x;
+    }
+    bool first_line_continued = *attrptr(src, src_idx(start)) & CONTINUED_MASK;
+    index_type num = MAX(1u, (len + self->xnum - 1) / self->xnum);
+    for (index_type i = num; i-- > 0 && self->count < self->ynum;) {
+        if (!self->start_of_data) {
+            memmove(self->segments + 1, self->segments, self->num_segments * sizeof(HistoryBufSegment));
+            alloc_segment(self, self->segments);
+            self->num_segments++;
+            self->start_of_data = SEGMENT_SIZE;
+            self->id_base -= SEGMENT_SIZE;
+            self->staged += SEGMENT_SIZE; self->expanded_pos = UINT_MAX;
+            // The previous first segment has been completely filled
+            if (self->num_segments > 1) maybe_compress(self, 1);
+        }
+        self->start_of_data--;
+        self->count++;
+        memset(dest, 0, self->xnum * sizeof(Cell));
+        for (index_type x = 0, o = i * self->xnum; x < self->xnum && o < len;) {
+            index_type sx = o % src->xnum;
+            index_type n = MIN(MIN(src->xnum - sx, self->xnum - x), len - o);
+            copy_line_cells(src, src_idx(start + o / src->xnum), sx, n, dest + x);
+            x += n; o += n;
+        }
+        *attrptr(self, self->start_of_data) = TEXT_DIRTY_MASK | ((i || first_line_continued) ? CONTINUED_MASK : 0);
+        store_line(self, self->start_of_data, dest);
+        index_line(self, self->start_of_data);
+        // The marks of the source lines go to the line their first cell is rewrapped into
+        for (index_type y = start; y < end; y++) {
+            if (MIN((y - start) * src->xnum / self->xnum, num - 1) == i) add_marks(self, self->start_of_data, *attrptr(src, src_idx(y)));
+        }
+    }
+    self->pending_count = start;
+#undef src_idx
+}
+
+void
+historybuf_materialize(HistoryBuf *self, index_type num) {
+    // Ensure that the newest num lines have been rewrapped, if there are that many
+    while (self->pending && self->count < num && self->count < self->ynum && self->pending_count) rewrap_pending_line(self);
+    if (self->pending && (!self->pending_count || self->count >= self->ynum)) Py_CLEAR(self->pending);
+}
+
+static bool
+materialize_mark(HistoryBuf *self, line_attrs_type mask) {
+    // Rewrap the pending lines up to the newest one that has a mark in mask,
+    // rather than all of them. Returns false if there is no such line.
+    HistoryBuf *src = self->pending;
+    if (src == NULL) return false;
+    const LineMark *m = src->marks + src->marks_start;
+    size_t i = first_mark_at(src, src->id_base + src->start_of_data + self->pending_count);
+    while (i > 0 && !(m[i - 1].marks & mask)) i--;
+    if (!i) return false;
+    index_type y = m[i - 1].id - src->id_base - src->start_of_data;
+    while (self->pending_count > y && self->count < self->ynum) rewrap_pending_line(self);
+    historybuf_materialize(self, 0);
+    return true;
+}
+
+// }}}
+
 bool
 historybuf_resize(HistoryBuf *self, index_type lines) {
-    HistoryBuf t = {{0}};
-    t.xnum=self->xnum;
-    t.ynum=lines;
-    if (t.ynum > 0 && t.ynum != self->ynum) {
-        t.buf = PyMem_Calloc(t.xnum * t.ynum, sizeof(Cell));
-        if (t.buf == NULL) { PyErr_NoMemory(); return false; }
-        t.line_attrs = PyMem_Calloc(t.ynum, sizeof(line_attrs_type));
-        if (t.line_attrs == NULL) { PyMem_Free(t.buf); PyErr_NoMemory(); return false; }
-        t.count = MIN(self->count, t.ynum);
-        for (index_type s=0; s < t.count; s++) {
-            index_type si = index_of(self, s), ti = index_of(&t, s);
-            copy_cells(lineptr(self, si), lineptr(&t, ti), t.xnum);
-            t.line_attrs[ti] = self->line_attrs[si];
-        }
-        self->count = t.count;
-        self->start_of_data = t.start_of_data;
-        self->ynum = t.ynum;
-        PyMem_Free(self->buf); PyMem_Free(self->line_attrs);
-        self->buf = t.buf; self->line_attrs = t.line_attrs;
+    // Only the array of segments is re-allocated, the lines are not copied
+    historybuf_materialize(self, UINT_MAX);
+    if (lines == 0 || lines == self->ynum) return true;
+    if (self->count > lines) {
+        self->start_of_data += self->count - lines;
+        self->count = lines;
+        drop_evicted_marks(self);
+        release_evicted_segments(self);
     }
+    HistoryBufSegment *segments = PyMem_Realloc(self->segments, max_segments(lines) * sizeof(HistoryBufSegment));
+    if (segments == NULL) { PyErr_NoMemory(); return false; }
+    self->segments = segments;
+    self->ynum = lines;
     return true;
 }
 
 void 
-historybuf_add_line(HistoryBuf *self, const Line *line) {
+historybuf_add_line(HistoryBuf *self, const Line *line, line_attrs_type marks) {
     index_type idx = historybuf_push(self);
+    self->num_added++;
     copy_line(line, self->line);
-    self->line_attrs[idx] = (line->continued & CONTINUED_MASK) | (line->has_dirty_text ? TEXT_DIRTY_MASK : 0);
+    *attrptr(self, idx) = (line->continued & CONTINUED_MASK) | (line->has_dirty_text ? TEXT_DIRTY_MASK : 0);
+    add_marks(self, idx, marks);
+}
+
+void
+historybuf_add_evicted_line(HistoryBuf *self) {
+    // Account for a line that is known to be overwritten before anyone can
+    // look at it, without copying its contents
+    index_type idx = historybuf_push(self);
+    self->num_added++;
+    self->has_staged = false;
+    self->segments[idx / SEGMENT_SIZE].extents[idx % SEGMENT_SIZE].length = 0;
+    *attrptr(self, idx) = 0;
 }
 
 static PyObject*
@@ -141,8 +1004,10 @@ change_num_of_lines(HistoryBuf *self, PyObject *val) {
 static PyObject*
 line(HistoryBuf *self, PyObject *val) {
 #define line_doc "Return the line with line number val. This buffer grows upwards, i.e. 0 is the most recently added line"
+    historybuf_materialize(self, 1);
     if (self->count == 0) { PyErr_SetString(PyExc_IndexError, "This buffer is empty"); return NULL; }
     index_type lnum = PyLong_AsUnsignedLong(val);
+    historybuf_materialize(self, lnum + 1);
     if (lnum >= self->count) { PyErr_SetString(PyExc_IndexError, "Out of bounds"); return NULL; }
     init_line(self, index_of(self, lnum), self->line);
     Py_INCREF(self->line);
@@ -151,7 +1016,8 @@ line(HistoryBuf *self, PyObject *val) {
 
 static PyObject*
 __str__(HistoryBuf *self) {
-    PyObject *lines = PyTuple_New(self->ynum);
+    historybuf_materialize(self, UINT_MAX);
+    PyObject *lines = PyTuple_New(self->count);
     if (lines == NULL) return PyErr_NoMemory();
     for (index_type i = 0; i < self->count; i++) {
         init_line(self, index_of(self, i), self->line);
@@ -170,7 +1036,7 @@ push(HistoryBuf *self, PyObject *args) {
 #define push_doc "Push a line into this buffer, removing the oldest line, if necessary"
     Line *line;
     if (!PyArg_ParseTuple(args, "O!", &Line_Type, &line)) return NULL;
-    historybuf_add_line(self, line);
+    historybuf_add_line(self, line, 0);
     Py_RETURN_NONE;
 }
 
@@ -179,10 +1045,11 @@ as_ansi(HistoryBuf *self, PyObject *callback) {
 #define as_ansi_doc "as_ansi(callback) -> The contents of this buffer as ANSI escaped text. callback is called with each successive line."
     static Py_UCS4 t[5120];
     Line l = {.xnum=self->xnum};
-    for(unsigned int i = 0; i < self->count; i++) {
+    historybuf_materialize(self, UINT_MAX);
+    for(index_type i = self->start_of_data; i < self->start_of_data + self->count; i++) {
         init_line(self, i, &l);
-        if (i < self->count - 1) {
-            l.continued = self->line_attrs[index_of(self, i + 1)] & CONTINUED_MASK;
+        if (i < self->start_of_data + self->count - 1) {
+            l.continued = *attrptr(self, i + 1) & CONTINUED_MASK;
         } else l.continued = false;
         index_type num = line_as_ansi(&l, t, 5120);
         if (!(l.continued) && num < 5119) t[num++] = 10; // 10 = \n
@@ -200,14 +1067,35 @@ static PyObject*
 dirty_lines(HistoryBuf *self) {
 #define dirty_lines_doc "dirty_lines() -> Line numbers of all lines that have dirty text."
     PyObject *ans = PyList_New(0);
-    for (index_type i = 0; i < self->ynum; i++) {
-        if (self->line_attrs[i] & TEXT_DIRTY_MASK) {
+    historybuf_materialize(self, UINT_MAX);
+    for (index_type i = 0; i < self->count; i++) {
+        if (*attrptr(self, index_of(self, i)) & TEXT_DIRTY_MASK) {
             PyList_Append(ans, PyLong_FromUnsignedLong(i));
         }
     }
     return ans;
 }
 
+static PyObject*
+compression_stats(HistoryBuf *self, PyObject *args) {
+#define compression_stats_doc "compression_stats(wait=False) -> The number of segments, how many of them are compressed, decompressed and spilled to disk, the size of the compressed data and of the stored cells of the compressed segments. If wait is True, wait for queued compressions to finish first."
+    int wait = 0;
+    if (!PyArg_ParseTuple(args, "|p", &wait)) return NULL;
+    collect_compressed_segments(self, wait);
+    unsigned long long compressed_size = 0, raw_size = 0;
+    index_type num_compressed = 0, num_decompressed = 0, num_spilled = 0;
+    for (index_type i = 0; i < self->num_segments; i++) {
+        HistoryBufSegment *s = self->segments + i;
+        if (!s->compressed && !s->spilled) continue;
+        num_compressed++;
+        if (s->spilled) num_spilled++;
+        if (s->cells) num_decompressed++;
+        compressed_size += s->compressed_size;
+        raw_size += (unsigned long long)s->num_cells * sizeof(Cell);
+    }
+    return Py_BuildValue("{sI sI sI sI sK sK}", "segments", self->num_segments, "compressed", num_compressed, "decompressed", num_decompressed,
+        "spilled", num_spilled, "compressed_size", compressed_size, "raw_size", raw_size);
+}
 
 // Boilerplate {{{
 static PyObject* rewrap(HistoryBuf *self, PyObject *args);
@@ -220,13 +1108,26 @@ static PyMethodDef methods[] = {
     METHOD(dirty_lines, METH_NOARGS)
     METHOD(push, METH_VARARGS)
     METHOD(rewrap, METH_VARARGS)
+    METHOD(compression_stats, METH_VARARGS)
     {NULL, NULL, 0, NULL}  /* Sentinel */
 };
 
 static PyMemberDef members[] = {
     {"xnum", T_UINT, offsetof(HistoryBuf, xnum), READONLY, "xnum"},
     {"ynum", T_UINT, offsetof(HistoryBuf, ynum), READONLY, "ynum"},
-    {"count", T_UINT, offsetof(HistoryBuf, count), READONLY, "count"},
+    {"num_segments", T_UINT, offsetof(HistoryBuf, num_segments), READONLY, "num_segments"},
+    {"in_memory_lines", T_UINT, offsetof(HistoryBuf, in_memory_lines), 0, "in_memory_lines"},
+    {NULL}  /* Sentinel */
+};
+
+static PyObject*
+count_get(HistoryBuf *self, void UNUSED *closure) {
+    historybuf_materialize(self, UINT_MAX);
+    return PyLong_FromUnsignedLong(self->count);
+}
+
+static PyGetSetDef getsetters[] = {
+    {"count", (getter) count_get, NULL, "count", NULL},
     {NULL}  /* Sentinel */
 };
 
@@ -239,6 +1140,7 @@ PyTypeObject HistoryBuf_Type = {
     .tp_doc = "History buffers",
     .tp_methods = methods,
     .tp_members = members,            
+    .tp_getset = getsetters,
     .tp_str = (reprfunc)__str__,
     .tp_new = new
 };
@@ -246,37 +1148,94 @@ PyTypeObject HistoryBuf_Type = {
 INIT_TYPE(HistoryBuf)
 
 HistoryBuf *alloc_historybuf(unsigned int lines, unsigned int columns) {
-    return (HistoryBuf*)new(&HistoryBuf_Type, Py_BuildValue("II", lines, columns), NULL);
+    HistoryBuf *ans = (HistoryBuf*)new(&HistoryBuf_Type, Py_BuildValue("II", lines, columns), NULL);
+    if (ans) ans->in_memory_lines = OPT(scrollback_in_memory_lines);
+    return ans;
 }
 // }}}
 
 #define BufType HistoryBuf
 
-#define map_src_index(y) ((src->start_of_data + y) % src->ynum)
+#define map_src_index(y) (src->start_of_data + y)
 
 #define init_src_line(src_y) init_line(src, map_src_index(src_y), src->line);
 
-#define is_src_line_continued(src_y) (map_src_index(src_y) < src->ynum - 1 ? (src->line_attrs[map_src_index(src_y + 1)] & CONTINUED_MASK) : false)
+#define is_src_line_continued(src_y) (src_y < src->count - 1 ? (*attrptr(src, map_src_index(src_y + 1)) & CONTINUED_MASK) : false)
 
-#define next_dest_line(cont) dest->line_attrs[historybuf_push(dest)] = cont & CONTINUED_MASK; dest->line->continued = cont; 
+#define next_dest_line(cont) *attrptr(dest, historybuf_push(dest)) = cont & CONTINUED_MASK; dest->line->continued = cont; memset(dest->line->cells, 0, dest->xnum * sizeof(Cell));
 
 #define first_dest_line next_dest_line(false); 
 
+#define src_line_marks(src_y) *attrptr(src, map_src_index(src_y))
+
+#define add_dest_line_marks(marks) add_marks(dest, dest->staged, marks);
+
 #include "rewrap.h"
 
 void historybuf_rewrap(HistoryBuf *self, HistoryBuf *other) {
+    // Rewrapping is deferred until lines are actually needed, at which point
+    // they are rewrapped in blocks of logical lines, newest first, see
+    // historybuf_materialize(). self must not be modified afterwards.
+    Py_CLEAR(other->pending); other->pending_count = 0;
+    clear_segments(other);
     // Fast path
     if (other->xnum == self->xnum && other->ynum == self->ynum) {
-        memcpy(other->buf, self->buf, sizeof(Cell) * self->xnum * self->ynum);
-        memcpy(other->line_attrs, self->line_attrs, sizeof(line_attrs_type) * self->ynum);
+        for (index_type i = 0; i < self->num_segments; i++) {
+            HistoryBufSegment *s = self->segments + i, *d = other->segments + i;
+            if (s->spilled) ensure_cells(self, s);
+            alloc_segment(other, d);
+            memcpy(d->line_attrs, s->line_attrs, sizeof(line_attrs_type) * SEGMENT_SIZE);
+            memcpy(d->extents, s->extents, sizeof(LineExtent) * SEGMENT_SIZE);
+            memcpy(d->trigrams, s->trigrams, sizeof(uint64_t) * INDEX_WORDS);
+            d->num_cells = s->num_cells;
+            if (s->num_clusters) {
+                ensure_space_for(d, clusters, uint16_t, s->num_clusters, clusters_capacity, 16, false);
+                memcpy(d->clusters, s->clusters, sizeof(uint16_t) * s->num_clusters);
+                d->num_clusters = s->num_clusters;
+            }
+            if (s->cells && s->num_cells) {
+                d->cells = PyMem_Malloc(sizeof(Cell) * s->num_cells);
+                if (d->cells == NULL) fatal("Out of memory.");
+                memcpy(d->cells, s->cells, sizeof(Cell) * s->num_cells);
+                d->capacity = s->num_cells;
+            }
+            if (s->compressed) {
+                d->compressed = malloc(s->compressed_size);
+                if (d->compressed == NULL) fatal("Out of memory.");
+                memcpy(d->compressed, s->compressed, s->compressed_size);
+                d->compressed_size = s->compressed_size; d->encoded_size = s->encoded_size;
+            }
+        }
+        other->num_segments = self->num_segments;
+        for (index_type i = 0; i < other->num_segments; i++) maybe_compress(other, i);
         other->count = self->count; other->start_of_data = self->start_of_data;
+        memcpy(other->staging, self->staging, sizeof(Cell) * self->xnum);
+        other->staged = self->staged; other->has_staged = self->has_staged;
+        if (self->num_marks) {
+            if (other->marks_capacity < self->marks_capacity) {
+                PyMem_Free(other->marks);
+                other->marks = PyMem_Malloc(self->marks_capacity * sizeof(LineMark));
+                if (other->marks == NULL) fatal("Out of memory.");
+                other->marks_capacity = self->marks_capacity;
+            }
+            memcpy(other->marks + self->marks_start, self->marks + self->marks_start, self->num_marks * sizeof(LineMark));
+            other->marks_start = self->marks_start; other->num_marks = self->num_marks;
+        }
+        other->id_base = self->id_base; other->num_added = self->num_added;
+        other->pending = self->pending; Py_XINCREF(other->pending); other->pending_count = self->pending_count;
+        return;
+    }
+    if (!self->pending) {
+        if (self->count > 0) { other->pending = self; Py_INCREF(self); other->pending_count = self->count; }
         return;
     }
-    other->count = 0; other->start_of_data = 0;
+    // The lines already rewrapped from self->pending have to be rewrapped again
     if (self->count > 0) {
         rewrap_inner(self, other, self->count, NULL);
-        for (index_type i = 0; i < other->count; i++) other->line_attrs[(other->start_of_data + i) % other->ynum] |= TEXT_DIRTY_MASK;
+        for (index_type i = 0; i < other->count; i++) *attrptr(other, other->start_of_data + i) |= TEXT_DIRTY_MASK;
+        if (*attrptr(self, self->start_of_data) & CONTINUED_MASK) *attrptr(other, other->start_of_data) |= CONTINUED_MASK;
     }
+    if (other->count < other->ynum) { other->pending = self->pending; Py_INCREF(other->pending); other->pending_count = self->pending_count; }
 }
 
 static PyObject*
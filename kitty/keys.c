@@ -52,7 +52,7 @@ on_text_input(unsigned int codepoint, int mods) {
 #ifdef __APPLE__
         if (!OPT(macos_option_as_alt) && IS_ALT_MODS(mods)) sz = encode_utf8(codepoint, buf);
 #endif
-        if (sz) schedule_write_to_child(w->id, buf, sz);
+        if (sz) schedule_key_write_to_child(w->render_data.screen, buf, sz);
     }
 }
 
@@ -169,7 +169,7 @@ on_key_input(int key, int scancode, int action, int mods) {
             screen->modes.mEXTENDED_KEYBOARD
        ) {
         const char *data = key_to_bytes(lkey, screen->modes.mDECCKM, screen->modes.mEXTENDED_KEYBOARD, mods, action);
-        if (data) schedule_write_to_child(w->id, (data + 1), *data);
+        if (data) schedule_key_write_to_child(w->render_data.screen, (data + 1), *data);
     }
 }
 
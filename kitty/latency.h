@@ -0,0 +1,102 @@
+/*
+ * latency.h
+ * Copyright (C) 2017 Kovid Goyal <kovid at kovidgoyal.net>
+ *
+ * Distributed under terms of the GPL3 license.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Histograms of latencies in microseconds, with buckets in the style of HDR
+// histograms: values below 2^LATENCY_SUB_BUCKET_BITS have a bucket each and
+// every power of two above that is split into 2^(LATENCY_SUB_BUCKET_BITS-1)
+// buckets, so that the width of a bucket is at most 1/16 of its values, up
+// to about a day and a half. A histogram only ever has a single writer at a
+// time, but is read from other threads, so the counts are updated atomically.
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_SUB_BUCKETS (1u << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_HALF_SUB_BUCKETS (LATENCY_SUB_BUCKETS / 2)
+#define LATENCY_MAX_SHIFT 32
+#define LATENCY_NUM_BUCKETS (LATENCY_SUB_BUCKETS + LATENCY_MAX_SHIFT * LATENCY_HALF_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[LATENCY_NUM_BUCKETS];
+    uint64_t total, sum, max;
+} LatencyHistogram;
+
+static inline unsigned int
+latency_bucket(uint64_t val) {
+    if (val < LATENCY_SUB_BUCKETS) return val;
+    unsigned int shift = (63 - __builtin_clzll(val)) - (LATENCY_SUB_BUCKET_BITS - 1);
+    if (shift > LATENCY_MAX_SHIFT) return LATENCY_NUM_BUCKETS - 1;
+    return LATENCY_SUB_BUCKETS + (shift - 1) * LATENCY_HALF_SUB_BUCKETS + (unsigned int)(val >> shift) - LATENCY_HALF_SUB_BUCKETS;
+}
+
+static inline uint64_t
+latency_bucket_limit(unsigned int idx) {
+    // The largest value that falls in the bucket
+    if (idx < LATENCY_SUB_BUCKETS) return idx;
+    unsigned int j = idx - LATENCY_SUB_BUCKETS, shift = j / LATENCY_HALF_SUB_BUCKETS + 1;
+    uint64_t top = j % LATENCY_HALF_SUB_BUCKETS + LATENCY_HALF_SUB_BUCKETS;
+    return ((top + 1) << shift) - 1;
+}
+
+static inline void
+latency_record(LatencyHistogram *h, double secs) {
+    uint64_t val = secs > 0 ? (uint64_t)(secs * 1e6) : 0;
+    __atomic_fetch_add(h->counts + latency_bucket(val), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, val, __ATOMIC_RELAXED);
+    if (val > __atomic_load_n(&h->max, __ATOMIC_RELAXED)) __atomic_store_n(&h->max, val, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+}
+
+// The stages of the latency of a window, from a key press to the frame
+// showing its echo:
+// - INPUT_TO_WRITE: a key press to its data being written to the child
+// - READ_TO_PARSE: input being read from the child to it being parsed
+// - PARSE_TO_PRESENT: input being parsed to the frame showing it being presented
+// - KEY_TO_ECHO: a key press to the frame showing the first input read
+//   after it, its echo, being presented
+typedef enum { INPUT_TO_WRITE, READ_TO_PARSE, PARSE_TO_PRESENT, KEY_TO_ECHO, NUM_LATENCIES } LatencyStage;
+
+// The reads of input that has not been parsed yet, as the position in the
+// read ring their input ends at and the time they happened. When more reads
+// than fit are pending, the newest one is extended to cover the input of
+// the others.
+#define LATENCY_READ_STAMPS 64
+
+typedef struct {
+    size_t end;
+    double at;
+} ReadStamp;
+
+typedef struct {
+    // The times, from monotonic(), of events whose latency is not yet known,
+    // zero if there are none. A key press is tracked from when its data is
+    // queued until it is written to the child (key_at), then until input read
+    // after it is parsed (written_key_at) and then presented (echo_key_at).
+    double key_at, written_key_at;  // guarded by write_buf_lock
+    double last_read_at;  // guarded by read_buf_lock
+    ReadStamp reads[LATENCY_READ_STAMPS];  // guarded by read_buf_lock
+    unsigned int reads_start, num_reads;
+    double parsed_at, echo_key_at;  // main thread only
+    LatencyHistogram histograms[NUM_LATENCIES];
+} LatencyTracker;
+
+static inline void
+latency_key_written(LatencyTracker *t, double now) {
+    // Must be called with write_buf_lock held
+    latency_record(t->histograms + INPUT_TO_WRITE, now - t->key_at);
+    if (!t->written_key_at) t->written_key_at = t->key_at;
+    t->key_at = 0;
+}
+
+static inline void
+latency_presented(LatencyTracker *t, double now) {
+    if (t->parsed_at) { latency_record(t->histograms + PARSE_TO_PRESENT, now - t->parsed_at); t->parsed_at = 0; }
+    if (t->echo_key_at) { latency_record(t->histograms + KEY_TO_ECHO, now - t->echo_key_at); t->echo_key_at = 0; }
+}
@@ -52,6 +52,12 @@ clear(LineBuf *self) {
     Py_RETURN_NONE;
 }
 
+static void
+mark_clusters_in_use(void *holder) {
+    LineBuf *self = holder;
+    mark_clusters(self->buf, (size_t)self->xnum * self->ynum);
+}
+
 static PyObject *
 new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
     LineBuf *self;
@@ -88,6 +94,7 @@ new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
                 self->line_map[i] = i;
                 if (BLANK_CHAR != 0) clear_chars_to(self, i, BLANK_CHAR);
             }
+            add_cluster_holder(self, mark_clusters_in_use);
         }
     }
 
@@ -96,6 +103,7 @@ new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
 
 static void
 dealloc(LineBuf* self) {
+    remove_cluster_holder(self);
     PyMem_Free(self->buf);
     PyMem_Free(self->line_map); 
     PyMem_Free(self->line_attrs); 
@@ -189,6 +197,7 @@ allocate_line_storage(Line *line, bool initialize) {
         if (line->cells == NULL) { PyErr_NoMemory(); return false; }
     }
     line->needs_free = 1;
+    add_cluster_holder(line, line_mark_clusters_in_use);
     return true;
 }
 
@@ -17,9 +17,16 @@ new(PyTypeObject UNUSED *type, PyObject UNUSED *args, PyObject UNUSED *kwds) {
     return NULL;
 }
 
+void
+line_mark_clusters_in_use(void *holder) {
+    Line *self = holder;
+    mark_clusters(self->cells, self->xnum);
+}
+
 static void
 dealloc(Line* self) {
     if (self->needs_free) {
+        remove_cluster_holder(self);
         PyMem_Free(self->cells);
     }
     Py_TYPE(self)->tp_free((PyObject*)self);
@@ -40,11 +47,12 @@ line_text_at(char_type ch, combining_type cc) {
     if (LIKELY(cc == 0)) {
         ans = PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, &ch, 1);
     } else {
-        Py_UCS4 buf[3];
-        buf[0] = ch; buf[1] = cc & CC_MASK; buf[2] = cc >> 16;
-        Py_UCS4 normalized = normalize(ch, buf[1], buf[2]);
+        Py_UCS4 buf[MAX_NUM_COMBINING_CHARS + 1];
+        buf[0] = ch;
+        unsigned int num = cell_combining_chars(cc, buf + 1);
+        Py_UCS4 normalized = normalize(ch, buf + 1, num);
         if (normalized) ans = PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, &normalized, 1);
-        else ans = PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, buf, buf[2] ? 3 : 2);
+        else ans = PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, buf, num + 1);
     }
     return ans;
 }
@@ -169,29 +177,17 @@ size_t
 cell_as_unicode(Cell *cell, bool include_cc, Py_UCS4 *buf, char_type zero_char) {
     size_t n = 1;
     buf[0] = cell->ch ? cell->ch : zero_char;
-    if (include_cc) {
-        char_type cc = cell->cc;
-        Py_UCS4 cc1 = cc & CC_MASK, cc2;
-        if (cc1) {
-            buf[1] = cc1; n++;
-            cc2 = cc >> 16;
-            if (cc2) { buf[2] = cc2; n++; }
-        }
-    }
+    if (include_cc) n += cell_combining_chars(cell->cc, buf + 1);
     return n;
 }
 
 size_t
 cell_as_utf8(Cell *cell, bool include_cc, char *buf, char_type zero_char) {
     size_t n = encode_utf8(cell->ch ? cell->ch : zero_char, buf);
-    if (include_cc) {
-        char_type cc = cell->cc;
-        Py_UCS4 cc1 = cc & CC_MASK, cc2;
-        if (cc1) {
-            n += encode_utf8(cc1, buf + n);
-            cc2 = cc >> 16;
-            if (cc2) { n += encode_utf8(cc2, buf + n); }
-        }
+    if (include_cc && cell->cc) {
+        char_type cc[MAX_NUM_COMBINING_CHARS];
+        unsigned int num = cell_combining_chars(cell->cc, cc);
+        for (unsigned int i = 0; i < num; i++) n += encode_utf8(cc[i], buf + n);
     }
     buf[n] = 0;
     return n;
@@ -204,7 +200,7 @@ unicode_in_range(Line *self, index_type start, index_type limit, bool include_cc
     static Py_UCS4 buf[4096];
     if (leading_char) buf[n++] = leading_char; 
     char_type previous_width = 0;
-    for(index_type i = start; i < limit && n < sizeof(buf)/sizeof(buf[0]) - 4; i++) {
+    for(index_type i = start; i < limit && n < sizeof(buf)/sizeof(buf[0]) - (MAX_NUM_COMBINING_CHARS + 2); i++) {
         char_type ch = self->cells[i].ch;
         if (ch == 0) {
             if (previous_width == 2) { previous_width = 0; continue; };
@@ -299,12 +295,10 @@ line_as_ansi(Line *self, Py_UCS4 *buf, index_type buflen) {
         CHECK_COLOR(bg, self->cells[pos].bg, 48);
         CHECK_COLOR(decoration_fg, self->cells[pos].decoration_fg, DECORATION_FG_CODE);
         WRITE_CH(ch);
-        char_type cc = self->cells[pos].cc;
-        Py_UCS4 cc1 = cc & CC_MASK;
-        if (cc1) {
-            WRITE_CH(cc1);
-            cc1 = cc >> 16;
-            if (cc1) { WRITE_CH(cc1); }
+        if (self->cells[pos].cc) {
+            char_type cc[MAX_NUM_COMBINING_CHARS];
+            unsigned int num = cell_combining_chars(self->cells[pos].cc, cc);
+            for (unsigned int c = 0; c < num; c++) { WRITE_CH(cc[c]); }
         }
         previous_width = attrs & WIDTH_MASK;
     }
@@ -354,9 +348,7 @@ width(Line *self, PyObject *val) {
 void 
 line_add_combining_char(Line *self, uint32_t ch, unsigned int x) {
     if (!self->cells[x].ch) return;  // dont allow adding combining chars to a null cell
-    combining_type c = self->cells[x].cc;
-    if (c & CC_MASK) self->cells[x].cc = (c & CC_MASK) | ( (ch & CC_MASK) << CC_SHIFT );
-    else self->cells[x].cc = ch & CC_MASK;
+    self->cells[x].cc = append_combining_char(self->cells[x].cc, ch);
 }
 
 static PyObject*
@@ -44,12 +44,44 @@ xlimit_for_line(Line *line) {
     return xlimit;
 }
 
+static inline char_type
+search_fold_char(char_type ch) {
+    // Map every char that matches an ASCII letter when ignoring case to that letter in lower case
+    if (ch >= 'A' && ch <= 'Z') return ch + 32;
+    switch (ch) {
+        case 0x130: case 0x131: return 'i';
+        case 0x17f: return 's';
+        case 0x212a: return 'k';
+    }
+    return ch;
+}
+
+static inline index_type
+search_text_for_cells(const Cell *cells, index_type xlimit, char_type *buf, index_type *xs) {
+    // The text of the cells as it is searched, the same as the selected text.
+    // buf must have space for xlimit * (MAX_NUM_COMBINING_CHARS + 1) chars. If
+    // xs is not NULL, it is filled with the x position of every char.
+    index_type n = 0;
+    char_type previous_width = 0;
+    for (index_type x = 0; x < xlimit; x++) {
+        const Cell *cell = cells + x;
+        if (cell->ch == 0 && previous_width == 2) { previous_width = 0; continue; }
+        previous_width = cell->attrs & WIDTH_MASK;
+        index_type start = n;
+        buf[n++] = cell->ch ? cell->ch : ' ';
+        if (cell->cc) n += cell_combining_chars(cell->cc, buf + n);
+        if (xs) { for (index_type i = start; i < n; i++) xs[i] = x; }
+    }
+    return n;
+}
+
 PyObject* line_text_at(char_type, combining_type);
 void line_clear_text(Line *self, unsigned int at, unsigned int num, char_type ch);
 void line_apply_cursor(Line *self, Cursor *cursor, unsigned int at, unsigned int num, bool clear_char);
 void line_set_char(Line *, unsigned int , uint32_t , unsigned int , Cursor *, bool);
 void line_right_shift(Line *, unsigned int , unsigned int );
 void line_add_combining_char(Line *, uint32_t , unsigned int );
+void line_mark_clusters_in_use(void *holder);
 index_type line_url_start_at(Line *self, index_type x);
 index_type line_url_end_at(Line *self, index_type x);
 index_type line_as_ansi(Line *self, Py_UCS4 *buf, index_type buflen);
@@ -73,9 +105,17 @@ void linebuf_mark_line_clean(LineBuf *self, index_type y);
 unsigned int linebuf_char_width_at(LineBuf *self, index_type x, index_type y);
 void linebuf_refresh_sprite_positions(LineBuf *self);
 bool historybuf_resize(HistoryBuf *self, index_type lines);
-void historybuf_add_line(HistoryBuf *self, const Line *line);
+void historybuf_add_line(HistoryBuf *self, const Line *line, line_attrs_type marks);
+void historybuf_add_evicted_line(HistoryBuf *self);
 void historybuf_rewrap(HistoryBuf *self, HistoryBuf *other);
+void historybuf_materialize(HistoryBuf *self, index_type num);
 void historybuf_init_line(HistoryBuf *self, index_type num, Line *l);
 void historybuf_mark_line_clean(HistoryBuf *self, index_type y);
 void historybuf_mark_line_dirty(HistoryBuf *self, index_type y);
 void historybuf_refresh_sprite_positions(HistoryBuf *self);
+index_type historybuf_trigram_bits(const char_type *chars, index_type num, bool case_sensitive, uint32_t *bits);
+bool historybuf_is_continued(HistoryBuf *self, index_type lnum);
+bool historybuf_lines_may_contain(HistoryBuf *self, index_type first, index_type last, const uint32_t *bits, index_type num);
+index_type historybuf_oldest_in_segment(HistoryBuf *self, index_type lnum);
+const Cell* historybuf_text_cells(HistoryBuf *self, index_type lnum, index_type *length);
+bool historybuf_find_mark(HistoryBuf *self, int y, bool up, line_attrs_type mask, int *ans);
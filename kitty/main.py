@@ -109,6 +109,13 @@ def option_parser():
         help=_('Path to file in which to store the raw bytes received from the'
                ' child process. Useful for debugging.')
     )
+    a(
+        '--dump-latency',
+        help=_('Path to a file in which to store histograms of the latency of'
+               ' every window, from key presses being written to the child,'
+               ' through its output being read and parsed, to the frame'
+               ' showing it being presented, as JSON, on exit.')
+    )
     a(
         '--debug-gl',
         action='store_true',
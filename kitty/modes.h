@@ -81,3 +81,8 @@
 
 // Extended keyboard protocol
 #define EXTENDED_KEYBOARD (2017 << 5)
+
+// Synchronized updates: while set, the screen is not rendered, so that
+// applications can update it with multiple writes without partial frames
+// being displayed
+#define PENDING_UPDATE (2026 << 5)
@@ -191,7 +191,7 @@ HANDLER(handle_move_event) {
     } else {
         if (!mouse_cell_changed) return;
         size_t sz = encode_mouse_event(w, MAX(0, button), button >=0 ? DRAG : MOVE, 0);
-        if (sz) schedule_write_to_child(w->id, mouse_event_buf, sz);
+        if (sz) schedule_write_to_child(w->render_data.screen, mouse_event_buf, sz);
     }
 }
 
@@ -280,7 +280,7 @@ HANDLER(handle_button_event) {
         }
     } else {
         size_t sz = encode_mouse_event(w, button, is_release ? RELEASE : PRESS, modifiers);
-        if (sz) schedule_write_to_child(w->id, mouse_event_buf, sz);
+        if (sz) schedule_write_to_child(w->render_data.screen, mouse_event_buf, sz);
     }
 }
 
@@ -355,7 +355,7 @@ scroll_event(double UNUSED xoffset, double yoffset) {
         } else {
             if (screen->modes.mouse_tracking_mode) {
                 size_t sz = encode_mouse_event(w, upwards ? GLFW_MOUSE_BUTTON_4 : GLFW_MOUSE_BUTTON_5, PRESS, 0);
-                if (sz) schedule_write_to_child(w->id, mouse_event_buf, sz);
+                if (sz) schedule_write_to_child(w->render_data.screen, mouse_event_buf, sz);
             } else {
                 call_boss(send_fake_scroll, "IiO", window_idx, abs(s), upwards ? Py_True : Py_False);
             }
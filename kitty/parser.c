@@ -313,6 +313,9 @@ dispatch_osc(Screen *screen, PyObject DUMP_UNUSED *dump_callback) {
             case 2:
                 DISPATCH_OSC(set_title);
                 break;
+            case 133:
+                DISPATCH_OSC(shell_prompt_marking);
+                break;
             case 4:
             case 104:
                 SET_COLOR(set_color_table_color);
@@ -1050,10 +1053,59 @@ dispatch_unicode_char(Screen *screen, uint32_t codepoint, PyObject DUMP_UNUSED *
 
 extern uint32_t *latin1_charset;
 
+// Jump scroll {{{
+// A run of plain text is a sequence of bytes that can only draw characters or
+// move the cursor within a line or down, never up. While processing such a run
+// with the cursor on the bottom line, every line feed scrolls a line into the
+// history buffer, so the number of line feeds left in the run is a lower bound
+// on the number of lines that will be added to history before this batch of
+// input is finished. See the INDEX_UP macro in screen.c for how it is used.
+
+static inline bool
+is_plain_text_byte(uint8_t ch) {
+    switch(ch) {
+        case BS:
+        case HT:
+        case LF:
+        case VT:
+        case FF:
+        case CR:
+            return true;
+        case 0xc2:
+            return false;  // lead byte of the UTF-8 encoded C1 control codes
+        default:
+            return (ch >= ' ' && ch < DEL) || ch > DEL;
+    }
+}
+
+static inline unsigned int
+find_plain_text_run(uint8_t *buf, unsigned int pos, unsigned int len, unsigned int *num_linefeeds) {
+    unsigned int count = 0;
+    for (; pos < len && is_plain_text_byte(buf[pos]); pos++) {
+        if (buf[pos] == LF || buf[pos] == VT || buf[pos] == FF) count++;
+    }
+    *num_linefeeds = count;
+    return pos;
+}
+// }}}
+
 static inline void 
 _parse_bytes(Screen *screen, uint8_t *buf, Py_ssize_t len, PyObject DUMP_UNUSED *dump_callback) {
     uint32_t prev = screen->utf8_state;
+    unsigned int run_end = 0, counted_upto = 0, linefeeds_in_run = 0;
     for (unsigned int i = 0; i < (unsigned int)len; i++) {
+        if (i >= run_end) {
+            linefeeds_in_run = 0; counted_upto = i + 1;
+            // Only plain text seen in the normal parser state is guaranteed to never move the cursor up
+            if (screen->parser_state == 0 && screen->utf8_state == UTF8_ACCEPT && !screen->use_latin1) {
+                run_end = find_plain_text_run(buf, i, (unsigned int)len, &linefeeds_in_run);
+                if (run_end > i && (buf[i] == LF || buf[i] == VT || buf[i] == FF)) linefeeds_in_run--;
+            } else run_end = i + 1;
+        }
+        for (; counted_upto <= i && counted_upto < run_end; counted_upto++) {
+            if (buf[counted_upto] == LF || buf[counted_upto] == VT || buf[counted_upto] == FF) linefeeds_in_run--;
+        }
+        screen->jump_scroll_lines = i < run_end ? linefeeds_in_run : 0;
         if (screen->use_latin1) dispatch_unicode_char(screen, latin1_charset[buf[i]], dump_callback);
         else {
             switch (decode_utf8(&screen->utf8_state, &screen->utf8_codepoint, buf[i])) {
@@ -1068,6 +1120,7 @@ _parse_bytes(Screen *screen, uint8_t *buf, Py_ssize_t len, PyObject DUMP_UNUSED
             prev = screen->utf8_state;
         }
     }
+    screen->jump_scroll_lines = 0;
 FLUSH_DRAW;
 }
 // }}}
@@ -1095,11 +1148,11 @@ FNAME(parse_bytes)(PyObject UNUSED *self, PyObject *args) {
 
 
 void
-FNAME(parse_worker)(Screen *screen, PyObject *dump_callback) {
+FNAME(parse_worker)(Screen *screen, uint8_t *buf, size_t sz, PyObject *dump_callback) {
 #ifdef DUMP_COMMANDS
-    Py_XDECREF(PyObject_CallFunction(dump_callback, "sy#", "bytes", screen->read_buf, screen->read_buf_sz)); PyErr_Clear();
+    Py_XDECREF(PyObject_CallFunction(dump_callback, "sy#", "bytes", buf, sz)); PyErr_Clear();
 #endif
-    _parse_bytes(screen, screen->read_buf, screen->read_buf_sz, dump_callback);
+    _parse_bytes(screen, buf, sz, dump_callback);
 #undef FNAME
 }
 // }}}
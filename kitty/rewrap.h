@@ -29,7 +29,7 @@
         linebuf_index(dest, 0, dest->ynum - 1); \
         if (historybuf != NULL) { \
             init_dest_line(dest->ynum - 1); \
-            historybuf_add_line(historybuf, dest->line); \
+            historybuf_add_line(historybuf, dest->line, dest->line_attrs[dest->ynum - 1] & LINE_MARKS_MASK); \
         }\
         linebuf_clear_line(dest, dest->ynum - 1); \
     } else dest_y++; \
@@ -37,6 +37,14 @@
     dest->line_attrs[dest_y] = continued ? CONTINUED_MASK : 0;
 #endif
 
+#ifndef src_line_marks
+#define src_line_marks(src_y) src->line_attrs[src_y]
+#endif
+
+#ifndef add_dest_line_marks
+#define add_dest_line_marks(marks) dest->line_attrs[dest_y] |= marks;
+#endif
+
 #ifndef is_src_line_continued
 #define is_src_line_continued(src_y) (src_y < src->ynum - 1 ? (src->line_attrs[src_y + 1] & CONTINUED_MASK) : false)
 #endif
@@ -62,8 +70,12 @@ rewrap_inner(BufType *src, BufType *dest, const index_type src_limit, HistoryBuf
             while(src_x_limit && (src->line->cells[src_x_limit - 1].ch) == BLANK_CHAR) src_x_limit--;
             
         }
+        // Shell integration marks go to the line the first cell of the source line is rewrapped into
+        line_attrs_type marks = src_line_marks(src_y) & LINE_MARKS_MASK;
+        if (marks && !src_x_limit) add_dest_line_marks(marks);
         while (src_x < src_x_limit) {
             if (dest_x >= dest->xnum) { next_dest_line(true); dest_x = 0; }
+            if (marks) { add_dest_line_marks(marks); marks = 0; }
             num = MIN(src->line->xnum - src_x, dest->xnum - dest_x);
             copy_range(src->line, src_x, dest->line, dest_x, num);
             src_x += num; dest_x += num;
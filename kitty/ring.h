@@ -0,0 +1,90 @@
+/*
+ * ring.h
+ * Copyright (C) 2017 Kovid Goyal <kovid at kovidgoyal.net>
+ *
+ * Distributed under terms of the GPL3 license.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+#define CACHE_LINE_SZ 64
+
+// A lock-free byte ring for a single producer and a single consumer thread.
+// head and tail are the total number of bytes ever written and consumed, so
+// the ring is empty when they are equal and full when they differ by
+// capacity, which must be a power of two. head is only written by the
+// producer and tail only by the consumer, each in a cache line of its own.
+// The producer writes into the free space and the consumer reads the used
+// space in place, both as up to two regions, since they can wrap around the
+// end of buf.
+typedef struct {
+    uint8_t *buf;
+    size_t capacity;
+    uint8_t pad0[CACHE_LINE_SZ];
+    size_t head;
+    uint8_t pad1[CACHE_LINE_SZ - sizeof(size_t)];
+    size_t tail;
+    uint8_t pad2[CACHE_LINE_SZ - sizeof(size_t)];
+} ByteRing;
+
+static inline void
+ring_init(ByteRing *r, uint8_t *buf, size_t capacity) {
+    r->buf = buf; r->capacity = capacity;
+    r->head = 0; r->tail = 0;
+}
+
+static inline size_t
+ring_used(ByteRing *r) {
+    // Safe to call from any thread. tail is loaded first, so that it is never
+    // ahead of head.
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+}
+
+static inline bool
+ring_is_full(ByteRing *r) {
+    return ring_used(r) >= r->capacity;
+}
+
+static inline unsigned int
+ring_regions(ByteRing *r, size_t pos, size_t len, struct iovec iov[2]) {
+    size_t offset = pos & (r->capacity - 1), first = len < r->capacity - offset ? len : r->capacity - offset;
+    if (!len) return 0;
+    iov[0].iov_base = r->buf + offset; iov[0].iov_len = first;
+    if (first == len) return 1;
+    iov[1].iov_base = r->buf; iov[1].iov_len = len - first;
+    return 2;
+}
+
+static inline unsigned int
+ring_write_space(ByteRing *r, struct iovec iov[2]) {
+    // Producer only. The free space, returns the number of regions in iov.
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    return ring_regions(r, head, r->capacity - (head - tail), iov);
+}
+
+static inline void
+ring_commit_write(ByteRing *r, size_t num) {
+    // Producer only. Hand over num bytes written into the free space to the consumer.
+    __atomic_store_n(&r->head, __atomic_load_n(&r->head, __ATOMIC_RELAXED) + num, __ATOMIC_RELEASE);
+}
+
+static inline unsigned int
+ring_read_space(ByteRing *r, struct iovec iov[2]) {
+    // Consumer only. The used space, returns the number of regions in iov.
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    return ring_regions(r, tail, head - tail, iov);
+}
+
+static inline void
+ring_commit_read(ByteRing *r, size_t num) {
+    // Consumer only. Hand num consumed bytes back to the producer.
+    __atomic_store_n(&r->tail, __atomic_load_n(&r->tail, __ATOMIC_RELAXED) + num, __ATOMIC_RELEASE);
+}
@@ -65,14 +65,20 @@ new(PyTypeObject *type, PyObject *args, PyObject UNUSED *kwds) {
             return NULL;
         }
         self->columns = columns; self->lines = lines;
-        self->write_buf = PyMem_RawMalloc(BUFSIZ);
         self->window_id = window_id;
-        if (self->write_buf == NULL) { Py_CLEAR(self); return PyErr_NoMemory(); }
-        self->write_buf_sz = BUFSIZ;
+        self->write_queue.fd = -1;
+        ring_init(&self->read_ring, self->read_buf, READ_BUF_SZ);
+        self->read_limit = READ_BUF_SZ;
         self->modes = empty_modes;
         self->is_dirty = true;
         self->scroll_changed = false;
         self->margin_top = 0; self->margin_bottom = self->lines - 1;
+        self->rendered_selection = PyMem_Calloc(self->lines, sizeof(SelectionSpan));
+        if (self->rendered_selection == NULL) { Py_CLEAR(self); return PyErr_NoMemory(); }
+        if (global_state.track_latency) {
+            self->latency = PyMem_Calloc(1, sizeof(LatencyTracker));
+            if (self->latency == NULL) { Py_CLEAR(self); return PyErr_NoMemory(); }
+        }
         self->history_line_added_count = 0;
         RESET_CHARSETS;
         self->callbacks = callbacks; Py_INCREF(callbacks);
@@ -121,6 +127,7 @@ screen_reset(Screen *self) {
 
 static inline HistoryBuf* 
 realloc_hb(HistoryBuf *old, unsigned int lines, unsigned int columns) {
+    if (old->xnum == columns && old->ynum == lines) { Py_INCREF(old); return old; }
     HistoryBuf *ans = alloc_historybuf(lines, columns);
     if (ans == NULL) { PyErr_NoMemory(); return NULL; }
     historybuf_rewrap(old, ans);
@@ -177,7 +184,15 @@ screen_resize(Screen *self, unsigned int lines, unsigned int columns) {
     init_tabstops(self->alt_tabstops, self->columns);
     self->is_dirty = true;
     self->selection = EMPTY_SELECTION;
+    // The contents have been rewrapped, so a pending synchronized update
+    // cannot be held back against a frame of the old size, and applications
+    // redraw after a resize anyway
+    self->modes.mPENDING_UPDATE = false;
     self->url_range = EMPTY_SELECTION;
+    PyMem_Free(self->rendered_selection);
+    self->rendered_selection = PyMem_Calloc(self->lines, sizeof(SelectionSpan));
+    if (self->rendered_selection == NULL) { PyErr_NoMemory(); return false; }
+    self->selection_updated_once = false;
 
     // Ensure cursor is on the correct line
     self->cursor->x = 0;
@@ -220,7 +235,10 @@ dealloc(Screen* self) {
     pthread_mutex_destroy(&self->write_buf_lock);
     Py_CLEAR(self->main_grman); 
     Py_CLEAR(self->alt_grman);
-    PyMem_RawFree(self->write_buf);
+    free_write_queue(&self->write_queue);
+    PyMem_Free(self->rendered_selection);
+    free(self->rendered_frame.images);
+    PyMem_Free(self->latency);
     Py_CLEAR(self->callbacks);
     Py_CLEAR(self->test_child);
     Py_CLEAR(self->cursor); 
@@ -423,7 +441,7 @@ END_ALLOW_CASE_RANGE
 
 static inline void
 write_to_child(Screen *self, const char *data, size_t sz) {
-    if (self->window_id) schedule_write_to_child(self->window_id, data, sz);
+    schedule_write_to_child(self, data, sz);
     if (self->test_child != Py_None) { PyObject *r = PyObject_CallMethod(self->test_child, "write", "y#", data, sz); if (r == NULL) PyErr_Print(); Py_CLEAR(r); }
 }
 
@@ -532,6 +550,13 @@ set_mode_from_const(Screen *self, unsigned int mode, bool val) {
             if (val && self->linebuf == self->main_linebuf) screen_toggle_screen_buffer(self);
             else if (!val && self->linebuf != self->main_linebuf) screen_toggle_screen_buffer(self);
             break;  
+        case PENDING_UPDATE:
+            if (val != self->modes.mPENDING_UPDATE) {
+                self->modes.mPENDING_UPDATE = val;
+                if (val) self->start_pending_update_at = monotonic();
+                else self->is_dirty = true;  // present everything that was drawn while the update was pending
+            }
+            break;
         default:
             private = mode >= 1 << 5;
             if (private) mode >>= 5;
@@ -567,6 +592,16 @@ screen_is_cursor_visible(Screen *self) {
     return self->modes.mDECTCEM;
 }
 
+bool
+screen_is_update_pending(Screen *self, double now, double *time_left) {
+    // Applications that never end the update must not be able to freeze the display
+    if (!self->modes.mPENDING_UPDATE) return false;
+    double elapsed = now - self->start_pending_update_at;
+    if (elapsed >= PENDING_UPDATE_TIMEOUT) return false;
+    if (time_left) *time_left = PENDING_UPDATE_TIMEOUT - elapsed;
+    return true;
+}
+
 void 
 screen_backspace(Screen *self) {
     screen_cursor_back(self, 1, -1);
@@ -682,8 +717,13 @@ screen_cursor_to_column(Screen *self, unsigned int column) {
     INDEX_GRAPHICS(-1) \
     if (self->linebuf == self->main_linebuf && bottom == self->lines - 1) { \
         /* Only add to history when no page margins have been set */ \
-        linebuf_init_line(self->linebuf, bottom); \
-        historybuf_add_line(self->historybuf, self->linebuf->line); \
+        if (self->jump_scroll_lines >= self->historybuf->ynum) { \
+            /* This line will be evicted by lines that the parser has already seen, so dont bother copying it */ \
+            historybuf_add_evicted_line(self->historybuf); \
+        } else { \
+            linebuf_init_line(self->linebuf, bottom); \
+            historybuf_add_line(self->historybuf, self->linebuf->line, self->linebuf->line_attrs[bottom] & LINE_MARKS_MASK); \
+        } \
         self->history_line_added_count++; \
     } \
     linebuf_clear_line(self->linebuf, bottom); \
@@ -872,6 +912,8 @@ screen_erase_in_line(Screen *self, unsigned int how, bool private) {
         } else {
             line_apply_cursor(self->linebuf->line, self->cursor, s, n, true);
         }
+        // The shell integration marks go with the contents of the line
+        if (how == 2) self->linebuf->line_attrs[self->cursor->y] &= ~LINE_MARKS_MASK;
         self->is_dirty = true;
         linebuf_mark_line_dirty(self->linebuf, self->cursor->y);
     }
@@ -911,6 +953,7 @@ screen_erase_in_display(Screen *self, unsigned int how, bool private) {
             } else {
                 line_apply_cursor(self->linebuf->line, self->cursor, 0, self->columns, true);
             }
+            self->linebuf->line_attrs[i] &= ~LINE_MARKS_MASK;
             linebuf_mark_line_dirty(self->linebuf, i);
         }
         self->is_dirty = true;
@@ -1085,6 +1128,7 @@ report_mode_status(Screen *self, unsigned int which, bool private) {
         KNOWN_MODE(BRACKETED_PASTE);
         KNOWN_MODE(EXTENDED_KEYBOARD);
         KNOWN_MODE(FOCUS_TRACKING);
+        KNOWN_MODE(PENDING_UPDATE);
 #undef KNOWN_MODE
         case STYLED_UNDERLINES:
             ans = 3; break;
@@ -1187,6 +1231,7 @@ screen_update_cell_data(Screen *self, void *address, size_t UNUSED sz) {
             historybuf_mark_line_clean(self->historybuf, lnum);
         }
         update_line_data(self->historybuf->line, y, address);
+        self->rendered_selection[y].line_limit = xlimit_for_line(self->historybuf->line);
     }
     for (index_type y = self->scrolled_by; y < self->lines; y++) {
         lnum = y - self->scrolled_by;
@@ -1196,7 +1241,9 @@ screen_update_cell_data(Screen *self, void *address, size_t UNUSED sz) {
             linebuf_mark_line_clean(self->linebuf, lnum);
         }
         update_line_data(self->linebuf->line, y, address);
+        self->rendered_selection[y].line_limit = xlimit_for_line(self->linebuf->line);
     }
+    self->rendered_lines_changed = true;
     if (selection_must_be_cleared) {
         self->selection = EMPTY_SELECTION; self->url_range = EMPTY_SELECTION;
     }
@@ -1242,25 +1289,67 @@ visual_line_(Screen *self, index_type y) {
     return self->linebuf->line;
 }
 
+bool
+screen_selection_buffer_needs_realloc(Screen *self) {
+    return !self->selection_updated_once;
+}
+
+static inline void
+apply_selection_to_row(Screen *self, float *data, index_type y, SelectionBoundary start, SelectionBoundary end, bool empty, bool full) {
+    index_type xstart = 0, xlimit = 0;
+    SelectionSpan *s = self->rendered_selection + y;
+    if (!empty && start.y <= y && y <= end.y) {
+        xlimit = s->line_limit;
+        if (y == end.y) xlimit = MIN(end.x + 1, xlimit);
+        if (y == start.y) xstart = start.x;
+        if (xstart >= xlimit) xstart = xlimit = 0;
+    }
+    float *line_start = data + self->columns * y;
+    if (!full) {
+        if (s->x == xstart && s->x_limit == xlimit) return;
+        for (index_type x = s->x; x < s->x_limit; x++) line_start[x] = 0;
+    }
+    for (index_type x = xstart; x < xlimit; x++) line_start[x] = 1.0;
+    s->x = xstart; s->x_limit = xlimit;
+}
+
 void
 screen_apply_selection(Screen *self, void *address, size_t size) {
-#define start (self->last_rendered_selection_start)
-#define end (self->last_rendered_selection_end)
+    // Only the rows whose selected range can have changed since the last call
+    // are visited and only those whose range has changed are written, unless
+    // address points to a newly allocated buffer, as indicated by
+    // screen_selection_buffer_needs_realloc(). The end of the text of every
+    // row is known from the last upload of the cell data, which happens
+    // whenever the lines shown in the rows change.
+    SelectionBoundary start, end, old_start = self->last_rendered_selection_start, old_end = self->last_rendered_selection_end;
     float *data = address;
-    memset(data, 0, size);
+    bool full = !self->selection_updated_once;
+    bool was_empty = full || is_selection_empty(self, old_start.x, old_start.y, old_end.x, old_end.y);
+    if (full) memset(data, 0, size);
     selection_limits_(selection, &start, &end);
+    bool empty = is_selection_empty(self, start.x, start.y, end.x, end.y);
+    // The ranges of rows to visit
+    index_type ranges[2][2], num_ranges = 0;
+#define R(a, b) { ranges[num_ranges][0] = MIN(a, b); ranges[num_ranges][1] = MAX(a, b); num_ranges++; }
+    if (full) { ranges[0][0] = 0; ranges[0][1] = self->lines - 1; num_ranges = 1; }
+    else if (self->rendered_lines_changed || self->last_selection_scrolled_by != self->scrolled_by || was_empty || empty) {
+        // Every row of the old and the new selection
+        if (!was_empty && !empty) R(MIN(old_start.y, start.y), MAX(old_end.y, end.y))
+        else if (!was_empty) R(old_start.y, old_end.y)
+        else if (!empty) R(start.y, end.y)
+    } else {
+        // Only the rows between the old and new boundaries
+        R(old_start.y, start.y);
+        R(old_end.y, end.y);
+    }
+#undef R
+    for (index_type r = 0; r < num_ranges; r++) {
+        for (index_type y = ranges[r][0]; y <= ranges[r][1] && y < self->lines; y++) apply_selection_to_row(self, data, y, start, end, empty, full);
+    }
+    self->last_rendered_selection_start = start; self->last_rendered_selection_end = end;
     self->last_selection_scrolled_by = self->scrolled_by;
     self->selection_updated_once = true;
-    if (is_selection_empty(self, start.x, start.y, end.x, end.y)) { return; }
-    for (index_type y = start.y; y <= end.y; y++) {
-        Line *line = visual_line_(self, y);
-        index_type xlimit = xlimit_for_line(line);
-        if (y == end.y) xlimit = MIN(end.x + 1, xlimit);
-        float *line_start = data + self->columns * y;
-        for (index_type x = (y == start.y ? start.x : 0); x < xlimit; x++) line_start[x] = 1.0;
-    }
-#undef start
-#undef end
+    self->rendered_lines_changed = false;
 }
 
 void
@@ -1391,6 +1480,7 @@ MODE_GETSET(focus_tracking_enabled, FOCUS_TRACKING)
 MODE_GETSET(auto_repeat_enabled, DECARM)
 MODE_GETSET(cursor_visible, DECTCEM)
 MODE_GETSET(cursor_key_mode, DECCKM)
+MODE_GETSET(update_pending, PENDING_UPDATE)
 
 static PyObject*
 cursor_up(Screen *self, PyObject *args) {
@@ -1422,26 +1512,126 @@ change_scrollback_size(Screen *self, PyObject *args) {
     Py_RETURN_NONE;
 }
 
+// Selection text {{{
+
+// Size of the chunks passed to the callback of text_for_selection()
+#define SELECTION_CHUNK_SIZE (64u * 1024u)
+// Space needed to write one cell as UTF-8, including the trailing NUL written by cell_as_utf8()
+#define MAX_CELL_UTF8_SIZE ((1 + MAX_NUM_COMBINING_CHARS) * 4 + 1)
+
+typedef struct {
+    PyObject *ans, *callback;
+    char *buf;
+    size_t used, capacity;
+} SelectionWriter;
+
+static inline bool
+flush_selection_chunk(SelectionWriter *w) {
+    if (!w->used) return true;
+    PyObject *mv = PyMemoryView_FromMemory(w->buf, w->used, PyBUF_READ);
+    if (mv == NULL) return false;
+    PyObject *ret = PyObject_CallFunctionObjArgs(w->callback, mv, NULL);
+    bool ok = ret != NULL;
+    Py_XDECREF(ret);
+    if (ok) {
+        // The chunk buffer is re-used, so do not let the callback hold on to it
+        ret = PyObject_CallMethod(mv, "release", NULL);
+        ok = ret != NULL;
+        Py_XDECREF(ret);
+    }
+    Py_DECREF(mv);
+    w->used = 0;
+    return ok;
+}
+
+static inline bool
+reserve_selection_space(SelectionWriter *w, size_t needed) {
+    if (w->capacity - w->used >= needed) return true;
+    if (w->callback) return flush_selection_chunk(w);
+    size_t capacity = MAX(w->capacity * 2, w->used + needed);
+    if (_PyBytes_Resize(&w->ans, capacity) != 0) return false;
+    w->buf = PyBytes_AS_STRING(w->ans); w->capacity = capacity;
+    return true;
+}
+
+static inline int
+selection_y(Screen *self, unsigned int y, unsigned int scrolled_by) {
+    // The line number relative to the top of the screen when not scrolled,
+    // negative numbers are lines in the history buffer
+    int ans = (int)y - (int)scrolled_by;
+    int min_y = self->linebuf == self->main_linebuf ? -(int)self->historybuf->count : 0;
+    return MIN(MAX(ans, min_y), (int)self->lines - 1);
+}
+
+static inline Line*
+selection_line(Screen *self, int y) {
+    if (y < 0) {
+        historybuf_init_line(self->historybuf, -y - 1, self->historybuf->line);
+        return self->historybuf->line;
+    }
+    linebuf_init_line(self->linebuf, y);
+    return self->linebuf->line;
+}
+
+static inline bool
+write_selection(Screen *self, int start_y, index_type start_x, int end_y, index_type end_x, SelectionWriter *w) {
+    for (int y = start_y; y <= end_y; y++) {
+        Line *line = selection_line(self, y);
+        index_type xlimit = xlimit_for_line(line), xstart = y == start_y ? start_x : 0;
+        if (y == end_y) xlimit = MIN(end_x + 1, xlimit);
+        if (y > start_y && !line->continued) {
+            if (!reserve_selection_space(w, 1)) return false;
+            w->buf[w->used++] = '\n';
+        }
+        char_type previous_width = 0;
+        for (index_type x = xstart; x < xlimit; x++) {
+            Cell *cell = line->cells + x;
+            if (cell->ch == 0 && previous_width == 2) { previous_width = 0; continue; }
+            if (!reserve_selection_space(w, MAX_CELL_UTF8_SIZE)) return false;
+            if (cell->ch < 0x80 && !cell->cc) w->buf[w->used++] = cell->ch ? cell->ch : ' ';
+            else w->used += cell_as_utf8(cell, true, w->buf + w->used, ' ');
+            previous_width = cell->attrs & WIDTH_MASK;
+        }
+    }
+    return true;
+}
+
 static PyObject*
-text_for_selection(Screen *self) {
-    SelectionBoundary start, end;
-    selection_limits_(selection, &start, &end);
-    if (is_selection_empty(self, start.x, start.y, end.x, end.y)) return PyTuple_New(0);
-    Py_ssize_t i = 0, num_of_lines = end.y - start.y + 1;
-    PyObject *ans = PyTuple_New(num_of_lines);
-    if (ans == NULL) return PyErr_NoMemory();
-    for (index_type y = start.y; y <= end.y; y++, i++) {
-        Line *line = visual_line_(self, y);
-        index_type xlimit = xlimit_for_line(line);
-        if (y == end.y) xlimit = MIN(end.x + 1, xlimit);
-        index_type xstart = (y == start.y ? start.x : 0);
-        char leading_char = i > 0 && !line->continued ? '\n' : 0;
-        PyObject *text = unicode_in_range(line, xstart, xlimit, true, leading_char);
-        if (text == NULL) { Py_DECREF(ans); return PyErr_NoMemory(); }
-        PyTuple_SET_ITEM(ans, i, text);
+text_for_selection(Screen *self, PyObject *args) {
+#define text_for_selection_doc "text_for_selection([callback]) -> The selected text, including any lines in the scrollback, as UTF-8 encoded bytes. If callback is specified it is called with the text in chunks, as memoryviews that are valid only for the duration of the call, and None is returned."
+    SelectionWriter w = {0};
+    if (!PyArg_ParseTuple(args, "|O", &w.callback)) return NULL;
+    if (w.callback == Py_None) w.callback = NULL;
+    Selection *s = &self->selection;
+    int start_y = selection_y(self, s->start_y, s->start_scrolled_by), end_y = selection_y(self, s->end_y, s->end_scrolled_by);
+    index_type start_x = MIN(s->start_x, self->columns - 1), end_x = MIN(s->end_x, self->columns - 1);
+    if (start_y > end_y || (start_y == end_y && start_x > end_x)) {
+        int ty = start_y; start_y = end_y; end_y = ty;
+        index_type tx = start_x; start_x = end_x; end_x = tx;
     }
-    return ans;
+    bool empty = start_y == end_y && start_x == end_x;
+    if (w.callback) {
+        if (empty) Py_RETURN_NONE;
+        w.capacity = SELECTION_CHUNK_SIZE;
+        w.buf = PyMem_Malloc(w.capacity);
+        if (w.buf == NULL) return PyErr_NoMemory();
+        bool ok = write_selection(self, start_y, start_x, end_y, end_x, &w) && flush_selection_chunk(&w);
+        PyMem_Free(w.buf);
+        if (!ok) return NULL;
+        Py_RETURN_NONE;
+    }
+    if (empty) return PyBytes_FromStringAndSize(NULL, 0);
+    // Exact for text that is all ASCII, grown as needed otherwise
+    w.capacity = (size_t)(end_y - start_y + 1) * (self->columns + 1);
+    w.ans = PyBytes_FromStringAndSize(NULL, w.capacity);
+    if (w.ans == NULL) return NULL;
+    w.buf = PyBytes_AS_STRING(w.ans);
+    if (!write_selection(self, start_y, start_x, end_y, end_x, &w)) { Py_CLEAR(w.ans); return NULL; }
+    if (_PyBytes_Resize(&w.ans, w.used) != 0) return NULL;
+    return w.ans;
 }
+
+// }}}
  
 bool
 screen_selection_range_for_line(Screen *self, index_type y, index_type *start, index_type *end) {
@@ -1490,6 +1680,7 @@ screen_history_scroll(Screen *self, int amt, bool upwards) {
             amt = self->lines - 1;
             break;
         case SCROLL_FULL:
+            historybuf_materialize(self->historybuf, UINT_MAX);
             amt = self->historybuf->count;
             break;
         default:
@@ -1501,6 +1692,7 @@ screen_history_scroll(Screen *self, int amt, bool upwards) {
         amt *= -1;
     }
     if (amt == 0) return false;
+    if (amt > 0) historybuf_materialize(self->historybuf, self->scrolled_by + amt);
     unsigned int new_scroll = MIN(self->scrolled_by + amt, self->historybuf->count);
     if (new_scroll != self->scrolled_by) {
         self->scrolled_by = new_scroll;
@@ -1546,6 +1738,372 @@ screen_update_selection(Screen *self, index_type x, index_type y, bool ended) {
     if (ended) self->selection.in_progress = false;
 }
 
+static PyObject*
+start_selection(Screen *self, PyObject *args) {
+    unsigned int x, y;
+    if (!PyArg_ParseTuple(args, "II", &x, &y)) return NULL;
+    screen_start_selection(self, x, y);
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+update_selection(Screen *self, PyObject *args) {
+    unsigned int x, y;
+    int ended = 0;
+    if (!PyArg_ParseTuple(args, "II|p", &x, &y, &ended)) return NULL;
+    screen_update_selection(self, x, y, ended);
+    Py_RETURN_NONE;
+}
+
+// Search {{{
+// Matches are found in logical lines, i.e. lines joined with the lines they
+// are continued by. Logical lines in the history are skipped if the index of
+// their segment shows that they cannot contain the literal parts of the query.
+
+typedef struct {
+    index_type x1, x2;
+    int y1, y2;
+} SearchMatch;
+
+typedef struct {
+    // The text of the logical line being searched and the cell of every char
+    char_type *text;
+    index_type *x1s, *x2s;
+    int *ys;
+    size_t len, capacity;
+    SearchMatch *matches;
+    size_t num_matches, matches_capacity;
+} SearchState;
+
+static inline bool
+is_line_continued(Screen *self, int y) {
+    if (y < 0) return historybuf_is_continued(self->historybuf, -y - 1);
+    return self->linebuf->line_attrs[y] & CONTINUED_MASK ? true : false;
+}
+
+static bool
+append_search_text(Screen *self, SearchState *st, int y) {
+    // History lines are not expanded to their full width
+    const Cell *cells;
+    index_type xlimit;
+    if (y < 0) cells = historybuf_text_cells(self->historybuf, -y - 1, &xlimit);
+    else {
+        Line *line = selection_line(self, y);
+        cells = line->cells; xlimit = xlimit_for_line(line);
+    }
+    size_t needed = st->len + (size_t)xlimit * (MAX_NUM_COMBINING_CHARS + 1);
+    if (needed > st->capacity) {
+        size_t capacity = MAX(st->capacity * 2, needed);
+#define R(field) { void *p = PyMem_Realloc(st->field, capacity * sizeof(st->field[0])); if (p == NULL) { PyErr_NoMemory(); return false; } st->field = p; }
+        R(text); R(x1s); R(x2s); R(ys);
+#undef R
+        st->capacity = capacity;
+    }
+    index_type n = search_text_for_cells(cells, xlimit, st->text + st->len, st->x1s + st->len);
+    for (size_t i = st->len; i < st->len + n; i++) {
+        st->ys[i] = y;
+        st->x2s[i] = st->x1s[i] + ((cells[st->x1s[i]].attrs & WIDTH_MASK) == 2 ? 1 : 0);
+    }
+    st->len += n;
+    return true;
+}
+
+static bool
+add_search_match(SearchState *st, size_t start, size_t end) {
+    if (st->num_matches >= st->matches_capacity) {
+        size_t capacity = MAX(64u, st->matches_capacity * 2);
+        SearchMatch *m = PyMem_Realloc(st->matches, capacity * sizeof(SearchMatch));
+        if (m == NULL) { PyErr_NoMemory(); return false; }
+        st->matches = m; st->matches_capacity = capacity;
+    }
+    st->matches[st->num_matches++] = (SearchMatch){.x1=st->x1s[start], .y1=st->ys[start], .x2=st->x2s[end - 1], .y2=st->ys[end - 1]};
+    return true;
+}
+
+static bool
+find_matches(SearchState *st, const char_type *query, size_t qlen, PyObject *matcher) {
+    if (matcher == Py_None) {
+        for (size_t i = 0; i + qlen <= st->len;) {
+            if (st->text[i] == query[0] && memcmp(st->text + i, query, qlen * sizeof(char_type)) == 0) {
+                if (!add_search_match(st, i, i + qlen)) return false;
+                i += qlen;
+            } else i++;
+        }
+        return true;
+    }
+    PyObject *text = PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, st->text, st->len);
+    if (text == NULL) return false;
+    PyObject *spans = PyObject_CallFunctionObjArgs(matcher, text, NULL);
+    Py_DECREF(text);
+    if (spans == NULL) return false;
+    PyObject *seq = PySequence_Fast(spans, "matcher must return a sequence of (start, end) spans");
+    Py_DECREF(spans);
+    if (seq == NULL) return false;
+    bool ok = true;
+    for (Py_ssize_t i = 0; ok && i < PySequence_Fast_GET_SIZE(seq); i++) {
+        Py_ssize_t start, end;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i), "nn", &start, &end)) { ok = false; break; }
+        if (start < 0 || end > (Py_ssize_t)st->len || start > end) { PyErr_SetString(PyExc_ValueError, "Span returned by matcher is out of bounds"); ok = false; break; }
+        if (start < end) ok = add_search_match(st, start, end);
+    }
+    Py_DECREF(seq);
+    return ok;
+}
+
+static inline bool
+text_contains(SearchState *st, const char_type *q, size_t qlen, bool fold) {
+    for (size_t i = 0; i + qlen <= st->len; i++) {
+        size_t j = 0;
+        while (j < qlen && (fold ? search_fold_char(st->text[i + j]) : st->text[i + j]) == q[j]) j++;
+        if (j == qlen) return true;
+    }
+    return false;
+}
+
+static PyObject*
+search(Screen *self, PyObject *args) {
+#define search_doc "search(literals, case_sensitive, matcher=None, limit=0) -> The matches in the screen and its scrollback as a list of (x1, y1, x2, y2) cell ranges, from top to bottom. y is relative to the top of the screen when it is not scrolled, negative numbers are lines in the scrollback, the same as for selections. literals is a tuple of strings that every match contains, used to skip lines. matcher is called with the text of every logical line that can match and must return the (start, end) spans of the matches in it. If it is None, the first literal is searched for, case sensitively. If limit is not zero, only the limit matches closest to the bottom are returned."
+    PyObject *literals, *matcher = Py_None, *ans = NULL;
+    int case_sensitive;
+    unsigned int limit = 0;
+    if (!PyArg_ParseTuple(args, "O!p|OI", &PyTuple_Type, &literals, &case_sensitive, &matcher, &limit)) return NULL;
+    Py_ssize_t num_literals = PyTuple_GET_SIZE(literals);
+    if (matcher == Py_None && (num_literals < 1 || !PyUnicode_Check(PyTuple_GET_ITEM(literals, 0)) || !PyUnicode_GET_LENGTH(PyTuple_GET_ITEM(literals, 0)))) {
+        PyErr_SetString(PyExc_ValueError, "A non-empty literal is needed when there is no matcher"); return NULL;
+    }
+    historybuf_materialize(self->historybuf, UINT_MAX);
+    SearchState st = {0};
+    uint32_t *bits = NULL;
+    index_type num_bits = 0;
+    // The literals that a logical line must contain to be passed to the
+    // matcher, case folded when ignoring case
+    Py_UCS4 **chars = PyMem_Calloc(num_literals + 1, sizeof(Py_UCS4*));
+    size_t *lengths = PyMem_Calloc(num_literals + 1, sizeof(size_t));
+    if (chars == NULL || lengths == NULL) { PyErr_NoMemory(); goto end; }
+    for (Py_ssize_t i = 0; i < num_literals; i++) {
+        PyObject *lit = PyTuple_GET_ITEM(literals, i);
+        if (!PyUnicode_Check(lit)) { PyErr_SetString(PyExc_TypeError, "literals must be strings"); goto end; }
+        if ((chars[i] = PyUnicode_AsUCS4Copy(lit)) == NULL) goto end;
+        lengths[i] = PyUnicode_GET_LENGTH(lit);
+        uint32_t *b = PyMem_Realloc(bits, (num_bits + lengths[i] + 1) * sizeof(uint32_t));
+        if (b == NULL) { PyErr_NoMemory(); goto end; }
+        bits = b;
+        num_bits += historybuf_trigram_bits(chars[i], lengths[i], case_sensitive, bits + num_bits);
+        if (!case_sensitive && matcher != Py_None) {
+            for (size_t c = 0; c < lengths[i]; c++) {
+                // Chars other than ASCII can match chars that fold differently
+                if (chars[i][c] > 127) { lengths[i] = 0; break; }
+                chars[i][c] = search_fold_char(chars[i][c]);
+            }
+        }
+    }
+    int min_y = self->linebuf == self->main_linebuf ? -(int)self->historybuf->count : 0;
+    for (int y = self->lines - 1; y >= min_y && (!limit || st.num_matches < limit);) {
+        int start = y;
+        while (start > min_y && is_line_continued(self, start)) start--;
+        if (y < 0 && !historybuf_lines_may_contain(self->historybuf, -y - 1, -start - 1, bits, num_bits)) {
+            // Skip the rest of the segment, except for the logical line continued from the previous segment
+            int oldest = -(int)historybuf_oldest_in_segment(self->historybuf, -y - 1) - 1;
+            if (oldest < start) {
+                y = oldest;
+                while (y + 1 < start && is_line_continued(self, y + 1)) y++;
+            } else y = start - 1;
+            continue;
+        }
+        st.len = 0;
+        for (int i = start; i <= y; i++) { if (!append_search_text(self, &st, i)) goto end; }
+        bool possible = true;
+        for (Py_ssize_t i = 0; possible && matcher != Py_None && i < num_literals; i++) {
+            if (lengths[i]) possible = text_contains(&st, chars[i], lengths[i], !case_sensitive);
+        }
+        if (possible) {
+            size_t first = st.num_matches;
+            if (!find_matches(&st, chars[0], lengths[0], matcher)) goto end;
+            // Matches are collected from the bottom up
+            for (size_t a = first, b = st.num_matches; b-- > a + 1; a++) {
+                SearchMatch t = st.matches[a]; st.matches[a] = st.matches[b]; st.matches[b] = t;
+            }
+        }
+        y = start - 1;
+    }
+    if (limit) st.num_matches = MIN(st.num_matches, limit);
+    ans = PyList_New(st.num_matches);
+    if (ans == NULL) goto end;
+    for (size_t i = 0; i < st.num_matches; i++) {
+        SearchMatch *m = st.matches + st.num_matches - 1 - i;
+        PyObject *t = Py_BuildValue("IiIi", m->x1, m->y1, m->x2, m->y2);
+        if (t == NULL) { Py_CLEAR(ans); goto end; }
+        PyList_SET_ITEM(ans, i, t);
+    }
+end:
+    if (chars) { for (Py_ssize_t i = 0; i < num_literals; i++) PyMem_Free(chars[i]); }
+    PyMem_Free(chars); PyMem_Free(lengths); PyMem_Free(bits);
+    PyMem_Free(st.text); PyMem_Free(st.x1s); PyMem_Free(st.x2s); PyMem_Free(st.ys); PyMem_Free(st.matches);
+    return ans;
+}
+
+static void
+screen_select_range(Screen *self, index_type x1, int y1, index_type x2, int y2) {
+    int top = -(int)self->scrolled_by, max_scroll = self->linebuf == self->main_linebuf ? (int)self->historybuf->count : 0;
+    if (y1 < top || y2 >= top + (int)self->lines) {
+        unsigned int scrolled_by = MAX(0, MIN((int)self->lines / 2 - y1, max_scroll));
+        if (scrolled_by != self->scrolled_by) { self->scrolled_by = scrolled_by; self->scroll_changed = true; }
+    }
+    screen_start_selection(self, x1, MAX(0, y1 + (int)self->scrolled_by));
+    screen_update_selection(self, x2, MAX(0, y2 + (int)self->scrolled_by), true);
+}
+
+static PyObject*
+select_range(Screen *self, PyObject *args) {
+#define select_range_doc "select_range(x1, y1, x2, y2) -> Select the cells from (x1, y1) to (x2, y2), as returned by search(), scrolling so that the start of the range is in the middle of the screen if the range is not visible"
+    unsigned int x1, x2;
+    int y1, y2;
+    if (!PyArg_ParseTuple(args, "IiIi", &x1, &y1, &x2, &y2)) return NULL;
+    screen_select_range(self, x1, y1, x2, y2);
+    Py_RETURN_NONE;
+}
+
+// }}}
+
+// Shell integration marks {{{
+// Shells mark where their prompts and the output of commands start with
+// OSC 133, the marks are kept in the attributes of the lines, see history.c
+// for how they are found in the scrollback.
+
+void
+shell_prompt_marking(Screen *self, PyObject *data) {
+    if (PyUnicode_READY(data) != 0) { PyErr_Clear(); return; }
+    if (!PyUnicode_GET_LENGTH(data)) return;
+    switch (PyUnicode_READ_CHAR(data, 0)) {
+        case 'A':
+            self->linebuf->line_attrs[self->cursor->y] |= PROMPT_START_MASK; break;
+        case 'C':
+            self->linebuf->line_attrs[self->cursor->y] |= OUTPUT_START_MASK; break;
+    }
+}
+
+static bool
+find_mark(Screen *self, int y, bool up, line_attrs_type mask, int *ans) {
+    // Find the nearest line above (or below) y that has a mark in mask. y and
+    // ans are relative to the top of the screen when it is not scrolled.
+    bool has_history = self->linebuf == self->main_linebuf;
+    if (up) {
+        for (int i = MIN(y, (int)self->lines) - 1; i >= 0; i--) {
+            if (self->linebuf->line_attrs[i] & mask) { *ans = i; return true; }
+        }
+        return has_history && historybuf_find_mark(self->historybuf, MIN(y, 0), true, mask, ans);
+    }
+    if (has_history && y < -1 && historybuf_find_mark(self->historybuf, y, false, mask, ans) && *ans < 0) return true;
+    for (int i = MAX(y + 1, 0); i < (int)self->lines; i++) {
+        if (self->linebuf->line_attrs[i] & mask) { *ans = i; return true; }
+    }
+    return false;
+}
+
+bool
+screen_scroll_to_prompt(Screen *self, int num) {
+    // Scroll so that the num-th prompt above (num < 0) or below (num > 0) the
+    // top of the screen is at the top of the screen
+    if (self->linebuf != self->main_linebuf || !num) return false;
+    int y = -(int)self->scrolled_by;
+    while (num && find_mark(self, y, num < 0, PROMPT_START_MASK, &y)) num += num < 0 ? 1 : -1;
+    unsigned int scrolled_by = MAX(0, -y);
+    if (scrolled_by == self->scrolled_by) return false;
+    self->scrolled_by = scrolled_by;
+    self->scroll_changed = true;
+    return true;
+}
+
+bool
+screen_select_last_command_output(Screen *self) {
+    // Select the output of the last command, up to the prompt after it, or
+    // the cursor if the command has not finished yet
+    int start, end;
+    if (!find_mark(self, self->cursor->y + 1, true, OUTPUT_START_MASK, &start)) return false;
+    // A prompt on the line the output starts on means the output is empty
+    if (find_mark(self, start - 1, false, PROMPT_START_MASK, &end)) end--;
+    else end = self->cursor->x ? (int)self->cursor->y : (int)self->cursor->y - 1;
+    if (end < start) return false;
+    screen_select_range(self, 0, start, self->columns - 1, end);
+    return true;
+}
+
+static PyObject*
+scroll_to_prompt(Screen *self, PyObject *args) {
+#define scroll_to_prompt_doc "scroll_to_prompt(num) -> Scroll to the num-th prompt above (num < 0) or below the top of the screen, returns True if the screen was scrolled"
+    int num;
+    if (!PyArg_ParseTuple(args, "i", &num)) return NULL;
+    if (screen_scroll_to_prompt(self, num)) { Py_RETURN_TRUE; }
+    Py_RETURN_FALSE;
+}
+
+static PyObject*
+select_last_command_output(Screen *self) {
+#define select_last_command_output_doc "select_last_command_output() -> Select the output of the last command, returns False if there is none"
+    if (screen_select_last_command_output(self)) { Py_RETURN_TRUE; }
+    Py_RETURN_FALSE;
+}
+
+// }}}
+
+// Latency tracking {{{
+
+static const char* latency_stage_names[NUM_LATENCIES] = {"input_to_write", "read_to_parse", "parse_to_present", "key_to_echo"};
+static const struct { const char *name; double fraction; } latency_percentiles[] = {
+    {"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}
+};
+
+PyObject*
+latency_histogram_stats(LatencyHistogram *h) {
+    // Latencies are in seconds, a percentile is the upper limit of the bucket it falls in
+    uint64_t counts[LATENCY_NUM_BUCKETS], total = 0;
+    for (unsigned int i = 0; i < LATENCY_NUM_BUCKETS; i++) total += (counts[i] = __atomic_load_n(h->counts + i, __ATOMIC_RELAXED));
+    uint64_t sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED), max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    PyObject *buckets = PyList_New(0);
+    PyObject *ans = Py_BuildValue("{sK sd sd}", "count", total, "mean", total ? sum / (double)total / 1e6 : 0., "max", max / 1e6);
+    if (buckets == NULL || ans == NULL) goto error;
+    size_t p = 0, num_percentiles = sizeof(latency_percentiles) / sizeof(latency_percentiles[0]);
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        if (!counts[i]) continue;
+        seen += counts[i];
+        double limit = latency_bucket_limit(i) / 1e6;
+        for (; p < num_percentiles && seen >= latency_percentiles[p].fraction * total; p++) {
+            PyObject *val = PyFloat_FromDouble(MIN(limit, max / 1e6));
+            if (val == NULL || PyDict_SetItemString(ans, latency_percentiles[p].name, val) != 0) { Py_XDECREF(val); goto error; }
+            Py_DECREF(val);
+        }
+        PyObject *bucket = Py_BuildValue("dK", limit, counts[i]);
+        if (bucket == NULL || PyList_Append(buckets, bucket) != 0) { Py_XDECREF(bucket); goto error; }
+        Py_DECREF(bucket);
+    }
+    for (; p < num_percentiles; p++) {
+        if (PyDict_SetItemString(ans, latency_percentiles[p].name, Py_None) != 0) goto error;
+    }
+    if (PyDict_SetItemString(ans, "buckets", buckets) != 0) goto error;
+    Py_DECREF(buckets);
+    return ans;
+error:
+    Py_XDECREF(buckets); Py_XDECREF(ans);
+    return NULL;
+}
+
+static PyObject*
+latency_stats(Screen *self) {
+#define latency_stats_doc "latency_stats() -> Histograms of the latencies of the stages from a key press to its echo being presented, or None if the screen does not track its latency. Each has the count, mean, max and percentiles, in seconds, and its non-empty buckets as (upper limit, count)"
+    if (self->latency == NULL) Py_RETURN_NONE;
+    PyObject *ans = PyDict_New();
+    if (ans == NULL) return NULL;
+    for (int i = 0; i < NUM_LATENCIES; i++) {
+        PyObject *h = latency_histogram_stats(self->latency->histograms + i);
+        if (h == NULL || PyDict_SetItemString(ans, latency_stage_names[i], h) != 0) { Py_XDECREF(h); Py_DECREF(ans); return NULL; }
+        Py_DECREF(h);
+    }
+    return ans;
+}
+
+// }}}
+
 static PyObject* 
 mark_as_dirty(Screen *self) {
     self->is_dirty = true;
@@ -1626,7 +2184,14 @@ static PyMethodDef methods[] = {
     MND(resize, METH_VARARGS)
     MND(set_margins, METH_VARARGS)
     MND(rescale_images, METH_VARARGS)
-    MND(text_for_selection, METH_NOARGS)
+    METHOD(text_for_selection, METH_VARARGS)
+    MND(start_selection, METH_VARARGS)
+    MND(update_selection, METH_VARARGS)
+    METHOD(search, METH_VARARGS)
+    METHOD(select_range, METH_VARARGS)
+    METHOD(scroll_to_prompt, METH_VARARGS)
+    METHOD(select_last_command_output, METH_NOARGS)
+    METHOD(latency_stats, METH_NOARGS)
     MND(scroll, METH_VARARGS)
     MND(toggle_alt_screen, METH_NOARGS)
     MND(reset_callbacks, METH_NOARGS)
@@ -1642,6 +2207,7 @@ static PyGetSetDef getsetters[] = {
     GETSET(focus_tracking_enabled)
     GETSET(cursor_visible)
     GETSET(cursor_key_mode)
+    GETSET(update_pending)
     {NULL}  /* Sentinel */
 };
 
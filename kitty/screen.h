@@ -7,12 +7,17 @@
 #pragma once
 
 #include "graphics.h"
+#include "ring.h"
+#include "latency.h"
 
 typedef enum ScrollTypes { SCROLL_LINE = -999999, SCROLL_PAGE, SCROLL_FULL } ScrollType;
 
+// The maximum time (in secs) rendering is suspended for by the PENDING_UPDATE mode
+#define PENDING_UPDATE_TIMEOUT 1.0
+
 typedef struct {
     bool mLNM, mIRM, mDECTCEM, mDECSCNM, mDECOM, mDECAWM, mDECCOLM, mDECARM, mDECCKM,
-         mBRACKETED_PASTE, mFOCUS_TRACKING, mEXTENDED_KEYBOARD;
+         mBRACKETED_PASTE, mFOCUS_TRACKING, mEXTENDED_KEYBOARD, mPENDING_UPDATE;
     MouseTrackingMode mouse_tracking_mode;
     MouseTrackingProtocol mouse_tracking_protocol;
 } ScreenModes;
@@ -25,6 +30,40 @@ typedef struct {
     unsigned int start_x, start_y, start_scrolled_by, end_x, end_y, end_scrolled_by;
     bool in_progress;
 } Selection;
+
+typedef struct {
+    // The selected cells of a row, and the end of the text of the line shown
+    // in it, as of the last upload of the cell data
+    index_type x, x_limit, line_limit;
+} SelectionSpan;
+
+typedef struct {
+    // What was last uploaded for drawing the screen. A screen in the middle of
+    // a synchronized update is drawn from this, not from its contents.
+    float xstart, ystart, dx, dy;
+    index_type lines, columns;
+    ImageRenderData *images;
+    size_t num_images, images_capacity, num_of_negative_refs, num_of_positive_refs;
+} RenderedFrame;
+
+typedef struct WriteSegment {
+    struct WriteSegment *next;
+    // The python object whose buffer data points into, or NULL if data is
+    // owned by the segment, in which case it has space for capacity bytes
+    PyObject *owner;
+    uint8_t *data;
+    size_t sz, capacity;
+} WriteSegment;
+
+typedef struct {
+    // The segments of data waiting to be written to the child, the first
+    // offset bytes of head have already been written
+    WriteSegment *head, *tail, *done;
+    size_t offset, queued;
+    // The fd of the child, -1 if the screen has no child
+    int fd;
+    unsigned long child_id;
+} WriteQueue;
     
 typedef struct {
     PyObject_HEAD
@@ -33,33 +72,64 @@ typedef struct {
     uint32_t utf8_state, utf8_codepoint, *g0_charset, *g1_charset, *g_charset;
     Selection selection;
     SelectionBoundary last_rendered_selection_start, last_rendered_selection_end;
+    // The selected cells in each line, as last written to the selection buffer
+    SelectionSpan *rendered_selection;
+    RenderedFrame rendered_frame;
     Selection url_range;
     bool use_latin1, selection_updated_once, is_dirty, scroll_changed;
+    // Set when the lines shown in the rows of the screen have changed since
+    // the selection was last applied
+    bool rendered_lines_changed;
     Cursor *cursor;
     SavepointBuffer main_savepoints, alt_savepoints;
     PyObject *callbacks, *test_child;
     LineBuf *linebuf, *main_linebuf, *alt_linebuf;
     GraphicsManager *grman, *main_grman, *alt_grman;
     HistoryBuf *historybuf;
-    unsigned int history_line_added_count;
+    unsigned int history_line_added_count, jump_scroll_lines;
     bool *tabstops, *main_tabstops, *alt_tabstops;
     ScreenModes modes;
     ColorProfile *color_profile;
-    double start_visual_bell_at;
+    double start_visual_bell_at, start_pending_update_at;
 
     uint32_t parser_buf[PARSER_BUF_SZ];
     unsigned int parser_state, parser_text_start, parser_buf_pos;
     bool parser_has_pending_text;
-    uint8_t read_buf[READ_BUF_SZ], *write_buf;
+    // Input from the child, written by the I/O thread of its worker and
+    // parsed in place by the main thread. A child only moves to a different
+    // worker with children_lock held, so the ring always has a single
+    // producer. read_buf_lock only guards the fields below it that describe
+    // the input, not the data in the ring.
+    uint8_t read_buf[READ_BUF_SZ];
+    ByteRing read_ring;
     double new_input_at;
-    size_t read_buf_sz, write_buf_sz, write_buf_used;
+    // Input for windows that are not visible is parsed in larger batches,
+    // unless it contains a query the terminal must respond to
+    bool throttle_parsing, has_pending_query;
+    // Whether the window is in the active tab and not hidden, computed by the
+    // main thread once per tick
+    bool is_visible;
+    // Set by the I/O thread when it stops reading because read_ring holds
+    // read_limit bytes, which the main thread lowers for unfocused windows
+    bool read_stalled;
+    size_t read_limit;
     pthread_mutex_t read_buf_lock, write_buf_lock;
+    // Output to the child, guarded by write_buf_lock. Segments that reference
+    // python objects are moved to done once written, since the I/O thread
+    // cannot release them.
+    WriteQueue write_queue;
+    // Only allocated for screens created while latency tracking is enabled
+    LatencyTracker *latency;
 
 } Screen;
 
 
-void parse_worker(Screen *screen, PyObject *dump_callback);
-void parse_worker_dump(Screen *screen, PyObject *dump_callback);
+void parse_worker(Screen *screen, uint8_t *buf, size_t sz, PyObject *dump_callback);
+bool schedule_write_to_child(Screen *screen, const char *data, size_t sz);
+bool schedule_key_write_to_child(Screen *screen, const char *data, size_t sz);
+PyObject* latency_histogram_stats(LatencyHistogram *h);
+void free_write_queue(WriteQueue *q);
+void parse_worker_dump(Screen *screen, uint8_t *buf, size_t sz, PyObject *dump_callback);
 void screen_align(Screen*);
 void screen_restore_cursor(Screen *);
 void screen_save_cursor(Screen *);
@@ -104,6 +174,7 @@ void screen_designate_charset(Screen *, uint32_t which, uint32_t as);
 void screen_use_latin1(Screen *, bool);
 void set_title(Screen *self, PyObject*);
 void set_icon(Screen *self, PyObject*);
+void shell_prompt_marking(Screen *self, PyObject*);
 void set_dynamic_color(Screen *self, unsigned int code, PyObject*);
 void set_color_table_color(Screen *self, unsigned int code, PyObject*);
 uint32_t* translation_table(uint32_t which);
@@ -113,15 +184,19 @@ void select_graphic_rendition(Screen *self, unsigned int *params, unsigned int c
 void report_device_status(Screen *self, unsigned int which, bool UNUSED);
 void report_mode_status(Screen *self, unsigned int which, bool);
 void screen_apply_selection(Screen *self, void *address, size_t size);
+bool screen_selection_buffer_needs_realloc(Screen *self);
 bool screen_is_selection_dirty(Screen *self);
 bool screen_invert_colors(Screen *self);
 void screen_update_cell_data(Screen *self, void *address, size_t sz);
 bool screen_is_cursor_visible(Screen *self);
+bool screen_is_update_pending(Screen *self, double now, double *time_left);
 bool screen_selection_range_for_line(Screen *self, index_type y, index_type *start, index_type *end);
 bool screen_selection_range_for_word(Screen *self, index_type x, index_type y, index_type *start, index_type *end);
 void screen_start_selection(Screen *self, index_type x, index_type y);
 void screen_update_selection(Screen *self, index_type x, index_type y, bool ended);
 bool screen_history_scroll(Screen *self, int amt, bool upwards);
+bool screen_scroll_to_prompt(Screen *self, int num);
+bool screen_select_last_command_output(Screen *self);
 Line* screen_visual_line(Screen *self, index_type y);
 unsigned long screen_current_char_width(Screen *self);
 void screen_url_range(Screen *self, uint32_t *);
@@ -0,0 +1,53 @@
+#!/usr/bin/env python
+# vim:fileencoding=utf-8
+# License: GPL v3 Copyright: 2017, Kovid Goyal <kovid at kovidgoyal.net>
+
+import re
+
+try:
+    import re._parser as sre_parse
+    from re._constants import LITERAL
+except ImportError:
+    import sre_parse
+    from sre_constants import LITERAL
+
+
+def required_literals(pat):
+    ' The runs of literal chars that every match of the compiled regex pat contains '
+    try:
+        parsed = sre_parse.parse(pat.pattern, pat.flags)
+    except Exception:
+        return ()
+    ans, current = [], []
+    for op, av in parsed:
+        if op == LITERAL:
+            current.append(chr(av))
+            continue
+        if current:
+            ans.append(''.join(current))
+            current = []
+    if current:
+        ans.append(''.join(current))
+    return tuple(ans)
+
+
+def search(screen, query, regex=False, case_sensitive=True, limit=0):
+    '''
+    Find query in the screen and its scrollback. Returns a list of (x1, y1,
+    x2, y2) cell ranges, from top to bottom, that can be passed to
+    screen.select_range(). If limit is not zero, only the limit matches
+    closest to the bottom are returned.
+    '''
+    if not query:
+        return []
+    if not regex and case_sensitive:
+        return screen.search((query,), True, None, limit)
+    pat = re.compile(query if regex else re.escape(query), 0 if case_sensitive else re.IGNORECASE)
+    literals = required_literals(pat)
+    if pat.flags & re.IGNORECASE:
+        case_sensitive = False
+
+    def matcher(text):
+        return [m.span() for m in pat.finditer(text)]
+
+    return screen.search(literals, case_sensitive, matcher, limit)
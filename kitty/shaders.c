@@ -263,20 +263,33 @@ cell_prepare_to_render(ssize_t vao_idx, ssize_t gvao_idx, Screen *screen, GLfloa
 
     if (screen_is_selection_dirty(screen)) {
         sz = sizeof(GLfloat) * screen->lines * screen->columns;
-        address = alloc_and_map_vao_buffer(vao_idx, sz, selection_buffer, GL_STREAM_DRAW, GL_WRITE_ONLY);
+        // Re-use the existing buffer contents when possible, so that only the changed lines are written
+        if (screen_selection_buffer_needs_realloc(screen)) address = alloc_and_map_vao_buffer(vao_idx, sz, selection_buffer, GL_STREAM_DRAW, GL_WRITE_ONLY);
+        else address = map_vao_buffer(vao_idx, selection_buffer, GL_WRITE_ONLY);
         screen_apply_selection(screen, address, sz);
         unmap_vao_buffer(vao_idx, selection_buffer); address = NULL;
     }
 
+    RenderedFrame *f = &screen->rendered_frame;
     if (gvao_idx && grman_update_layers(screen->grman, screen->scrolled_by, xstart, ystart, dx, dy, screen->columns, screen->lines)) {
-        sz = sizeof(GLfloat) * 16 * screen->grman->count;
+        GraphicsManager *g = screen->grman;
+        sz = sizeof(GLfloat) * 16 * g->count;
         GLfloat *a = alloc_and_map_vao_buffer(gvao_idx, sz, 0, GL_STREAM_DRAW, GL_WRITE_ONLY);
-        for (size_t i = 0; i < screen->grman->count; i++, a += 16) memcpy(a, screen->grman->render_data[i].vertices, sizeof(screen->grman->render_data[0].vertices));
+        for (size_t i = 0; i < g->count; i++, a += 16) memcpy(a, g->render_data[i].vertices, sizeof(g->render_data[0].vertices));
         unmap_vao_buffer(gvao_idx, 0); a = NULL;
+        ensure_space_for(f, images, ImageRenderData, g->count, images_capacity, 16, false);
+        if (g->count) memcpy(f->images, g->render_data, sizeof(ImageRenderData) * g->count);
+        f->num_images = g->count; f->num_of_negative_refs = g->num_of_negative_refs; f->num_of_positive_refs = g->num_of_positive_refs;
     }
 
     cell_update_uniform_block(vao_idx, screen, uniform_buffer, xstart, ystart, dx, dy, cursor);
+    f->xstart = xstart; f->ystart = ystart; f->dx = dx; f->dy = dy;
+    f->lines = screen->lines; f->columns = screen->columns;
+}
 
+static inline void
+bind_cell_buffers(ssize_t vao_idx) {
+    CELL_BUFFERS;
     bind_vao_uniform_buffer(vao_idx, uniform_buffer, cell_program_layouts[CELL_PROGRAM].render_data.index);
     bind_vertex_array(vao_idx);
 }
@@ -308,48 +321,64 @@ draw_graphics(ssize_t vao_idx, ssize_t gvao_idx, ImageRenderData *data, GLuint s
 }
 
 static void
-draw_all_cells(ssize_t vao_idx, ssize_t gvao_idx, Screen *screen) {
+draw_all_cells(ssize_t vao_idx, ssize_t gvao_idx, const RenderedFrame *f) {
     bind_program(CELL_PROGRAM); 
     static bool cell_constants_set = false;
     if (!cell_constants_set) { 
         glUniform1i(glGetUniformLocation(program_id(CELL_PROGRAM), "sprites"), SPRITE_MAP_UNIT);  
         cell_constants_set = true; 
     }
-    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, screen->lines * screen->columns); 
-    if (screen->grman->count) draw_graphics(vao_idx, gvao_idx, screen->grman->render_data, 0, screen->grman->count);
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, f->lines * f->columns); 
+    if (f->num_images) draw_graphics(vao_idx, gvao_idx, f->images, 0, f->num_images);
 }
 
 static void
-draw_cells_interleaved(ssize_t vao_idx, ssize_t gvao_idx, Screen *screen) {
+draw_cells_interleaved(ssize_t vao_idx, ssize_t gvao_idx, const RenderedFrame *f) {
     bind_program(CELL_BACKGROUND_PROGRAM); 
-    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, screen->lines * screen->columns); 
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, f->lines * f->columns); 
 
-    if (screen->grman->num_of_negative_refs) draw_graphics(vao_idx, gvao_idx, screen->grman->render_data, 0, screen->grman->num_of_negative_refs);
+    if (f->num_of_negative_refs) draw_graphics(vao_idx, gvao_idx, f->images, 0, f->num_of_negative_refs);
 
     bind_program(CELL_SPECIAL_PROGRAM); 
-    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, screen->lines * screen->columns); 
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, f->lines * f->columns); 
 
     bind_program(CELL_FOREGROUND_PROGRAM); 
     glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, screen->lines * screen->columns); 
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, f->lines * f->columns); 
 
-    if (screen->grman->num_of_positive_refs) draw_graphics(vao_idx, gvao_idx, screen->grman->render_data, screen->grman->num_of_negative_refs, screen->grman->num_of_positive_refs);
+    if (f->num_of_positive_refs) draw_graphics(vao_idx, gvao_idx, f->images, f->num_of_negative_refs, f->num_of_positive_refs);
 }
 
-void 
-draw_cells(ssize_t vao_idx, ssize_t gvao_idx, GLfloat xstart, GLfloat ystart, GLfloat dx, GLfloat dy, Screen *screen, CursorRenderInfo *cursor) {
-    GLfloat h = (GLfloat)screen->lines * dy;
+static void
+draw_frame(ssize_t vao_idx, ssize_t gvao_idx, const RenderedFrame *f) {
+    GLfloat h = (GLfloat)f->lines * f->dy;
 #define SCALE(w, x) ((GLfloat)(global_state.viewport_##w) * (GLfloat)(x))
     glScissor(
-            (GLint)(SCALE(width, (xstart + 1.0f) / 2.0f)), 
-            (GLint)(SCALE(height, ((ystart - h) + 1.0f) / 2.0f)),
-            (GLsizei)(ceilf(SCALE(width, (float)screen->columns * dx / 2.0f))),
+            (GLint)(SCALE(width, (f->xstart + 1.0f) / 2.0f)), 
+            (GLint)(SCALE(height, ((f->ystart - h) + 1.0f) / 2.0f)) + viewport_y,
+            (GLsizei)(ceilf(SCALE(width, (float)f->columns * f->dx / 2.0f))),
             (GLsizei)(ceilf(SCALE(height, h / 2.0f)))
     );
 #undef SCALE
+    bind_cell_buffers(vao_idx);
+    if (f->num_of_negative_refs) draw_cells_interleaved(vao_idx, gvao_idx, f);
+    else draw_all_cells(vao_idx, gvao_idx, f);
+}
+
+void 
+draw_cells(ssize_t vao_idx, ssize_t gvao_idx, GLfloat xstart, GLfloat ystart, GLfloat dx, GLfloat dy, Screen *screen, CursorRenderInfo *cursor) {
     cell_prepare_to_render(vao_idx, gvao_idx, screen, xstart, ystart, dx, dy, cursor);
-    if (screen->grman->num_of_negative_refs) draw_cells_interleaved(vao_idx, gvao_idx, screen);
-    else draw_all_cells(vao_idx, gvao_idx, screen);
+    draw_frame(vao_idx, gvao_idx, &screen->rendered_frame);
+}
+
+void
+draw_rendered_frame(ssize_t vao_idx, ssize_t gvao_idx, Screen *screen) {
+    // Draw the screen as it was last uploaded, without uploading any of its
+    // cells, selection, graphics or uniforms, since the back buffer is not
+    // preserved between frames
+    if (!screen->rendered_frame.lines) return;
+    ensure_sprite_map();
+    draw_frame(vao_idx, gvao_idx, &screen->rendered_frame);
 }
 // }}}
 
@@ -11,18 +11,15 @@ GlobalState global_state = {{0}};
 static const Tab EMPTY_TAB = {0};
 static const Window EMPTY_WINDOW = {0};
 
-#define ensure_can_add(array, count, msg) if (count >= sizeof(array)/sizeof(array[0]) - 1) fatal(msg);
-
-#define noop(...)
 #define REMOVER(array, qid, count, empty, structure, destroy) { \
-    size_t capacity = sizeof(array)/sizeof(array[0]); \
     for (size_t i = 0; i < count; i++) { \
         if (array[i].id == qid) { \
             destroy(array[i]); \
-            array[i] = empty; \
-            size_t num_to_right = capacity - count - 1; \
+            size_t num_to_right = count - i - 1; \
             if (num_to_right) memmove(array + i, array + i + 1, num_to_right * sizeof(structure)); \
             (count)--; \
+            array[count] = empty; \
+            break; \
         } \
     }} 
 #define WITH_TAB(tab_id) \
@@ -33,7 +30,7 @@ static const Window EMPTY_WINDOW = {0};
 
 static inline void
 add_tab(unsigned int id) {
-    ensure_can_add(global_state.tabs, global_state.num_tabs, "Too many children (add_tab)");
+    ensure_space_for(&global_state, tabs, Tab, global_state.num_tabs + 1, capacity, 1, true);
     global_state.tabs[global_state.num_tabs] = EMPTY_TAB;
     global_state.tabs[global_state.num_tabs].id = id;
     global_state.num_tabs++;
@@ -42,7 +39,7 @@ add_tab(unsigned int id) {
 static inline void
 add_window(unsigned int tab_id, unsigned int id, PyObject *title) {
     WITH_TAB(tab_id);
-    ensure_can_add(tab->windows, tab->num_windows, "Too many children (add_window)");
+    ensure_space_for(tab, windows, Window, tab->num_windows + 1, capacity, 1, true);
     tab->windows[tab->num_windows] = EMPTY_WINDOW;
     tab->windows[tab->num_windows].id = id;
     tab->windows[tab->num_windows].visible = true;
@@ -66,17 +63,26 @@ update_window_title(unsigned int tab_id, unsigned int window_id, PyObject *title
     END_WITH_TAB;
 }
 
+#define destroy_window(w) Py_CLEAR(w.render_data.screen); Py_CLEAR(w.title);
+
+static inline void
+destroy_tab(Tab *tab) {
+    for (size_t i = 0; i < tab->num_windows; i++) { destroy_window(tab->windows[i]); }
+    free(tab->windows);
+    *tab = EMPTY_TAB;
+}
+
 static inline void
 remove_tab(unsigned int id) {
-    REMOVER(global_state.tabs, id, global_state.num_tabs, EMPTY_TAB, Tab, noop);
+#define destroy(t) destroy_tab(&t)
+    REMOVER(global_state.tabs, id, global_state.num_tabs, EMPTY_TAB, Tab, destroy);
+#undef destroy
 }
 
 static inline void
 remove_window(unsigned int tab_id, unsigned int id) {
     WITH_TAB(tab_id);
-#define destroy_window(w) Py_CLEAR(w.render_data.screen); Py_CLEAR(w.title);
     REMOVER(tab->windows, id, tab->num_windows, EMPTY_WINDOW, Window, destroy_window);
-#undef destroy_window
     END_WITH_TAB;
 }
 
@@ -162,6 +168,10 @@ PYWRAP1(set_options) {
     S(url_color, color_as_int);
     S(repaint_delay, repaint_delay);
     S(input_delay, repaint_delay);
+    S(background_input_delay, repaint_delay);
+    S(resize_debounce_time, repaint_delay);
+    S(io_threads, PyLong_AsUnsignedLong);
+    S(scrollback_in_memory_lines, PyLong_AsUnsignedLong);
     S(macos_option_as_alt, PyObject_IsTrue);
 
     PyObject *chars = PyObject_GetAttrString(args, "select_by_word_characters");
@@ -231,6 +241,12 @@ PYWRAP1(set_logical_dpi) {
     Py_RETURN_NONE;
 }
 
+PYWRAP1(set_latency_tracking) {
+    // Only screens created afterwards track their latency
+    global_state.track_latency = PyObject_IsTrue(args) ? true : false;
+    Py_RETURN_NONE;
+}
+
 PYWRAP1(set_boss) {
     Py_CLEAR(global_state.boss);
     global_state.boss = args;
@@ -241,6 +257,9 @@ PYWRAP1(set_boss) {
 PYWRAP0(destroy_global_data) {
     Py_CLEAR(global_state.tab_bar_render_data.screen);
     Py_CLEAR(global_state.boss);
+    for (size_t t = 0; t < global_state.num_tabs; t++) destroy_tab(global_state.tabs + t);
+    free(global_state.tabs); global_state.tabs = NULL;
+    global_state.num_tabs = 0; global_state.capacity = 0;
     Py_RETURN_NONE;
 }
 
@@ -286,6 +305,7 @@ static PyMethodDef module_methods[] = {
     MW(set_window_render_data, METH_VARARGS),
     MW(update_window_visibility, METH_VARARGS),
     MW(set_boss, METH_O),
+    MW(set_latency_tracking, METH_O),
     MW(set_display_state, METH_VARARGS),
     MW(destroy_global_data, METH_NOARGS),
 
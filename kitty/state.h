@@ -17,7 +17,9 @@ typedef struct {
     unsigned int open_url_modifiers;
     char_type select_by_word_characters[256]; size_t select_by_word_characters_count;
     color_type url_color;
-    double repaint_delay, input_delay;
+    double repaint_delay, input_delay, background_input_delay, resize_debounce_time;
+    unsigned int io_threads;
+    unsigned int scrollback_in_memory_lines;
     bool focus_follows_mouse;
     bool macos_option_as_alt;
     int adjust_line_height_px;
@@ -45,11 +47,21 @@ typedef struct {
     unsigned int length;
 } ClickQueue;
 
+typedef struct {
+    bool is_visible;
+    CursorShape shape;
+    double left, right, top, bottom;
+    color_type color;
+} CursorRenderInfo;
+
 typedef struct {
     unsigned int id;
     bool visible;
     PyObject *title;
     ScreenRenderData render_data;
+    // The cursor as last presented, which is kept while a synchronized
+    // update of the window is pending
+    CursorRenderInfo presented_cursor;
     unsigned int mouse_cell_x, mouse_cell_y;
     WindowGeometry geometry;
     ClickQueue click_queue;
@@ -57,8 +69,8 @@ typedef struct {
 } Window;
 
 typedef struct {
-    unsigned int id, active_window, num_windows;
-    Window windows[MAX_CHILDREN];
+    unsigned int id, active_window, num_windows, capacity;
+    Window *windows;
 } Tab;
 
 #define MAX_KEY_COUNT 512
@@ -66,32 +78,28 @@ typedef struct {
 typedef struct {
     Options opts;
 
-    Tab tabs[MAX_CHILDREN];
-    unsigned int active_tab, num_tabs;
+    Tab *tabs;
+    unsigned int active_tab, num_tabs, capacity;
     ScreenRenderData tab_bar_render_data;
     bool application_focused;
-    double cursor_blink_zero_time, last_mouse_activity_at;
+    double cursor_blink_zero_time, last_mouse_activity_at, last_key_input_at;
     double logical_dpi_x, logical_dpi_y;
     float font_sz_in_pts;
     double mouse_x, mouse_y;
     bool mouse_button_pressed[20];
     int viewport_width, viewport_height;
     double viewport_x_ratio, viewport_y_ratio;
+    bool has_pending_resizes;
+    double last_resize_event_at;
     unsigned int cell_width, cell_height;
     PyObject *application_title;
     PyObject *boss;
     bool is_key_pressed[MAX_KEY_COUNT];
+    bool track_latency;
 } GlobalState;
 
 extern GlobalState global_state;
 
-typedef struct {
-    bool is_visible;
-    CursorShape shape;
-    double left, right, top, bottom;
-    color_type color;
-} CursorRenderInfo;
-
 #define call_boss(name, ...) { \
     PyObject *cret_ = PyObject_CallMethod(global_state.boss, #name, __VA_ARGS__); \
     if (cret_ == NULL) { PyErr_Print(); } \
@@ -101,8 +109,10 @@ typedef struct {
 bool drag_scroll(Window *);
 void draw_borders();
 void draw_cells(ssize_t, ssize_t, float, float, float, float, Screen *, CursorRenderInfo *);
+void draw_rendered_frame(ssize_t, ssize_t, Screen *);
 void draw_cursor(CursorRenderInfo *);
-void update_viewport_size(int, int);
+void update_viewport_size(int, int, int);
+void apply_pending_resize();
 void free_texture(uint32_t*);
 void send_image_to_gpu(uint32_t*, const void*, int32_t, int32_t, bool, bool);
 void send_sprite_to_gpu(unsigned int, unsigned int, unsigned int, uint8_t*);
@@ -25,9 +25,9 @@ is_url_char(uint32_t ch) {
 }
 
 static inline uint32_t
-normalize(uint32_t ch, uint32_t cc1, uint32_t cc2) {
-    uint32_t ans = uc_composition(ch, cc1);
-    if (ans && cc2) ans = uc_composition(ans, cc2);
+normalize(uint32_t ch, const uint32_t *cc, unsigned int num) {
+    uint32_t ans = ch;
+    for (unsigned int i = 0; ans && i < num; i++) ans = uc_composition(ans, cc[i]);
     return ans;
 }
 
@@ -17,8 +17,9 @@ from time import monotonic
 
 from .constants import isosx, iswayland, selection_clipboard_funcs, x11_display, x11_window_id
 from .fast_data_types import (
-    GLSL_VERSION, glfw_get_physical_dpi, glfw_primary_monitor_content_scale,
-    redirect_std_streams, wcwidth as wcwidth_impl
+    GLSL_VERSION, clear_handled_signals, glfw_get_physical_dpi,
+    glfw_primary_monitor_content_scale, redirect_std_streams,
+    wcwidth as wcwidth_impl
 )
 from .rgb import Color, to_color
 
@@ -164,7 +165,7 @@ def set_primary_selection(text):
         text = text.encode('utf-8')
     s = selection_clipboard_funcs()[1]
     if s is None:
-        p = subprocess.Popen(['xsel', '-i', '-p'], stdin=subprocess.PIPE, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        p = subprocess.Popen(['xsel', '-i', '-p'], stdin=subprocess.PIPE, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, preexec_fn=clear_handled_signals)
         p.stdin.write(text), p.stdin.close()
         p.wait()
     else:
@@ -177,7 +178,7 @@ def get_primary_selection():
     g = selection_clipboard_funcs()[0]
     if g is None:
         # We cannot use check_output as we set a SIGCHLD handler to reap zombies
-        ans = subprocess.Popen(['xsel', '-p'], stderr=subprocess.DEVNULL, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE).stdout.read().decode('utf-8')
+        ans = subprocess.Popen(['xsel', '-p'], stderr=subprocess.DEVNULL, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, preexec_fn=clear_handled_signals).stdout.read().decode('utf-8')
         if ans:
             # Without this for some reason repeated pastes dont work
             set_primary_selection(ans)
@@ -204,7 +205,7 @@ def open_cmd(cmd, arg=None):
     if arg is not None:
         cmd = list(cmd)
         cmd.append(arg)
-    return subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, preexec_fn=clear_handled_signals)
 
 
 def open_url(url, program='default'):
@@ -241,7 +241,7 @@ class Window:
     # }}}
 
     def text_for_selection(self):
-        return ''.join(self.screen.text_for_selection())
+        return self.screen.text_for_selection().decode('utf-8', 'replace')
 
     def destroy(self):
         if self.vao_id is not None:
@@ -261,16 +261,22 @@ class Window:
     # actions {{{
 
     def show_scrollback(self):
-        get_boss().display_scrollback(self.buffer_as_ansi().encode('utf-8'))
+        get_boss().display_scrollback(self.screen)
 
     def paste(self, text):
         if text and not self.destroyed:
             if isinstance(text, str):
                 text = text.encode('utf-8')
             if self.screen.in_bracketed_paste_mode:
+                # Written separately, so that large pastes are not copied
                 bpe = BRACKETED_PASTE_END.encode('ascii')
-                text = BRACKETED_PASTE_START.encode('ascii') + text.replace(bpe, b'') + bpe
-            self.write_to_child(text)
+                if bpe in text:
+                    text = text.replace(bpe, b'')
+                self.write_to_child(BRACKETED_PASTE_START.encode('ascii'))
+                self.write_to_child(text)
+                self.write_to_child(bpe)
+            else:
+                self.write_to_child(text)
 
     def copy_to_clipboard(self):
         text = self.text_for_selection()
@@ -308,4 +314,15 @@ class Window:
     def scroll_end(self):
         if self.screen.is_main_linebuf():
             self.screen.scroll(SCROLL_FULL, False)
+
+    def scroll_to_previous_prompt(self):
+        if self.screen.is_main_linebuf():
+            self.screen.scroll_to_prompt(-1)
+
+    def scroll_to_next_prompt(self):
+        if self.screen.is_main_linebuf():
+            self.screen.scroll_to_prompt(1)
+
+    def select_last_command_output(self):
+        self.screen.select_last_command_output()
     # }}}
@@ -7,7 +7,8 @@ from unittest import skipIf
 
 from kitty.config import build_ansi_color_table, defaults
 from kitty.fast_data_types import (
-    REVERSE, ColorProfile, Cursor as C, HistoryBuf, LineBuf
+    REVERSE, ColorProfile, Cursor as C, HistoryBuf, LineBuf, test_byte_ring,
+    test_frame_pacer, test_latency_histogram
 )
 from kitty.utils import sanitize_title, wcwidth
 
@@ -153,9 +154,9 @@ class TestDataTypes(BaseTest):
         l0.add_combining_char(0, '2')
         self.ae(l0[0], ' 12')
         l0.add_combining_char(0, '3')
-        self.ae(l0[0], ' 13')
+        self.ae(l0[0], ' 123')
         self.ae(l0[1], '\0')
-        self.ae(str(l0), ' 13')
+        self.ae(str(l0), ' 123')
         t = 'Testing with simple text'
         lb = LineBuf(2, len(t))
         l0 = lb.line(0)
@@ -369,6 +370,166 @@ class TestDataTypes(BaseTest):
         for i in range(hb.ynum):
             self.ae(hb.line(i), hb3.line(i))
 
+        # lazy rewrap, with only some lines rewrapped before rewrapping again
+        hb = filled_history_buf(5, 5)
+        hb2 = HistoryBuf(20, 2)
+        hb.rewrap(hb2)
+        self.ae(str(hb2.line(0)), '4')
+        self.ae(str(hb2.line(2)), '44')
+        self.assertTrue(hb2.line(1).is_continued())
+        hb3 = HistoryBuf(5, 5)
+        hb2.rewrap(hb3)
+        self.ae(hb3.count, 5)
+        for i in range(hb.ynum):
+            self.ae(hb.line(i), hb3.line(i))
+        hb2 = HistoryBuf(4, 2)
+        hb.rewrap(hb2)
+        self.ae(hb2.count, 4)
+        self.ae([str(hb2.line(i)) for i in range(4)], ['4', '44', '44', '3'])
+
+    @skipIf(not os.path.exists('/proc/self/statm'), 'No /proc/self/statm')
+    def test_historybuf_memory(self):
+        def memory():
+            # The virtual memory size and the resident set size
+            with open('/proc/self/statm') as f:
+                return [int(x) * os.sysconf('SC_PAGE_SIZE') for x in f.read().split()[:2]]
+
+        # Memory for lines is allocated only as they are added
+        before = memory()
+        hb = HistoryBuf(1000000, 200)
+        for b, a in zip(before, memory()):
+            self.assertLess(a - b, 1024 * 1024)
+        self.ae(hb.num_segments, 0)
+        lb = filled_line_buf(1, 200)
+        for i in range(1000):
+            hb.push(lb.line(0))
+        self.ae(hb.num_segments, 4)
+        # Changing the size does not copy lines and frees the segments of evicted lines
+        hb.change_num_of_lines(300)
+        self.ae(hb.count, 300)
+        self.ae(hb.num_segments, 2)
+        self.ae(str(hb.line(299)), '0' * 200)
+        hb.change_num_of_lines(1000000)
+        for i in range(300):
+            hb.push(lb.line(0))
+        self.ae(hb.count, 600)
+        self.ae(hb.num_segments, 4)
+
+    def test_historybuf_compression(self):
+        lb = LineBuf(1, 20)
+        hb = HistoryBuf(3000, 20)
+        c = C()
+        lines = []
+        for i in range(2000):
+            c.bold = i % 3 == 0
+            c.fg = (i % 256) << 8 | 1
+            t = str(i) * (i % 7)
+            lines.append(t[:20])
+            l = lb.line(0)
+            l.clear_text(0, 20)
+            l.set_text(t[:20], 0, len(t[:20]), c)
+            hb.push(l)
+        ansi = [hb.line(i).as_ansi() for i in range(hb.count)]
+        stats = hb.compression_stats(True)
+        # All but the two newest segments are compressed
+        self.ae(stats['segments'], 8)
+        self.ae(stats['compressed'], 6)
+        self.assertLess(stats['compressed_size'] * 10, stats['raw_size'])
+        for i in range(hb.count):
+            self.ae(str(hb.line(i)), lines[-1 - i])
+            self.ae(hb.line(i).as_ansi(), ansi[i])
+        self.assertLessEqual(hb.compression_stats()['decompressed'], 4)
+        # Decompressed lines are marked dirty, so that they are re-rendered.
+        # Up to four segments may not have been freed since being compressed.
+        self.assertGreaterEqual(len(hb.dirty_lines()), 2 * 256)
+        hb2 = HistoryBuf(hb.ynum, hb.xnum)
+        hb.rewrap(hb2)
+        self.ae(hb2.compression_stats(True)['compressed'], 6)
+        self.ae([str(hb2.line(i)) for i in range(hb2.count)], [str(hb.line(i)) for i in range(hb.count)])
+        hb.change_num_of_lines(300)
+        self.ae(str(hb.line(299)), lines[-300])
+        self.ae(hb.compression_stats(True)['compressed'], 0)
+
+    def test_historybuf_line_storage(self):
+        lb = LineBuf(1, 200)
+        hb = HistoryBuf(2000, 200)
+        c, bg = C(), C()
+        bg.bg = 3 << 8 | 1
+        for i in range(1000):
+            l = lb.line(0)
+            l.clear_text(0, 200)
+            l.apply_cursor(c, 0, 200, True)
+            t = str(i)
+            l.set_text(t, 0, len(t), c)
+            if i % 3 == 1:
+                l.apply_cursor(bg, 10, 190, True)
+            elif i % 3 == 2:
+                l.set_char(199, 'x', 1, c)
+            hb.push(l)
+        for i in range(1000):
+            l, n = hb.line(i), 999 - i
+            self.ae(str(l), str(n) + (' ' * (199 - len(str(n))) + 'x' if n % 3 == 2 else ''))
+            self.ae(l.cursor_from(199).bg, bg.bg if n % 3 == 1 else 0)
+        # Trailing blanks are not stored
+        stats = hb.compression_stats(True)
+        self.assertLess(stats['raw_size'] * 2, stats['compressed'] * 256 * 200 * 28)
+
+    def test_historybuf_spill(self):
+        lb = LineBuf(1, 20)
+        hb = HistoryBuf(5000, 20)
+        hb.in_memory_lines = 300
+        c = C()
+        for i in range(3000):
+            l = lb.line(0)
+            l.clear_text(0, 20)
+            l.set_text(str(i), 0, len(str(i)), c)
+            hb.push(l)
+        stats = hb.compression_stats(True)
+        # Segments older than the newest 300 lines are on disk
+        self.ae(stats['spilled'], stats['segments'] - 2)
+        self.ae([str(hb.line(i)) for i in range(hb.count)], [str(i) for i in range(2999, -1, -1)])
+        self.assertLessEqual(hb.compression_stats()['decompressed'], 4)
+        hb2 = HistoryBuf(hb.ynum, 7)
+        hb.rewrap(hb2)
+        self.ae(str(hb2.line(2999)), '0')
+        hb.change_num_of_lines(600)
+        stats = hb.compression_stats()
+        self.assertLessEqual(stats['spilled'], stats['segments'] - 2)
+        self.ae([str(hb.line(i)) for i in range(hb.count)], [str(i) for i in range(2999, 2399, -1)])
+
+    def test_byte_ring(self):
+        # Tiny rings wrap around on almost every chunk and are full or empty
+        # most of the time, exercising the races between the two threads
+        for total, capacity, max_chunk in ((20000, 1, 1), (200000, 16, 7), (1000000, 64, 200), (3000000, 4096, 5000), (30000000, 1024 * 1024, 65536)):
+            test_byte_ring(total, capacity, max_chunk, capacity * 31 + max_chunk)
+        self.assertRaises(ValueError, test_byte_ring, 100, 48, 10, 1)
+
+    def test_frame_pacer(self):
+        def run(*events):
+            delays, stats = test_frame_pacer(events, 0.003, 0.01)
+            return [round(d, 6) for d in delays], stats
+
+        # The echo of a key press is parsed and shown right away
+        delays, stats = run(('frame', 1), ('key', 1.5), ('input', 1.501, 5, True), ('frame', 1.502))
+        self.ae(delays, [0, 0, 0])
+        self.ae(stats['frames'], {'normal': 1, 'interactive': 1, 'throughput': 0})
+        # but not input in unfocused windows, large input or input long after the key press
+        delays, stats = run(('key', 1), ('input', 1.001, 5, False), ('input', 1.001, 100000, True), ('input', 3, 5, True))
+        self.ae(delays, [0.003] * 3)
+        self.ae(stats['interactive_inputs'], 0)
+        # Frames are stretched while a lot of input is parsed, and back to
+        # normal once it stops
+        events = []
+        for t in range(1, 7):
+            events += [('input', t, 100000, False), ('frame', t)]
+        delays, stats = run(*events)
+        self.ae(stats['mode'], 'throughput')
+        self.ae(stats['repaint_delay'], 0.05)
+        delays, stats = run(*(events + [('frame', 6.01), ('input', 7, 10, False), ('frame', 7), ('frame', 7.005)]))
+        self.ae(delays[-4:], [0.04, 0.003, 0, 0.005])
+        self.ae(stats['frames'], {'normal': 3, 'interactive': 0, 'throughput': 6})
+        self.ae(stats['repaint_delay'], 0.01)
+
     def test_ansi_repr(self):
         lb = filled_line_buf()
         l0 = lb.line(0)
@@ -395,3 +556,16 @@ class TestDataTypes(BaseTest):
         a = []
         hb.as_ansi(a.append)
         self.ae(a, ['\x1b[0m' + str(hb.line(i)) + '\n' for i in range(hb.count - 1, -1, -1)])
+
+    def test_latency_histogram(self):
+        # Every value falls in a bucket whose upper limit is within 1/16 of it
+        for val in (0, 1e-6, 31e-6, 32e-6, 33e-6, 0.001, 0.0167, 1.5, 3600):
+            stats = test_latency_histogram([val])
+            limit = stats['buckets'][0][0]
+            self.assertTrue(val - 1e-6 <= limit <= val * 17 / 16 + 1e-6, (val, limit))
+        stats = test_latency_histogram([0.001] * 90 + [0.01] * 9 + [1])
+        self.ae((stats['count'], stats['max']), (100, 1))
+        self.ae([count for limit, count in stats['buckets']], [90, 9, 1])
+        for name, val in (('p50', 0.001), ('p90', 0.001), ('p99', 0.01), ('p999', 1)):
+            self.assertTrue(val <= stats[name] <= val * 17 / 16, name)
+        self.assertIsNone(test_latency_histogram([])['p50'])
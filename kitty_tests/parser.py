@@ -163,6 +163,14 @@ class TestParser(BaseTest):
         c.clear()
         pb('\033[?1$p', ('report_mode_status', 1, 1))
         self.ae(c.wtcbuf, b'\033[?1;2$y')
+        c.clear()
+        pb('\033[?2026h', ('screen_set_mode', 2026, 1))
+        pb('\033[?2026$p', ('report_mode_status', 2026, 1))
+        self.ae(c.wtcbuf, b'\033[?2026;1$y')
+        c.clear()
+        pb('\033[?2026l', ('screen_reset_mode', 2026, 1))
+        pb('\033[?2026$p', ('report_mode_status', 2026, 1))
+        self.ae(c.wtcbuf, b'\033[?2026;2$y')
         pb('\033[2;4r', ('screen_set_margins', 2, 4))
         self.ae(s.margin_top, 1), self.ae(s.margin_bottom, 3)
         pb('\033[r', ('screen_set_margins', 0, 0))
@@ -247,3 +255,19 @@ class TestParser(BaseTest):
         e('s=', 'Malformed graphics control block, expecting an integer value')
         e('s==', 'Malformed graphics control block, expecting an integer value for key: s')
         e('s=1=', 'Malformed graphics control block, expecting a comma or semi-colon after a value, found: 0x3d')
+
+    def test_jump_scroll(self):
+        # Parsing in one large batch skips copying lines into history that
+        # are evicted in the same batch, the result must be identical to
+        # parsing a byte at a time
+        data = ''.join('line {} {}\n'.format(i, 'x' * (i % 13)) for i in range(100))
+        data += '\033[31mred\033[m\r\nニチ\n' + ''.join('{}\x0b\r'.format(i) for i in range(50)) + 'ab\x0cc'
+        data = data.encode('utf-8')
+        a, b = self.create_screen(scrollback=7), self.create_screen(scrollback=7)
+        parse_bytes(a, data)
+        for i in range(len(data)):
+            parse_bytes(b, data[i:i+1])
+        self.ae(str(a.historybuf), str(b.historybuf))
+        self.ae(str(a.linebuf), str(b.linebuf))
+        self.ae(a.historybuf.count, 7)
+        self.ae((a.cursor.x, a.cursor.y), (b.cursor.x, b.cursor.y))
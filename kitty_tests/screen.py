@@ -6,7 +6,7 @@ import os
 from unittest import skipIf
 
 from . import BaseTest
-from kitty.fast_data_types import DECAWM, IRM, Cursor, DECCOLM, DECOM
+from kitty.fast_data_types import DECAWM, IRM, Cursor, DECCOLM, DECOM, HistoryBuf, parse_bytes
 
 
 class TestScreen(BaseTest):
@@ -93,6 +93,130 @@ class TestScreen(BaseTest):
         self.ae(str(s.line(4)), 'a\u0306b1\u030623')
         self.ae((s.cursor.x, s.cursor.y), (2, 4))
 
+    def test_grapheme_clusters(self):
+        s = self.create_screen()
+        cluster = 'a\u0301\u0302\u0303\U0001d167'
+        s.draw(cluster + 'b' + cluster)
+        self.ae(str(s.line(0)), cluster + 'b' + cluster)
+        self.ae(s.cursor.x, 3)
+        s.draw('\u0304' * 10)
+        self.ae(str(s.line(0)), cluster + 'b' + cluster + '\u0304' * 4)
+        s.resize(s.lines, 2)
+        self.ae(str(s.line(0)), cluster + 'b')
+        self.ae(str(s.line(1)), cluster + '\u0304' * 4)
+
+    def test_grapheme_cluster_reclamation(self):
+        # Once more distinct clusters have been used than fit in the table,
+        # the entries of the clusters no longer on screen or in the scrollback are re-used
+        from kitty.fast_data_types import cluster_table_stats
+        s = self.create_screen(cols=10, lines=2, scrollback=20)
+        marks = [chr(c) for c in range(0x300, 0x370) if c != 0x34f]
+        n = len(marks)
+
+        def cluster(i):
+            return 'a' + marks[i % n] + marks[(i // n) % n] + marks[i // (n * n)]
+
+        total = 70000
+        s.draw(''.join(map(cluster, range(total))))
+        self.assertLessEqual(cluster_table_stats()['size'], 65536)
+        self.ae(str(s.line(s.cursor.y)), ''.join(map(cluster, range(total - 10, total))))
+        hb = s.historybuf
+        for y in range(hb.count):
+            end = total - 10 * (y + 1 + s.cursor.y)
+            self.ae(str(hb.line(y)), ''.join(map(cluster, range(end - 10, end))))
+
+    def test_text_for_selection(self):
+        s = self.create_screen()
+
+        def text(start, end):
+            s.start_selection(*start), s.update_selection(*end, True)
+            ans = s.text_for_selection()
+            chunks = []
+            s.text_for_selection(lambda mv: chunks.append(bytes(mv)))
+            self.ae(ans, b''.join(chunks))
+            return ans.decode('utf-8')
+
+        s.draw('ab\u4e00cdefg')
+        s.carriage_return(), s.linefeed()
+        s.draw('xyz')
+        self.ae(text((0, 0), (0, 0)), '')
+        self.ae(text((4, 2), (1, 0)), 'b\u4e00cdefg\nxyz')
+        for i in range(5):
+            s.carriage_return(), s.linefeed()
+        self.ae(str(s.historybuf.line(2)), 'ab\u4e00c')
+        # A selection that starts in the scrollback and ends on screen
+        s.scroll(3, True)
+        s.start_selection(0, 0)
+        s.scroll(3, False)
+        s.update_selection(2, 0, True)
+        self.ae(s.text_for_selection().decode('utf-8'), 'ab\u4e00cdefg\nxyz\n')
+
+    def test_search(self):
+        from kitty.search import search
+        s = self.create_screen(cols=10, lines=3, scrollback=2000)
+        for i in range(1000):
+            s.draw('line %d' % i)
+            s.carriage_return(), s.linefeed()
+        s.draw('0123456789abc \u4e00 end')
+        s.historybuf.compression_stats(True)
+        self.ae(search(s, 'line 999'), [(0, 0, 7, 0)])
+        self.ae(search(s, 'line 0'), [(0, -999, 5, -999)])
+        self.ae(len(search(s, 'line 5')), 111)
+        self.ae(search(s, 'line 5', limit=2), [(0, -401, 5, -401), (0, -400, 5, -400)])
+        self.ae(search(s, 'nothing'), [])
+        # Matches in wrapped lines and wide chars
+        self.ae(search(s, '89abc'), [(8, 1, 2, 2)])
+        self.ae(search(s, '\u4e00 e'), [(4, 2, 7, 2)])
+        self.ae(search(s, 'c \u4e00'), [(2, 2, 5, 2)])
+        self.ae(search(s, 'LINE 12', case_sensitive=False), search(s, 'line 12'))
+        self.ae(search(s, r'line 9\d9$', regex=True), [(0, -y, 7, -y) for y in range(90, -1, -10)])
+        self.ae(search(s, r'9a|4\d4', regex=True), [(5, -y, 7, -y) for y in range(595, 504, -10)] + [(9, 1, 0, 2)])
+        s.select_range(*search(s, 'line 500')[0])
+        self.ae(s.text_for_selection(), b'line 500')
+        self.ae(s.scrolled_by, 500)
+
+    def test_prompt_marks(self):
+        s = self.create_screen(cols=10, lines=5, scrollback=20)
+        for i in range(15):
+            parse_bytes(s, ('\x1b]133;A\x07$ cmd%d\r\n\x1b]133;C\x07' % i).encode('ascii'))
+            parse_bytes(s, ('out%d\r\n' % i).encode('ascii') * (i % 3))
+        parse_bytes(s, b'\x1b]133;A\x07$ ')
+
+        def prompts(num):
+            ans = []
+            while s.scroll_to_prompt(num):
+                ans.append(str(s.historybuf.line(s.scrolled_by - 1) if s.scrolled_by else s.line(0)))
+            return ans
+
+        self.assertTrue(s.select_last_command_output())
+        self.ae(s.text_for_selection(), b'out14\nout14')
+        # The prompts of cmd0 to cmd2 have been pushed out of the scrollback
+        self.ae(prompts(-1), ['$ cmd%d' % i for i in range(13, 2, -1)])
+        self.ae(prompts(1), ['$ cmd%d' % i for i in range(4, 14)] + ['out13'])
+        # Rewrapping into a buffer of the same size keeps the marks
+        hb = HistoryBuf(s.historybuf.ynum, s.columns)
+        s.historybuf.rewrap(hb), hb.rewrap(s.historybuf)
+        self.ae(prompts(-1), ['$ cmd%d' % i for i in range(13, 2, -1)])
+        self.ae(prompts(1), ['$ cmd%d' % i for i in range(4, 14)] + ['out13'])
+        s.resize(5, 20)
+        self.ae(prompts(-1), ['$ cmd%d' % i for i in range(13, 3, -1)])
+        self.ae(prompts(1), ['$ cmd%d' % i for i in range(5, 15)])
+        s.resize(5, 4)
+        self.ae(prompts(-1), ['$ cm'] * 5)
+        self.ae(prompts(1), ['$ cm'] * 4 + ['4'])
+        self.assertTrue(s.select_last_command_output())
+        self.ae(s.text_for_selection(), b'out14\nout14')
+        parse_bytes(s, b'ls\r\n\x1b]133;C\x07')
+        self.assertFalse(s.select_last_command_output())
+        parse_bytes(s, b'out')
+        self.assertTrue(s.select_last_command_output())
+        self.ae(s.text_for_selection(), b'out')
+        # Erasing the screen erases the marks of its lines
+        parse_bytes(s, b'\r\n\x1b]133;C\x07o\r\n\x1b]133;C\x07o\r\n\x1b[H\x1b[2J')
+        parse_bytes(s, b'\x1b]133;A\x07$\r\n\x1b]133;C\x07out\r\n\x1b]133;A\x07$ ')
+        self.assertTrue(s.select_last_command_output())
+        self.ae(s.text_for_selection(), b'out')
+
     @skipIf('ANCIENT_WCWIDTH' in os.environ, 'wcwidth() is too old')
     def test_char_manipulation(self):
         s = self.create_screen()
@@ -230,6 +354,21 @@ class TestScreen(BaseTest):
         s.resize(5, 2)
         self.ae(str(s.linebuf), '88\n88\n99\n99\n9')
 
+    def test_resize_during_pending_update(self):
+        s = self.create_screen()
+        parse_bytes(s, b'\x1b[?2026h')
+        self.assertTrue(s.update_pending)
+        s.draw('a' * s.columns * 2)
+        # The frame drawn before the update started has the old size, so the
+        # update ends, rather than being held back against it
+        s.resize(s.lines, s.columns * 2)
+        self.assertFalse(s.update_pending)
+        self.ae(str(s.line(0)), 'a' * s.columns)
+        parse_bytes(s, b'\x1b[?2026h')
+        self.assertTrue(s.update_pending)
+        parse_bytes(s, b'\x1b[?2026l')
+        self.assertFalse(s.update_pending)
+
     def test_cursor_after_resize(self):
         s = self.create_screen()
         s.draw('123'), s.linefeed(), s.carriage_return(), s.draw('123'), s.linefeed(), s.carriage_return()